@@ -0,0 +1,31 @@
+#!/bin/bash
+#
+# Synthetic measurement feed
+# --------------------------
+#
+# Goal: testing the closed loop mode (-feed) without a wireless link.
+# Simulates a RSSI reading which drops by 1dB per dB of attenuation, as
+# read from the attenuation log, plus some noise.
+#
+# Usage:
+#   ./synthetic-feed.sh att.log feed.txt &
+#   sudo attenuator_lab_brick -l att.log -feed feed.txt -target -60
+
+# Parameters:
+ATT_LOG=${1:-attenuator.log}			# log written with -l
+FEED=${2:-feed.txt}				# file or fifo read with -feed
+TX_POWER=${3:--20}				# dBm, rssi at 0dB attenuation
+NOISE=${4:-1}					# dB, maximal noise amplitude
+INTERVAL=${5:-0.1}				# seconds between two readings
+
+[ -p "$FEED" ] || : > "$FEED"
+
+while true; do
+	ATT=$(grep -v '^#' "$ATT_LOG" 2>/dev/null | tail -n 1 | cut -d ',' -f 2)
+	awk -v tx="$TX_POWER" -v att="${ATT:-0}" -v noise="$NOISE" \
+	    -v seed="$RANDOM" 'BEGIN {
+		srand(seed);
+		printf "%.2f\n", tx - att + (2 * rand() - 1) * noise
+	}' >> "$FEED"
+	sleep "$INTERVAL"
+done
@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <math.h>
+#include <zlib.h>
+#include "analyze.h"
+#include "timing.h"
+#include "control.h"
+#include "input.h"
+
+/*
+ * add a sample to running statistics
+ */
+static void
+stats_add(struct running_stats *rs, double x)
+{
+	double delta;
+
+	if (rs->count == 0 || x < rs->min)
+		rs->min = x;
+	if (rs->count == 0 || x > rs->max)
+		rs->max = x;
+	rs->count++;
+	delta = x - rs->mean;
+	rs->mean += delta / rs->count;
+	rs->m2 += delta * (x - rs->mean);
+}
+
+static double
+stats_stddev(struct running_stats *rs)
+{
+	return rs->count > 1 ? sqrt(rs->m2 / (rs->count - 1)) : 0;
+}
+
+/*
+ * parse a log entry <sec>.<nsec>,<attenuation in dB>
+ * @param line: line of the log
+ * @param t: storage for the timestamp in nanoseconds
+ * @param att: storage for the attenuation in MULTIPLIER_STEP units
+ * @return: 0 on success, 1 if malformed
+ */
+static int
+parse_entry(char *line, unsigned long long *t, int *att)
+{
+	unsigned long long ns = 0;
+	char *pos, *end;
+	int digits = 0;
+
+	*t = strtoull(line, &end, 10);
+	if (end == line)
+		return 1;
+	pos = end;
+	if (*pos == '.')
+		for (pos++; isdigit((unsigned char)*pos); pos++)
+			if (digits++ < 9)
+				ns = ns * 10 + (*pos - '0');
+	for (; digits < 9; digits++)
+		ns *= 10;
+	*t = *t * NSEC_PER_SEC + ns;
+
+	if (*pos != ',')
+		return 1;
+	pos++;
+	*att = (int)floor(strtod(pos, &end) * MULTIPLIER_STEP + 0.5);
+	return end == pos;
+}
+
+/*
+ * parse an overrun record #<timestamp>,late|skipped,<index>,<lateness>
+ * @param line: line of the log without the leading '#'
+ * @param index: storage for the step index
+ * @return: 1 if late, 2 if skipped, 0 for any other comment
+ */
+static int
+parse_overrun(char *line, unsigned long *index)
+{
+	char *pos = strchr(line, ',');
+	int type;
+
+	if (pos == NULL)
+		return 0;
+	pos++;
+	if (strncmp(pos, "late,", 5) == 0)
+		type = 1;
+	else if (strncmp(pos, "skipped,", 8) == 0)
+		type = 2;
+	else
+		return 0;
+	*index = strtoul(strchr(pos, ',') + 1, NULL, 10);
+	return type;
+}
+
+/*
+ * add the deviation of a step from its intended length to the jitter
+ * histogram
+ */
+static void
+add_jitter(struct analysis *a, double error)
+{
+	unsigned long long us = (unsigned long long)fabs(error / NSEC_PER_USEC);
+	int bucket = 0;
+
+	while (us && bucket < JITTER_BUCKETS - 1) {
+		us >>= 1;
+		bucket++;
+	}
+	a->hist[bucket]++;
+}
+
+/*
+ * add the offset between log and schedule time at the start of a step
+ * @param x: schedule time since the start of the run in nanoseconds
+ * @param drift: log time minus schedule time in nanoseconds
+ */
+static void
+add_drift(struct analysis *a, double x, double drift)
+{
+	x /= NSEC_PER_SEC;
+	a->sx += x;
+	a->sy += drift / NSEC_PER_SEC;
+	a->sxx += x * x;
+	a->sxy += x * drift / NSEC_PER_SEC;
+	a->drift_points++;
+	if (fabs(drift) > fabs(a->max_drift))
+		a->max_drift = drift;
+	a->last_drift = drift;
+}
+
+/*
+ * print the results of a log analysis
+ */
+static void
+print_analysis(char *path, struct analysis *a, struct schedule *s,
+	       struct user_data *ud)
+{
+	double slope, denom;
+	int i;
+
+	printf(INFO "%s: %llu lines, %llu entries, %llu malformed, "
+	       "%llu late and %llu skipped steps recorded\n", path, a->lines,
+	       a->entries, a->malformed, a->late, a->skipped);
+
+	if (a->interval.count)
+		printf(INFO "interval: min %.3f ms, mean %.3f ms, max %.3f ms, "
+		       "stddev %.3f ms\n", a->interval.min / NSEC_PER_MSEC,
+		       a->interval.mean / NSEC_PER_MSEC,
+		       a->interval.max / NSEC_PER_MSEC,
+		       stats_stddev(&a->interval) / NSEC_PER_MSEC);
+
+	if (s == NULL) {
+		printf(INFO "no schedule given, intended intervals are unknown\n");
+		return;
+	}
+
+	printf(INFO "%llu runs, %llu steps checked against %lu schedule steps, "
+	       "%llu entries outside of a run\n", a->runs, a->checked, s->count,
+	       a->unmatched);
+	if (a->mismatches)
+		printf(WARN "%llu values differ from the schedule, first in "
+		       "line %llu\n", a->mismatches, a->first_mismatch);
+	else
+		printf(INFO "all values match the schedule\n");
+
+	if (a->checked == 0)
+		return;
+
+	printf(INFO "intended interval: mean %.3f ms, actual interval: "
+	       "mean %.3f ms\n", a->intended.mean / NSEC_PER_MSEC,
+	       a->actual.mean / NSEC_PER_MSEC);
+	printf(INFO "interval error: mean %+.3f ms, stddev %.3f ms, "
+	       "early %.3f ms, late %.3f ms\n", a->error.mean / NSEC_PER_MSEC,
+	       stats_stddev(&a->error) / NSEC_PER_MSEC,
+	       -a->error.min / NSEC_PER_MSEC, a->error.max / NSEC_PER_MSEC);
+
+	denom = a->drift_points * a->sxx - a->sx * a->sx;
+	slope = denom > 0 ? (a->drift_points * a->sxy - a->sx * a->sy) / denom
+			  : 0;
+	printf(INFO "drift: max %+.3f ms, at end %+.3f ms, rate %+.1f ppm\n",
+	       a->max_drift / NSEC_PER_MSEC, a->last_drift / NSEC_PER_MSEC,
+	       slope * 1e6);
+
+	printf(INFO "jitter histogram (deviation from intended interval):\n");
+	for (i = 0; i < JITTER_BUCKETS; i++) {
+		if (a->hist[i] == 0)
+			continue;
+		if (i == JITTER_BUCKETS - 1)
+			printf("\t>= %8lu us: %12llu (%5.1f%%)\n", 1UL << (i - 1),
+			       a->hist[i], 100.0 * a->hist[i] / a->checked);
+		else
+			printf("\t<  %8lu us: %12llu (%5.1f%%)\n", 1UL << i,
+			       a->hist[i], 100.0 * a->hist[i] / a->checked);
+	}
+
+	printf(INFO "fidelity score: %.1f%% of steps with the intended value "
+	       "within %lu us\n", 100.0 * a->in_time / a->checked,
+	       ud->tolerance);
+}
+
+/*
+ * check how faithfully a log written with -l followed its schedule. The log
+ * is streamed in one pass, so logs of any size are analyzed in constant
+ * memory. Without a schedule only the intervals between entries are
+ * reported. With a schedule every entry is matched to the next expected
+ * step, a run starts at an entry with the value of the first step and ends
+ * after the last one. Steps dropped by the skip overrun policy are taken
+ * from the overrun records in the log. A value differing from the expected
+ * step, but matching the first one, starts a new run.
+ * @param path: path to the log file
+ * @param s: schedule the log was written from, may be NULL
+ * @param ud: user data struct holding tolerance and speed
+ * @return: 0 on success, 1 on error
+ */
+int
+analyze_log(char *path, struct schedule *s, struct user_data *ud)
+{
+	gzFile fp;
+	char line[ANALYZE_LINE];
+	struct analysis a;
+	unsigned long long t, prev_t = 0, run_t = 0, tolerance;
+	unsigned long index;
+	long cur, prev = -1, next = -1, first = 0;
+	int att, matched, prev_matched = 0, have_prev = 0, measure;
+	double speed, intended, error;
+
+	memset(&a, 0, sizeof(struct analysis));
+	speed = ud->speed > 0 ? ud->speed : 1;
+	tolerance = (unsigned long long)ud->tolerance * NSEC_PER_USEC;
+
+	/* segments compressed by the logger are read transparently */
+	fp = gzopen(path, "r");
+	if (fp == NULL) {
+		printf(ERR "unable to open log for reading: %s\n", path);
+		return 1;
+	}
+	gzbuffer(fp, ANALYZE_BUFFER);
+
+	if (s && s->count == 0) {
+		printf(ERR "schedule holds no steps\n");
+		gzclose(fp);
+		return 1;
+	}
+
+	while (gzgets(fp, line, ANALYZE_LINE)) {
+		a.lines++;
+		if (line[0] == '#') {
+			switch (parse_overrun(line + 1, &index)) {
+			case 1:
+				a.late++;
+				break;
+			case 2:
+				a.skipped++;
+				if (s && prev >= 0 && (long)index >= prev)
+					next = index + 1;
+				break;
+			}
+			continue;
+		}
+		if (line[0] == '\n' || line[0] == '\0')
+			continue;
+		if (parse_entry(line, &t, &att)) {
+			a.malformed++;
+			continue;
+		}
+		a.entries++;
+
+		if (have_prev)
+			stats_add(&a.interval, (double)(t - prev_t));
+
+		if (s == NULL) {
+			prev_t = t;
+			have_prev = 1;
+			continue;
+		}
+
+		/* find the step this entry belongs to */
+		cur = -1;
+		matched = 0;
+		measure = prev >= 0;
+		if (prev >= 0) {
+			cur = next >= 0 ? next : prev + 1;
+			if (cur >= (long)s->count) {
+				/* end of the schedule, a repetition or the reset */
+				cur = att == s->entries[0].attenuation ? 0 : -1;
+			} else if (att == s->entries[cur].attenuation) {
+				matched = 1;
+			} else if (att == s->entries[0].attenuation) {
+				/* restarted, the gap tells nothing about timing */
+				cur = 0;
+				measure = 0;
+			} else {
+				a.mismatches++;
+				if (a.first_mismatch == 0)
+					a.first_mismatch = a.lines;
+			}
+		} else if (att == s->entries[0].attenuation) {
+			cur = 0;
+		}
+		if (cur == 0)
+			matched = att == s->entries[0].attenuation;
+
+		if (measure) {
+			if (cur > prev)
+				intended = s->entries[cur].start
+					   - s->entries[prev].start;
+			else
+				intended = s->length - s->entries[prev].start;
+			intended /= speed;
+			error = (double)(t - prev_t) - intended;
+			stats_add(&a.intended, intended);
+			stats_add(&a.actual, (double)(t - prev_t));
+			stats_add(&a.error, error);
+			add_jitter(&a, error);
+			a.checked++;
+			if (prev_matched && fabs(error) <= tolerance)
+				a.in_time++;
+		}
+
+		if (cur < 0) {
+			a.unmatched++;
+		} else if (cur == 0) {
+			run_t = t;
+			first = cur;
+		} else {
+			/* the reset to 0dB after the last step is no run */
+			if (prev == first)
+				a.runs++;
+			add_drift(&a, (s->entries[cur].start
+				       - s->entries[first].start) / speed,
+				  (double)(t - run_t) - (s->entries[cur].start
+				  - s->entries[first].start) / speed);
+		}
+
+		prev = cur;
+		prev_t = t;
+		prev_matched = matched;
+		have_prev = 1;
+		next = -1;
+	}
+	gzclose(fp);
+
+	print_analysis(path, &a, s, ud);
+	return 0;
+}
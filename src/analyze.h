@@ -0,0 +1,53 @@
+#ifndef _ANALYZE_H_
+#define _ANALYZE_H_
+
+#include "input.h"
+#include "schedule.h"
+
+/* <1us, then one bucket per power of two up to 1s and one above */
+#define JITTER_BUCKETS 22
+#define ANALYZE_LINE 256
+#define ANALYZE_BUFFER (1 << 16)
+
+/* running mean and variance, updated per sample */
+struct running_stats
+{
+	unsigned long long count;
+	double mean;
+	double m2;
+	double min;
+	double max;
+};
+
+/*
+ * results of a log analysis. Memory use does not depend on the size of
+ * the log, every value is updated while streaming through it.
+ */
+struct analysis
+{
+	unsigned long long lines;
+	unsigned long long entries;
+	unsigned long long malformed;
+	unsigned long long late;
+	unsigned long long skipped;
+	unsigned long long runs;
+	unsigned long long checked;
+	unsigned long long in_time;
+	unsigned long long mismatches;
+	unsigned long long first_mismatch;
+	unsigned long long unmatched;
+	struct running_stats interval;
+	struct running_stats intended;
+	struct running_stats actual;
+	struct running_stats error;
+	unsigned long long hist[JITTER_BUCKETS];
+	/* drift against schedule time, fitted by least squares */
+	double sx, sy, sxx, sxy;
+	unsigned long long drift_points;
+	double max_drift;
+	double last_drift;
+};
+
+int analyze_log(char *path, struct schedule *s, struct user_data *ud);
+
+#endif
@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include "batch.h"
+#include "mem.h"
+#include "timing.h"
+#include "control.h"
+#include "input.h"
+#include "LDAhid.h"
+
+#define LINE_LENGTH 1024
+
+/*
+ * split a manifest row into arguments like a shell without quoting,
+ * argv[0] is set to the name of the manifest
+ * @return: number of arguments
+ */
+static int
+split_row(char *line, char *name, char **argv)
+{
+	int argc = 0;
+	char *pos = line;
+
+	argv[argc++] = name;
+	while (argc < BATCH_MAX_ARGS) {
+		while (isspace((unsigned char)*pos))
+			pos++;
+		if (*pos == '\0' || *pos == '#')
+			break;
+		argv[argc++] = pos;
+		while (*pos && !isspace((unsigned char)*pos))
+			pos++;
+		if (*pos)
+			*pos++ = '\0';
+	}
+	return argc;
+}
+
+/*
+ * set the options of a round and load its schedule
+ * @return: 0 on success, 1 on error
+ */
+static int
+load_round(char *path, struct batch_round *r, int argc, char **argv)
+{
+	double pause = 0;
+	int i, res;
+
+	if (!get_parameters(argc, argv, &r->ud))
+		return 1;
+	for (i = 1; i < argc - 1; i++)
+		if (strcmp(argv[i], "-pause") == 0)
+			pause = atof(argv[i + 1]);
+	if (pause < 0) {
+		printf(ERR "%s:%u: pause has to be positive\n", path, r->line);
+		return 1;
+	}
+	r->serial = r->ud.serial_number;
+
+	if (r->ud.cont || r->ud.closed_loop || r->ud.checkpoint[0]
+	    || r->ud.resume[0]) {
+		printf(ERR "%s:%u: rounds have to end, -r, -feed, -checkpoint "
+		       "and -resume are not supported\n", path, r->line);
+		return 1;
+	}
+
+	if (r->ud.keyframe)
+		res = keyframe_load(r->ud.path, &r->ks, &r->ud);
+	else if (r->ud.scenario)
+		res = scenario_load(r->ud.path, &r->sc);
+	else if (r->ud.file)
+		res = schedule_load(r->ud.path, &r->sched, &r->ud);
+	else if (r->ud.simple || r->ud.ramp || r->ud.triangle)
+		res = 0;
+	else {
+		printf(ERR "%s:%u: round sets no attenuation\n", path, r->line);
+		return 1;
+	}
+
+	if (res == 0)
+		log_open(&r->ud);
+	/* in the time unit of the round options, not of a schedule header */
+	r->pause = (unsigned long long)(pause * time_unit_ns(&r->ud));
+	return res;
+}
+
+/*
+ * read a batch manifest. Every row holds the options of one round in the
+ * same form as on the command line, e.g.
+ * ms -n 12655 -f cct50.csv -rr 2 -l cct50.log -pause 5000
+ * -n assigns the device, the first one is used without it. -pause is the
+ * time to wait after the round, in its time unit. All schedules are loaded
+ * and checked before returning, so no file is read between rounds.
+ * @param path: path to the manifest
+ * @param b: batch to fill
+ * @param quiet: 1 to suppress [INFO] output of all rounds
+ * @return: 0 on success, 1 on error
+ */
+int
+batch_load(char *path, struct batch *b, int quiet)
+{
+	FILE *fp;
+	char line[LINE_LENGTH];
+	char *argv[BATCH_MAX_ARGS];
+	struct batch_round *rounds;
+	unsigned int nr_line = 0, size;
+	int argc;
+
+	memset(b, 0, sizeof(struct batch));
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		printf(ERR "unable to open manifest for reading: %s\n", path);
+		return 1;
+	}
+
+	while (fgets(line, LINE_LENGTH, fp)) {
+		nr_line++;
+		argc = split_row(line, path, argv);
+		if (argc == 1)
+			continue;
+
+		if (b->count == b->size) {
+			size = b->size ? b->size * 2 : INITIAL_ROUNDS;
+			rounds = mem_realloc(b->rounds,
+					 size * sizeof(struct batch_round));
+			if (rounds == NULL) {
+				printf(ERR "could not allocate memory for "
+				       "rounds\n");
+				goto error;
+			}
+			b->rounds = rounds;
+			b->size = size;
+		}
+
+		memset(&b->rounds[b->count], 0, sizeof(struct batch_round));
+		b->rounds[b->count].line = nr_line;
+		clear_userdata(&b->rounds[b->count].ud);
+		b->rounds[b->count].ud.quiet = quiet;
+		b->count++;
+		if (load_round(path, &b->rounds[b->count - 1], argc, argv)) {
+			printf(ERR "%s:%u: invalid round\n", path, nr_line);
+			goto error;
+		}
+	}
+	fclose(fp);
+
+	if (b->count == 0) {
+		printf(ERR "%s: manifest holds no rounds\n", path);
+		return 1;
+	}
+	return 0;
+
+error:
+	fclose(fp);
+	batch_free(b);
+	return 1;
+}
+
+/*
+ * play a round as often as set with -rr, like set_data() does with files
+ * loaded beforehand
+ * @param reset: 1 to set 0dB after the round, like a single run does
+ * @return: 0 on success, 1 on error
+ */
+static int
+play_round(struct batch_round *r, int reset)
+{
+	struct user_data *ud = &r->ud;
+	struct play_stats st;
+	unsigned int i;
+	int res = 0;
+
+	for (i = 0; i < ud->runs && res == 0; i++) {
+		if (ud->simple) {
+			set_attenuation(r->id, ud);
+			break;
+		} else if (ud->triangle) {
+			res = set_triangle(r->id, ud);
+		} else if (ud->ramp) {
+			res = set_ramp(r->id, ud);
+		} else if (ud->keyframe) {
+			res = keyframe_play(r->id, &r->ks, ud);
+		} else if (ud->scenario) {
+			res = scenario_run(r->id, &r->sc, ud);
+		} else {
+			memset(&st, 0, sizeof(struct play_stats));
+			res = schedule_play(r->id, &r->sched, ud, &st);
+		}
+		ud->offset = 0;
+	}
+
+	if (reset && ud->atime != 0) {
+		write_attenuation(r->id, 0);
+		log_attenuation(0, ud);
+	}
+	return res;
+}
+
+/*
+ * check if a round is the last one on its device
+ */
+static int
+last_on_device(struct batch *b, unsigned int i)
+{
+	unsigned int k;
+
+	for (k = i + 1; k < b->count; k++)
+		if (b->rounds[k].id == b->rounds[i].id)
+			return 0;
+	return 1;
+}
+
+/*
+ * play all rounds of a batch one after the other on devices kept open.
+ * A device is only set to 0dB after its last round or before a pause, so
+ * back to back rounds switch without a detour. The gap of a round is the
+ * time from the last write of the previous round to its first write,
+ * including the hold of that write and the pause, it is reported for
+ * every round.
+ * @param b: batch with device ids assigned
+ * @param quiet: 1 to suppress [INFO] output
+ * @return: 0 on success, 1 if a round failed
+ */
+int
+batch_run(struct batch *b, int quiet)
+{
+	struct batch_round *r;
+	unsigned long long ready = 0, start, end, gap, max_gap = 0;
+	unsigned long long total_gap = 0, first, last = 0, prev = 0;
+	unsigned int i;
+	int res = 0;
+
+	for (i = 0; i < b->count && res == 0; i++) {
+		r = &b->rounds[i];
+		if (i > 0)
+			time_sleep_until_ns(ready);
+
+		write_mark(r->id);
+		start = time_now_ns();
+		res = play_round(r, r->pause || last_on_device(b, i));
+		end = time_now_ns();
+		ready = end + r->pause;
+
+		write_times(r->id, &first, &last);
+		gap = i > 0 && prev && first > prev ? first - prev : 0;
+		if (last)
+			prev = last;
+
+		total_gap += gap;
+		if (gap > max_gap)
+			max_gap = gap;
+		if (!quiet)
+			printf(INFO "round %u of %u (serial %i, line %u) took "
+			       "%.3f s, gap before %.3f ms\n", i + 1, b->count,
+			       fnLDA_GetSerialNumber(r->id), r->line,
+			       (double)(end - start) / NSEC_PER_SEC,
+			       (double)gap / NSEC_PER_MSEC);
+	}
+
+	if (res)
+		printf(ERR "round %u failed, batch stopped\n", i);
+	if (!quiet && i > 1)
+		printf(INFO "played %u rounds, gap between rounds mean %.3f ms, "
+		       "max %.3f ms\n", i,
+		       (double)total_gap / (i - 1) / NSEC_PER_MSEC,
+		       (double)max_gap / NSEC_PER_MSEC);
+	return res;
+}
+
+/*
+ * release the schedules of all rounds
+ */
+void
+batch_free(struct batch *b)
+{
+	unsigned int i;
+
+	for (i = 0; i < b->count; i++) {
+		if (b->rounds[i].ud.keyframe)
+			keyframe_free(&b->rounds[i].ks);
+		else if (b->rounds[i].ud.scenario)
+			scenario_free(&b->rounds[i].sc);
+		else if (b->rounds[i].ud.file)
+			schedule_free(&b->rounds[i].sched);
+	}
+	free(b->rounds);
+	memset(b, 0, sizeof(struct batch));
+}
@@ -0,0 +1,39 @@
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include "input.h"
+#include "schedule.h"
+#include "keyframe.h"
+#include "scenario.h"
+
+#define BATCH_MAX_ARGS 64
+#define INITIAL_ROUNDS 16
+
+/*
+ * round of a batch manifest. Its schedule is loaded before the first round
+ * starts, id is the device assigned to the serial number.
+ */
+struct batch_round
+{
+	unsigned int line;
+	int serial;
+	int id;
+	unsigned long long pause;
+	struct user_data ud;
+	struct schedule sched;
+	struct keyframe_schedule ks;
+	struct scenario sc;
+};
+
+struct batch
+{
+	struct batch_round *rounds;
+	unsigned int count;
+	unsigned int size;
+};
+
+int batch_load(char *path, struct batch *b, int quiet);
+int batch_run(struct batch *b, int quiet);
+void batch_free(struct batch *b);
+
+#endif
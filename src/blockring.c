@@ -0,0 +1,111 @@
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include "blockring.h"
+#include "mem.h"
+#include "timing.h"
+
+/*
+ * compute the next block and publish it to the playback
+ */
+static void
+blockring_fill(struct block_ring *r)
+{
+	int last;
+
+	last = r->fill(r->arg, blockring_block(r, r->produced), r->produced);
+	__sync_synchronize();
+	r->produced++;
+	if (last)
+		r->done = 1;
+}
+
+/*
+ * compute blocks ahead of the playback, as long as there is room in the
+ * ring
+ */
+static void *
+blockring_worker(void *arg)
+{
+	struct block_ring *r = arg;
+	sigset_t set;
+
+	/* signals are handled by the threads of the program */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	time_sim_enter();
+	while (r->running && !r->done) {
+		/* blocks missed by the playback are not computed anymore */
+		if (r->consumed > r->produced)
+			r->produced = r->consumed;
+		if (r->produced - r->consumed >= r->count) {
+			time_sleep_until_ns(time_now_ns() + r->pause);
+			continue;
+		}
+		blockring_fill(r);
+	}
+	r->done = 1;
+	time_sim_leave();
+	return NULL;
+}
+
+/*
+ * fill the ring before the first deadline and start the worker which
+ * keeps it full. On the virtual clock, the worker sleeps with the playback.
+ * @param r: ring
+ * @param count: number of blocks in the ring
+ * @param size: size of a block in bytes
+ * @param pause: sleep of the worker when the ring is full
+ * @param fill: computes a block
+ * @param arg: passed to fill
+ * @return: 0 on success, 1 on error
+ */
+int
+blockring_start(struct block_ring *r, unsigned long count, size_t size,
+		unsigned long long pause, block_fill fill, void *arg)
+{
+	memset(r, 0, sizeof(struct block_ring));
+	r->count = count;
+	r->size = size;
+	r->pause = pause;
+	r->fill = fill;
+	r->arg = arg;
+	r->blocks = mem_alloc(count * size);
+	if (r->blocks == NULL)
+		return 1;
+
+	while (r->produced < r->count && !r->done)
+		blockring_fill(r);
+
+	r->running = 1;
+	time_sim_add(1);
+	if (pthread_create(&r->worker, NULL, blockring_worker, r)) {
+		time_sim_add(-1);
+		free(r->blocks);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * get the memory of block n
+ */
+void *
+blockring_block(struct block_ring *r, unsigned long n)
+{
+	return r->blocks + (n % r->count) * r->size;
+}
+
+/*
+ * end the worker and free the blocks. The calling playback leaves the
+ * virtual clock, so the worker can wake up to end.
+ */
+void
+blockring_stop(struct block_ring *r)
+{
+	r->running = 0;
+	time_sim_leave();
+	pthread_join(r->worker, NULL);
+	free(r->blocks);
+}
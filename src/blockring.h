@@ -0,0 +1,40 @@
+#ifndef _BLOCKRING_H_
+#define _BLOCKRING_H_
+
+#include <stddef.h>
+#include <pthread.h>
+
+/*
+ * compute block n into the memory given
+ * @return: 1 if it was the last block, else 0
+ */
+typedef int (*block_fill)(void *arg, void *block, unsigned long n);
+
+/*
+ * ring of blocks computed by a worker thread ahead of a playback. The
+ * playback may read block n once n < produced and sets consumed past the
+ * blocks it is done with. Blocks it skipped are not computed anymore.
+ * @pause: sleep of the worker when the ring is full
+ * @done: set when the last block was computed or the worker ended
+ */
+struct block_ring
+{
+	char *blocks;
+	size_t size;
+	unsigned long count;
+	volatile unsigned long produced;
+	volatile unsigned long consumed;
+	volatile int running;
+	volatile int done;
+	unsigned long long pause;
+	block_fill fill;
+	void *arg;
+	pthread_t worker;
+};
+
+int blockring_start(struct block_ring *r, unsigned long count, size_t size,
+		    unsigned long long pause, block_fill fill, void *arg);
+void *blockring_block(struct block_ring *r, unsigned long n);
+void blockring_stop(struct block_ring *r);
+
+#endif
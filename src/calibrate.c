@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "calibrate.h"
+#include "mem.h"
+#include "profile.h"
+#include "timing.h"
+#include "control.h"
+
+/*
+ * measurements of a device. Writes toggle between the minimum attenuation
+ * and one step above, so every write changes the attenuation.
+ */
+struct cal_dev
+{
+	int id;
+	int serial;
+	int low;
+	int high;
+	int saved;
+	unsigned long n;
+	unsigned long long *samples;
+	unsigned long long elapsed;
+	pthread_t thread;
+	struct profile p;
+};
+
+/* the writers of the shared test wait for all of them to be started */
+static pthread_mutex_t start_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t start_cond = PTHREAD_COND_INITIALIZER;
+static int started_all;
+
+static int
+compare_ns(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * sort samples and get one of their percentiles
+ * @param samples: samples in nanoseconds, sorted in place
+ * @param n: number of samples
+ * @param pct: percentile, 100 for the maximum
+ * @return: value of the percentile
+ */
+static unsigned long long
+percentile(unsigned long long *samples, unsigned long n, unsigned int pct)
+{
+	if (n == 0)
+		return 0;
+	qsort(samples, n, sizeof(unsigned long long), compare_ns);
+	return samples[(n - 1) * pct / 100];
+}
+
+/*
+ * write back to back and take the latency of every write
+ * @param d: device, samples and elapsed are set
+ */
+static void
+measure_writes(struct cal_dev *d)
+{
+	unsigned long long start, issued;
+	unsigned long i;
+
+	start = time_now_ns();
+	for (i = 0; i < d->n; i++) {
+		issued = time_now_ns();
+		fnLDA_SetAttenuation(d->id, i & 1 ? d->high : d->low);
+		d->samples[i] = time_now_ns() - issued;
+	}
+	d->elapsed = time_now_ns() - start;
+}
+
+/*
+ * take the latency of reading the attenuation back
+ * @param d: device, samples are set
+ */
+static void
+measure_reads(struct cal_dev *d)
+{
+	unsigned long long issued;
+	unsigned long i;
+
+	for (i = 0; i < d->n; i++) {
+		issued = time_now_ns();
+		fnLDA_GetAttenuation(d->id);
+		d->samples[i] = time_now_ns() - issued;
+	}
+}
+
+/*
+ * writer thread of the shared test, all of them start together
+ */
+static void *
+shared_writer(void *arg)
+{
+	struct cal_dev *d = arg;
+
+	pthread_mutex_lock(&start_lock);
+	while (!started_all)
+		pthread_cond_wait(&start_cond, &start_lock);
+	pthread_mutex_unlock(&start_lock);
+	measure_writes(d);
+	return NULL;
+}
+
+/*
+ * take how late sleeps of CAL_SLEEP_NS wake up on this host
+ * @param samples: storage for n samples
+ * @param n: number of sleeps
+ */
+static void
+measure_sleep(unsigned long long *samples, unsigned long n)
+{
+	unsigned long long deadline, now;
+	unsigned long i;
+
+	for (i = 0; i < n; i++) {
+		deadline = time_now_ns() + CAL_SLEEP_NS;
+		time_sleep_until_ns(deadline);
+		now = time_now_ns();
+		samples[i] = now > deadline ? now - deadline : 0;
+	}
+}
+
+static unsigned long long
+rate(struct cal_dev *d)
+{
+	return d->elapsed ? d->n * NSEC_PER_SEC / d->elapsed : 0;
+}
+
+/*
+ * print the results of a device
+ */
+static void
+print_profile(struct cal_dev *d, int count)
+{
+	struct profile *p = &d->p;
+
+	printf(INFO "serial %i: write p50 %.3f ms, p99 %.3f ms, max %.3f ms, "
+	       "%llu writes/s\n", d->serial,
+	       (double)p->write_p50 / NSEC_PER_MSEC,
+	       (double)p->write_p99 / NSEC_PER_MSEC,
+	       (double)p->write_max / NSEC_PER_MSEC, p->rate);
+	printf(INFO "serial %i: readback p50 %.3f ms, p99 %.3f ms\n", d->serial,
+	       (double)p->read_p50 / NSEC_PER_MSEC,
+	       (double)p->read_p99 / NSEC_PER_MSEC);
+	if (count > 1)
+		printf(INFO "serial %i: write with %d devices p50 %.3f ms, p99 "
+		       "%.3f ms, %llu writes/s\n", d->serial, count,
+		       (double)p->shared_p50 / NSEC_PER_MSEC,
+		       (double)p->shared_p99 / NSEC_PER_MSEC, p->shared_rate);
+	printf(INFO "serial %i: shortest step %.3f ms alone, %.3f ms shared\n",
+	       d->serial, (double)p->min_step / NSEC_PER_MSEC,
+	       (double)p->min_step_shared / NSEC_PER_MSEC);
+}
+
+/*
+ * measure what the devices and this host achieve and write a profile for
+ * every device. Each device is measured alone first, then all of them
+ * write at the same time like -md does on a shared bus. The shortest step
+ * is the 99th percentile of the write latency and of the sleep overshoot.
+ * The attenuation of every device is restored at the end.
+ * @param ids: devices to calibrate
+ * @param count: number of devices
+ * @param samples: measurements per device and test
+ * @param dir: directory of the profiles, DEFAULT_PROFILE_DIR if empty
+ * @param quiet: 1 to print the results only
+ * @return: 0 on success, 1 on error
+ */
+int
+calibrate_run(DEVID *ids, int count, unsigned long samples, char *dir,
+	      int quiet)
+{
+	struct cal_dev *devs;
+	unsigned long long *sleeps, total, sleep_p50, sleep_p99;
+	char path[MAX_LENGTH];
+	int i, started, ret = 1;
+
+	devs = mem_calloc(count, sizeof(struct cal_dev));
+	sleeps = mem_calloc(samples, sizeof(unsigned long long));
+	if (devs == NULL || sleeps == NULL) {
+		printf(ERR "could not allocate memory for calibration\n");
+		goto out;
+	}
+	for (i = 0; i < count; i++) {
+		devs[i].samples = mem_calloc(samples,
+					     sizeof(unsigned long long));
+		if (devs[i].samples == NULL) {
+			printf(ERR "could not allocate memory for calibration\n");
+			goto out;
+		}
+		devs[i].id = ids[i];
+		devs[i].serial = fnLDA_GetSerialNumber(ids[i]);
+		devs[i].low = fnLDA_GetMinAttenuation(ids[i]);
+		devs[i].high = devs[i].low + fnLDA_GetDevResolution(ids[i]);
+		devs[i].saved = fnLDA_GetAttenuation(ids[i]);
+		devs[i].n = samples;
+		devs[i].p.serial = devs[i].serial;
+		devs[i].p.samples = samples;
+		devs[i].p.devices = count;
+	}
+
+	if (!quiet)
+		printf(INFO "measuring %lu sleeps of %.3f ms\n", samples,
+		       (double)CAL_SLEEP_NS / NSEC_PER_MSEC);
+	measure_sleep(sleeps, samples);
+	sleep_p50 = percentile(sleeps, samples, 50);
+	sleep_p99 = percentile(sleeps, samples, 99);
+	printf(INFO "sleep overshoot p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+	       (double)sleep_p50 / NSEC_PER_MSEC,
+	       (double)sleep_p99 / NSEC_PER_MSEC,
+	       (double)percentile(sleeps, samples, 100) / NSEC_PER_MSEC);
+
+	for (i = 0; i < count; i++) {
+		if (!quiet)
+			printf(INFO "measuring serial %i alone\n",
+			       devs[i].serial);
+		measure_writes(&devs[i]);
+		devs[i].p.rate = rate(&devs[i]);
+		devs[i].p.write_p50 = percentile(devs[i].samples, samples, 50);
+		devs[i].p.write_p99 = percentile(devs[i].samples, samples, 99);
+		devs[i].p.write_max = percentile(devs[i].samples, samples, 100);
+		measure_reads(&devs[i]);
+		devs[i].p.read_p50 = percentile(devs[i].samples, samples, 50);
+		devs[i].p.read_p99 = percentile(devs[i].samples, samples, 99);
+	}
+
+	/* all devices write at once, as on a bus shared by -md */
+	if (count > 1) {
+		if (!quiet)
+			printf(INFO "measuring %d devices at the same time\n",
+			       count);
+		for (started = 0; started < count; started++)
+			if (pthread_create(&devs[started].thread, NULL,
+					   shared_writer, &devs[started])) {
+				printf(ERR "could not start the writers\n");
+				break;
+			}
+		pthread_mutex_lock(&start_lock);
+		started_all = 1;
+		pthread_cond_broadcast(&start_cond);
+		pthread_mutex_unlock(&start_lock);
+		for (i = 0; i < started; i++)
+			pthread_join(devs[i].thread, NULL);
+		if (started < count)
+			goto restore;
+	}
+	total = 0;
+	for (i = 0; i < count; i++) {
+		if (count > 1) {
+			devs[i].p.shared_rate = rate(&devs[i]);
+			devs[i].p.shared_p50 = percentile(devs[i].samples,
+							  samples, 50);
+			devs[i].p.shared_p99 = percentile(devs[i].samples,
+							  samples, 99);
+		} else {
+			devs[i].p.shared_rate = devs[i].p.rate;
+			devs[i].p.shared_p50 = devs[i].p.write_p50;
+			devs[i].p.shared_p99 = devs[i].p.write_p99;
+		}
+		devs[i].p.sleep_p50 = sleep_p50;
+		devs[i].p.sleep_p99 = sleep_p99;
+		devs[i].p.min_step = devs[i].p.write_p99 + sleep_p99;
+		/* sharing the bus never makes a device faster */
+		devs[i].p.min_step_shared = sleep_p99
+			+ (devs[i].p.shared_p99 > devs[i].p.write_p99
+			   ? devs[i].p.shared_p99 : devs[i].p.write_p99);
+		total += devs[i].p.shared_rate;
+	}
+	if (count > 1)
+		printf(INFO "%d devices: %llu writes/s on the bus\n", count,
+		       total);
+
+	ret = 0;
+	for (i = 0; i < count; i++) {
+		print_profile(&devs[i], count);
+		if (profile_save(&devs[i].p, dir)) {
+			ret = 1;
+			continue;
+		}
+		if (!quiet && profile_path(devs[i].serial, dir, path,
+					   MAX_LENGTH) == 0)
+			printf(INFO "serial %i: profile saved to %s\n",
+			       devs[i].serial, path);
+	}
+
+restore:
+	for (i = 0; i < count; i++)
+		fnLDA_SetAttenuation(devs[i].id, devs[i].saved);
+out:
+	for (i = 0; devs && i < count; i++)
+		free(devs[i].samples);
+	free(devs);
+	free(sleeps);
+	return ret;
+}
@@ -0,0 +1,14 @@
+#ifndef _CALIBRATE_H_
+#define _CALIBRATE_H_
+
+#include "LDAhid.h"
+
+/* measurements per device and test, changed with -cal-writes */
+#define DEFAULT_CAL_WRITES 1000
+/* sleep of the overshoot test, as short as the steps in question */
+#define CAL_SLEEP_NS NSEC_PER_MSEC
+
+int calibrate_run(DEVID *ids, int count, unsigned long samples, char *dir,
+		  int quiet);
+
+#endif
@@ -0,0 +1,525 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <math.h>
+#include "channel.h"
+#include "blockring.h"
+#include "keyframe.h"
+#include "schedule.h"
+#include "status.h"
+#include "timing.h"
+#include "control.h"
+#include "input.h"
+#include "LDAhid.h"
+
+#define LINE_LENGTH 512
+
+/* state shared by the generator thread and the playback */
+struct channel_player
+{
+	struct channel_model *m;
+	int ids[CHANNEL_MAX_LINKS];
+	int resolution[CHANNEL_MAX_LINKS];
+	int min[CHANNEL_MAX_LINKS];
+	int max[CHANNEL_MAX_LINKS];
+	struct block_ring ring;
+	unsigned long long period;
+	unsigned long long length;
+	unsigned long total;
+	int cont;
+	double speed;
+};
+
+/*
+ * xorshift64* generator, so a seed always gives the same fading
+ * @return: uniform random number in [0, 1)
+ */
+static double
+channel_random(unsigned long long *state)
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return (double)((*state * 0x2545f4914f6cdd1dULL) >> 11)
+	       / (double)(1ULL << 53);
+}
+
+/*
+ * decompose the correlation matrix into a lower triangular factor
+ * @return: 0 on success, 1 if the matrix is not positive definite
+ */
+static int
+cholesky(struct channel_model *m)
+{
+	unsigned int i, j, k;
+	double sum;
+
+	memset(m->chol, 0, sizeof(m->chol));
+	for (i = 0; i < m->links; i++) {
+		for (j = 0; j <= i; j++) {
+			sum = m->corr[i][j];
+			for (k = 0; k < j; k++)
+				sum -= m->chol[i][k] * m->chol[j][k];
+			if (i == j) {
+				if (sum <= 0)
+					return 1;
+				m->chol[i][i] = sqrt(sum);
+			} else {
+				m->chol[i][j] = sum / m->chol[j][j];
+			}
+		}
+	}
+	return 0;
+}
+
+/*
+ * draw angles of arrival and phases of all sinusoids, following the
+ * model of Zheng and Xiao
+ */
+static void
+init_sinusoids(struct channel_model *m)
+{
+	unsigned long long state = m->seed ? m->seed : 1;
+	unsigned int k, n;
+	double theta;
+
+	for (k = 0; k < m->links; k++) {
+		theta = (2 * channel_random(&state) - 1) * M_PI;
+		for (n = 0; n < m->sinusoids; n++) {
+			m->angle[k][n] = (2 * M_PI * (n + 1) - M_PI + theta)
+					 / (4 * m->sinusoids);
+			m->phase_i[k][n] = (2 * channel_random(&state) - 1) * M_PI;
+			m->phase_q[k][n] = (2 * channel_random(&state) - 1) * M_PI;
+		}
+	}
+}
+
+/*
+ * set up a model of a single link without path loss, for fading generated
+ * outside of channel_run()
+ * @param m: model to fill
+ * @param doppler: maximal Doppler frequency in Hz
+ * @param sinusoids: number of sinusoids
+ * @param seed: seed of the phases
+ */
+void
+channel_single(struct channel_model *m, double doppler,
+	       unsigned int sinusoids, unsigned long long seed)
+{
+	memset(m, 0, sizeof(struct channel_model));
+	m->links = 1;
+	m->corr[0][0] = 1;
+	m->chol[0][0] = 1;
+	m->doppler = doppler;
+	m->sinusoids = sinusoids;
+	m->seed = seed;
+	init_sinusoids(m);
+}
+
+/*
+ * read the values of a row into an array
+ * @return: number of values read
+ */
+static unsigned int
+read_values(char **pos, double *values, unsigned int max)
+{
+	unsigned int count = 0;
+	char *end;
+
+	while (count < max) {
+		values[count] = strtod(*pos, &end);
+		if (end == *pos)
+			break;
+		*pos = end;
+		count++;
+	}
+	return count;
+}
+
+/*
+ * check the model for consistency once the file is read
+ * @return: 0 on success, 1 on error
+ */
+static int
+channel_check(char *path, struct channel_model *m)
+{
+	unsigned int i, j;
+
+	if (m->links == 0) {
+		printf(ERR "%s: no link defined\n", path);
+		return 1;
+	}
+	if (m->path[0].count == 0) {
+		printf(ERR "%s: no path loss defined\n", path);
+		return 1;
+	}
+
+	if (m->corr_rows == 0)
+		for (i = 0; i < m->links; i++)
+			m->corr[i][i] = 1;
+	else if (m->corr_rows != m->links) {
+		printf(ERR "%s: correlation matrix needs %u rows\n", path,
+		       m->links);
+		return 1;
+	}
+	for (i = 0; i < m->links; i++) {
+		if (fabs(m->corr[i][i] - 1) > 1e-9) {
+			printf(ERR "%s: correlation of link %u with itself has "
+			       "to be 1\n", path, i + 1);
+			return 1;
+		}
+		for (j = 0; j < i; j++) {
+			if (fabs(m->corr[i][j] - m->corr[j][i]) > 1e-9) {
+				printf(ERR "%s: correlation matrix is not "
+				       "symmetric\n", path);
+				return 1;
+			}
+		}
+	}
+	if (cholesky(m)) {
+		printf(ERR "%s: correlation matrix is not positive definite\n",
+		       path);
+		return 1;
+	}
+
+	init_sinusoids(m);
+	return 0;
+}
+
+/*
+ * read a channel model file. Every row starts with a keyword:
+ * rate <samples per second>
+ * doppler <maximal Doppler frequency in Hz>
+ * sinusoids <number of sinusoids per link>
+ * seed <number>
+ * link <serial>              - one row per link, in order
+ * corr <value> ...           - one row of the correlation matrix per link
+ * path <time> <dB> ... [interpolation] - path loss of all links
+ * Times of path rows are given in the time unit set by the user. Empty rows
+ * and text after '#' are skipped.
+ * @param path: path to channel model file
+ * @param m: model to fill
+ * @param ud: user data struct
+ * @return: 0 on success, 1 on error
+ */
+int
+channel_load(char *path, struct channel_model *m, struct user_data *ud)
+{
+	FILE *fp;
+	char line[LINE_LENGTH];
+	char *pos, *end;
+	double values[CHANNEL_MAX_LINKS + 1];
+	struct keyframe kf;
+	unsigned long long unit;
+	unsigned int nr_line = 0, i;
+	int interp;
+
+	memset(m, 0, sizeof(struct channel_model));
+	m->rate = DEFAULT_CHANNEL_RATE;
+	m->sinusoids = DEFAULT_SINUSOIDS;
+	m->seed = 1;
+	unit = time_unit_ns(ud);
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		printf(ERR "unable to open channel model for reading: %s\n",
+		       path);
+		return 1;
+	}
+
+	while (fgets(line, LINE_LENGTH, fp)) {
+		nr_line++;
+		if ((pos = strchr(line, '#')))
+			*pos = '\0';
+		pos = line;
+		while (isspace((unsigned char)*pos))
+			pos++;
+		if (*pos == '\0')
+			continue;
+
+		if (strncmp(pos, "rate ", 5) == 0) {
+			m->rate = strtod(pos + 5, &end);
+			if (end == pos + 5)
+				goto malformed;
+			if (!(m->rate >= 1 && m->rate <= CHANNEL_MAX_RATE)) {
+				printf(ERR "%s:%u: rate has to be between 1 and "
+				       "%d samples per second\n", path, nr_line,
+				       CHANNEL_MAX_RATE);
+				goto error;
+			}
+		} else if (strncmp(pos, "doppler ", 8) == 0) {
+			m->doppler = strtod(pos + 8, &end);
+			if (m->doppler < 0)
+				goto malformed;
+		} else if (strncmp(pos, "sinusoids ", 10) == 0) {
+			m->sinusoids = strtoul(pos + 10, &end, 10);
+			if (m->sinusoids == 0
+			    || m->sinusoids > CHANNEL_MAX_SINUSOIDS)
+				goto malformed;
+		} else if (strncmp(pos, "seed ", 5) == 0) {
+			m->seed = strtoull(pos + 5, &end, 10);
+		} else if (strncmp(pos, "link ", 5) == 0) {
+			if (m->links == CHANNEL_MAX_LINKS) {
+				printf(ERR "%s:%u: more than %d links\n", path,
+				       nr_line, CHANNEL_MAX_LINKS);
+				goto error;
+			}
+			if (m->path[0].count || m->corr_rows) {
+				printf(ERR "%s:%u: links have to be defined "
+				       "before correlation and path loss\n", path,
+				       nr_line);
+				goto error;
+			}
+			m->serials[m->links++] = atoi(pos + 5);
+		} else if (strncmp(pos, "corr ", 5) == 0) {
+			pos += 5;
+			if (m->corr_rows == m->links
+			    || read_values(&pos, values, CHANNEL_MAX_LINKS)
+			       != m->links)
+				goto malformed;
+			for (i = 0; i < m->links; i++)
+				m->corr[m->corr_rows][i] = values[i];
+			m->corr_rows++;
+		} else if (strncmp(pos, "path ", 5) == 0) {
+			pos += 5;
+			if (m->links == 0
+			    || read_values(&pos, values, m->links + 1)
+			       != m->links + 1 || values[0] < 0)
+				goto malformed;
+			interp = get_interp(pos);
+			if (interp < 0) {
+				printf(ERR "%s:%u: unknown interpolation\n",
+				       path, nr_line);
+				goto error;
+			}
+			kf.time = (unsigned long long)(values[0] * unit + 0.5);
+			kf.interp = interp;
+			if (m->path[0].count && kf.time
+			    <= m->path[0].frames[m->path[0].count - 1].time) {
+				printf(ERR "%s:%u: path times have to increase\n",
+				       path, nr_line);
+				goto error;
+			}
+			for (i = 0; i < m->links; i++) {
+				kf.attenuation = values[i + 1] * MULTIPLIER_STEP;
+				if (add_keyframe(&m->path[i], &kf)) {
+					printf(ERR "could not allocate memory for "
+					       "path loss\n");
+					goto error;
+				}
+			}
+		} else {
+			goto malformed;
+		}
+	}
+	fclose(fp);
+	if (channel_check(path, m)) {
+		channel_free(m);
+		return 1;
+	}
+	return 0;
+
+malformed:
+	printf(ERR "%s:%u: malformed row\n", path, nr_line);
+error:
+	fclose(fp);
+	channel_free(m);
+	return 1;
+}
+
+/*
+ * fading of all links at a point in time
+ * @param m: channel model
+ * @param t: time in seconds
+ * @param fade: storage for the fading of each link in dB
+ */
+void
+channel_fading(struct channel_model *m, double t, double *fade)
+{
+	double gi[CHANNEL_MAX_LINKS], gq[CHANNEL_MAX_LINKS];
+	double w = 2 * M_PI * m->doppler * t, scale, hi, hq;
+	unsigned int k, j, n;
+
+	/* independent unit power Rayleigh processes */
+	scale = sqrt(1.0 / m->sinusoids);
+	for (k = 0; k < m->links; k++) {
+		gi[k] = gq[k] = 0;
+		for (n = 0; n < m->sinusoids; n++) {
+			gi[k] += cos(w * cos(m->angle[k][n]) + m->phase_i[k][n]);
+			gq[k] += cos(w * sin(m->angle[k][n]) + m->phase_q[k][n]);
+		}
+		gi[k] *= scale;
+		gq[k] *= scale;
+	}
+
+	/* correlate them, the power of each link stays 1 */
+	for (k = 0; k < m->links; k++) {
+		hi = hq = 0;
+		for (j = 0; j <= k; j++) {
+			hi += m->chol[k][j] * gi[j];
+			hq += m->chol[k][j] * gq[j];
+		}
+		fade[k] = 10 * log10(hi * hi + hq * hq + 1e-12);
+		if (fade[k] < CHANNEL_FADE_FLOOR)
+			fade[k] = CHANNEL_FADE_FLOOR;
+	}
+}
+
+/*
+ * compute a block of attenuation values of all links
+ * @return: 1 if it holds the last sample, else 0
+ */
+static int
+fill_block(void *arg, void *block_mem, unsigned long block)
+{
+	struct channel_player *p = arg;
+	struct channel_model *m = p->m;
+	int (*values)[CHANNEL_MAX_LINKS] = block_mem;
+	double fade[CHANNEL_MAX_LINKS], loss;
+	unsigned long long t, tp;
+	unsigned int seg[CHANNEL_MAX_LINKS];
+	unsigned long n;
+	unsigned int i, k;
+
+	memset(seg, 0, sizeof(seg));
+	for (i = 0; i < CHANNEL_BLOCK; i++) {
+		n = block * CHANNEL_BLOCK + i;
+		t = n * p->period;
+		tp = t;
+		if (p->cont && p->length)
+			tp = t % p->length;
+		else if (tp > p->length)
+			tp = p->length;
+
+		channel_fading(m, (double)t / NSEC_PER_SEC, fade);
+		for (k = 0; k < m->links; k++) {
+			if (tp < m->path[k].frames[seg[k]].time)
+				seg[k] = 0;
+			loss = keyframe_value(&m->path[k], &seg[k], tp);
+			values[i][k] = quantize(loss - fade[k] * MULTIPLIER_STEP,
+						p->resolution[k], p->min[k],
+						p->max[k]);
+		}
+	}
+	return p->total && (block + 1) * CHANNEL_BLOCK >= p->total;
+}
+
+/*
+ * play the channel model on the devices of its links. Samples are
+ * generated in blocks by a worker thread ahead of time, the playback only
+ * writes precomputed values at their deadlines. Values which did not change
+ * are not written again. If the worker falls behind, samples are dropped
+ * and counted instead of waiting for them.
+ * @param m: channel model
+ * @param ids: device id of each link
+ * @param ud: user data struct
+ * @return: 0 on success, 1 on error
+ */
+int
+channel_run(struct channel_model *m, int *ids, struct user_data *ud)
+{
+	struct channel_player p;
+	int (*values)[CHANNEL_MAX_LINKS];
+	int last[CHANNEL_MAX_LINKS], value;
+	unsigned long long start, deadline, now, tolerance, late, max_late = 0;
+	unsigned long long lead, pause;
+	unsigned long n, block, underruns = 0, missed = 0, writes = 0;
+	unsigned int k;
+
+	memset(&p, 0, sizeof(struct channel_player));
+	p.m = m;
+	p.period = (unsigned long long)(NSEC_PER_SEC / m->rate);
+	p.length = m->path[0].frames[m->path[0].count - 1].time;
+	p.cont = ud->cont;
+	p.total = p.cont ? 0 : p.length / p.period + 1;
+	p.speed = ud->speed > 0 ? ud->speed : 1;
+	tolerance = (unsigned long long)ud->tolerance * NSEC_PER_USEC;
+
+	for (k = 0; k < m->links; k++) {
+		p.ids[k] = ids[k];
+		p.resolution[k] = fnLDA_GetDevResolution(ids[k]);
+		if (p.resolution[k] <= 0)
+			p.resolution[k] = 1;
+		p.min[k] = fnLDA_GetMinAttenuation(ids[k]);
+		p.max[k] = fnLDA_GetMaxAttenuation(ids[k]);
+		last[k] = -1;
+	}
+
+	/* the generator sleeps a quarter block when the ring is full */
+	pause = (unsigned long long)(p.period * CHANNEL_BLOCK / p.speed / 4);
+	if (blockring_start(&p.ring, CHANNEL_BLOCKS,
+			    sizeof(int[CHANNEL_BLOCK][CHANNEL_MAX_LINKS]), pause,
+			    fill_block, &p)) {
+		printf(ERR "unable to start channel generator thread\n");
+		return 1;
+	}
+
+	if (!ud->quiet)
+		printf(INFO "playing %u correlated links at %.0f samples/s, "
+		       "Doppler %.2f Hz\n", m->links, m->rate, m->doppler);
+
+	start = time_now_ns();
+	for (n = 0; p.total == 0 || n < p.total; n++) {
+		block = n / CHANNEL_BLOCK;
+		deadline = start + (unsigned long long)(n * p.period / p.speed);
+		lead = 0;
+		for (k = 0; k < m->links; k++)
+			if (write_lead(p.ids[k], ud) > lead)
+				lead = write_lead(p.ids[k], ud);
+		time_sleep_until_ns(deadline - lead);
+
+		if (block >= p.ring.produced) {
+			underruns++;
+		} else {
+			__sync_synchronize();
+			values = blockring_block(&p.ring, block);
+			now = time_now_ns();
+			late = now > deadline - lead ? now - deadline + lead : 0;
+			if (late > tolerance)
+				missed++;
+			if (late > max_late)
+				max_late = late;
+			for (k = 0; k < m->links; k++) {
+				value = values[n % CHANNEL_BLOCK][k];
+				if (value != last[k]) {
+					write_attenuation(p.ids[k], value);
+					write_residual(p.ids[k], n, deadline,
+						       ud);
+					last[k] = value;
+					writes++;
+				}
+				status_late(p.ids[k], late, late > tolerance, 0);
+				status_step(p.ids[k], n, p.total, deadline +
+					    (unsigned long long)(p.period
+								 / p.speed));
+			}
+		}
+
+		if (n % CHANNEL_BLOCK == CHANNEL_BLOCK - 1) {
+			__sync_synchronize();
+			p.ring.consumed = block + 1;
+		}
+	}
+
+	blockring_stop(&p.ring);
+
+	if (!ud->quiet)
+		printf(INFO "played %lu samples with %lu writes, %lu late, "
+		       "%lu not generated in time, max lateness %.3f ms\n", n,
+		       writes, missed, underruns,
+		       (double)max_late / NSEC_PER_MSEC);
+	return 0;
+}
+
+/*
+ * release the path loss of a channel model
+ */
+void
+channel_free(struct channel_model *m)
+{
+	unsigned int k;
+
+	for (k = 0; k < CHANNEL_MAX_LINKS; k++)
+		keyframe_free(&m->path[k]);
+}
@@ -0,0 +1,48 @@
+#ifndef _CHANNEL_H_
+#define _CHANNEL_H_
+
+#include "input.h"
+#include "keyframe.h"
+
+#define CHANNEL_MAX_LINKS 16
+#define CHANNEL_MAX_SINUSOIDS 64
+#define CHANNEL_BLOCK 256
+#define CHANNEL_BLOCKS 8
+#define CHANNEL_FADE_FLOOR -40.0
+
+#define DEFAULT_CHANNEL_RATE 100
+/* a write takes about a millisecond on the bus */
+#define CHANNEL_MAX_RATE 1000
+#define DEFAULT_SINUSOIDS 16
+
+/*
+ * model of several links with correlated Rayleigh fading on top of a path
+ * loss trajectory per link. Fading of every link is generated by a sum of
+ * sinusoids with random phases, the links are correlated by the Cholesky
+ * factor of the correlation matrix.
+ */
+struct channel_model
+{
+	unsigned int links;
+	int serials[CHANNEL_MAX_LINKS];
+	double corr[CHANNEL_MAX_LINKS][CHANNEL_MAX_LINKS];
+	double chol[CHANNEL_MAX_LINKS][CHANNEL_MAX_LINKS];
+	unsigned int corr_rows;
+	double rate;
+	double doppler;
+	unsigned int sinusoids;
+	unsigned long long seed;
+	struct keyframe_schedule path[CHANNEL_MAX_LINKS];
+	double angle[CHANNEL_MAX_LINKS][CHANNEL_MAX_SINUSOIDS];
+	double phase_i[CHANNEL_MAX_LINKS][CHANNEL_MAX_SINUSOIDS];
+	double phase_q[CHANNEL_MAX_LINKS][CHANNEL_MAX_SINUSOIDS];
+};
+
+int channel_load(char *path, struct channel_model *m, struct user_data *ud);
+void channel_single(struct channel_model *m, double doppler,
+		    unsigned int sinusoids, unsigned long long seed);
+void channel_fading(struct channel_model *m, double t, double *fade);
+int channel_run(struct channel_model *m, int *ids, struct user_data *ud);
+void channel_free(struct channel_model *m);
+
+#endif
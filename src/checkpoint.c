@@ -0,0 +1,450 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include "checkpoint.h"
+#include "timing.h"
+#include "control.h"
+#include "input.h"
+
+#define LINE_LENGTH 256
+
+/*
+ * cp_state is only touched under cp_lock. The playback and the shutdown
+ * request checkpoints, the writer thread takes a snapshot of the state and
+ * is the only one to write, sync and rename the file.
+ */
+static struct checkpoint cp_state;
+static pthread_mutex_t cp_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cp_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t cp_done = PTHREAD_COND_INITIALIZER;
+static pthread_t cp_thread;
+static int cp_running;
+static unsigned long cp_requested;
+static unsigned long cp_written;
+static int cp_result;
+/* time spent in the run a checkpoint was resumed from */
+static unsigned long long resumed_elapsed;
+
+static void *checkpoint_loop(void *arg);
+
+/*
+ * enable checkpoints for a schedule and start the thread writing them
+ * @param path: checkpoint file
+ * @param schedule: path of the schedule file
+ * @param hash: hash of the schedule content
+ * @param interval: seconds between two periodic checkpoints
+ * @return: 0 on success, 1 on error
+ */
+int
+checkpoint_start(char *path, char *schedule, unsigned long long hash,
+		 unsigned int interval)
+{
+	pthread_mutex_lock(&cp_lock);
+	memset(&cp_state, 0, sizeof(struct checkpoint));
+	strncpy(cp_state.path, path, MAX_LENGTH - 1);
+	strncpy(cp_state.schedule, schedule, MAX_LENGTH - 1);
+	cp_state.hash = hash;
+	cp_state.interval = (unsigned long long)interval * NSEC_PER_SEC;
+	cp_state.origin = time_now_ns() - resumed_elapsed;
+	cp_state.speed = 1;
+	cp_requested = 0;
+	cp_written = 0;
+	cp_running = 1;
+	if (pthread_create(&cp_thread, NULL, checkpoint_loop, NULL)) {
+		cp_running = 0;
+		pthread_mutex_unlock(&cp_lock);
+		printf(ERR "unable to start the checkpoint writer\n");
+		return 1;
+	}
+	cp_state.enabled = 1;
+	pthread_mutex_unlock(&cp_lock);
+	return 0;
+}
+
+/*
+ * note the start of a new run
+ * @param run: number of runs done so far
+ * @param runs: total number of runs, 0 if repeated until canceled
+ */
+void
+checkpoint_run(unsigned long run, unsigned long runs)
+{
+	pthread_mutex_lock(&cp_lock);
+	cp_state.run = run;
+	cp_state.runs = runs;
+	cp_state.index = 0;
+	cp_state.step_pos = 0;
+	cp_state.step_wall = time_now_ns();
+	cp_state.step_end = 0;
+	pthread_mutex_unlock(&cp_lock);
+}
+
+/*
+ * note a step written to a device and ask the writer for a checkpoint if
+ * the interval has passed. The playback never waits for the disk.
+ * @param index: index of the step in the schedule
+ * @param pos: schedule time in nanoseconds at the start of the step
+ * @param wall: monotonic time the step started at
+ * @param end: schedule time in nanoseconds the step ends at
+ * @param speed: playback speed factor
+ * @param serial: serial number of the device
+ * @param value: value written to the device
+ */
+void
+checkpoint_step(unsigned long index, unsigned long long pos,
+		unsigned long long wall, unsigned long long end,
+		double speed, int serial, int value)
+{
+	int i;
+
+	pthread_mutex_lock(&cp_lock);
+	if (!cp_state.enabled) {
+		pthread_mutex_unlock(&cp_lock);
+		return;
+	}
+
+	cp_state.index = index;
+	cp_state.step_pos = pos;
+	cp_state.step_wall = wall;
+	cp_state.step_end = end;
+	cp_state.speed = speed;
+
+	for (i = 0; i < cp_state.nr_devices; i++)
+		if (cp_state.devices[i].serial == serial)
+			break;
+	if (i == cp_state.nr_devices && i < MAXDEVICES)
+		cp_state.devices[cp_state.nr_devices++].serial = serial;
+	if (i < MAXDEVICES)
+		cp_state.devices[i].value = value;
+
+	if (wall - cp_state.last_write >= cp_state.interval) {
+		cp_state.last_write = wall;
+		cp_requested++;
+		pthread_cond_signal(&cp_wake);
+	}
+	pthread_mutex_unlock(&cp_lock);
+}
+
+/* text built without stdio, len stays below size for the '\0' */
+struct text
+{
+	char *buf;
+	int size;
+	int len;
+};
+
+static void
+put_str(struct text *t, const char *str)
+{
+	while (*str && t->len < t->size - 1)
+		t->buf[t->len++] = *str++;
+}
+
+/*
+ * append a number in a base of 10 or 16, hex numbers are padded to 16
+ * digits like the hash of a schedule
+ */
+static void
+put_num(struct text *t, unsigned long long n, int base)
+{
+	char digits[24];
+	int i = 0;
+
+	do {
+		digits[i++] = "0123456789abcdef"[n % base];
+		n /= base;
+	} while (n || (base == 16 && i < 16));
+	while (i && t->len < t->size - 1)
+		t->buf[t->len++] = digits[--i];
+}
+
+static void
+put_int(struct text *t, long long n)
+{
+	if (n < 0) {
+		put_str(t, "-");
+		put_num(t, -(unsigned long long)n, 10);
+	} else {
+		put_num(t, n, 10);
+	}
+}
+
+/*
+ * format the current position, called with cp_lock held
+ * @return: length of the text
+ */
+static int
+checkpoint_format(char *buf, int size)
+{
+	struct text t = { buf, size, 0 };
+	unsigned long long now, pos;
+	int i;
+
+	now = time_now_ns();
+	pos = cp_state.step_pos;
+	if (now > cp_state.step_wall)
+		pos += (unsigned long long)((now - cp_state.step_wall)
+					    * cp_state.speed);
+	if (cp_state.step_end && pos >= cp_state.step_end)
+		pos = cp_state.step_end - 1;
+
+	put_str(&t, "# attenuator_lab_brick checkpoint\nschedule=");
+	put_str(&t, cp_state.schedule);
+	put_str(&t, "\nhash=");
+	put_num(&t, cp_state.hash, 16);
+	put_str(&t, "\nindex=");
+	put_num(&t, cp_state.index, 10);
+	put_str(&t, "\nposition=");
+	put_num(&t, pos, 10);
+	put_str(&t, "\nelapsed=");
+	put_num(&t, now - cp_state.origin, 10);
+	put_str(&t, "\nrun=");
+	put_num(&t, cp_state.run, 10);
+	put_str(&t, "\nruns=");
+	put_num(&t, cp_state.runs, 10);
+	put_str(&t, "\nfinished=");
+	put_int(&t, cp_state.finished);
+	put_str(&t, "\n");
+	for (i = 0; i < cp_state.nr_devices; i++) {
+		put_str(&t, "device=");
+		put_int(&t, cp_state.devices[i].serial);
+		put_str(&t, ",");
+		put_int(&t, cp_state.devices[i].value);
+		put_str(&t, "\n");
+	}
+	return t.len;
+}
+
+/*
+ * write a checkpoint to a temporary file, sync it and rename it over the
+ * last one, so neither an interrupted write nor a power cut destroys it
+ * @return: 0 on success, 1 on error
+ */
+static int
+checkpoint_save(const char *path, const char *buf, int len)
+{
+	char tmp[MAX_LENGTH + 8];
+	struct text name = { tmp, sizeof(tmp), 0 };
+	int fd;
+
+	put_str(&name, path);
+	put_str(&name, ".tmp");
+	tmp[name.len] = '\0';
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return 1;
+	if (write(fd, buf, len) != len || fsync(fd)) {
+		close(fd);
+		unlink(tmp);
+		return 1;
+	}
+	close(fd);
+	if (rename(tmp, path)) {
+		unlink(tmp);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * write the checkpoints requested, until stopped with none pending
+ */
+static void *
+checkpoint_loop(void *arg)
+{
+	char buf[CHECKPOINT_LENGTH];
+	char path[MAX_LENGTH];
+	unsigned long seq;
+	sigset_t set;
+	int len, res;
+
+	/* signals are handled by the threads of the program */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	pthread_mutex_lock(&cp_lock);
+	for (;;) {
+		while (cp_running && cp_requested == cp_written)
+			pthread_cond_wait(&cp_wake, &cp_lock);
+		if (cp_requested == cp_written)
+			break;
+		seq = cp_requested;
+		len = checkpoint_format(buf, CHECKPOINT_LENGTH);
+		memcpy(path, cp_state.path, MAX_LENGTH);
+		pthread_mutex_unlock(&cp_lock);
+
+		res = checkpoint_save(path, buf, len);
+
+		pthread_mutex_lock(&cp_lock);
+		cp_written = seq;
+		cp_result = res;
+		pthread_cond_broadcast(&cp_done);
+	}
+	pthread_mutex_unlock(&cp_lock);
+	return NULL;
+}
+
+/*
+ * write the current position to the checkpoint file and wait until it is
+ * on the disk. Used on shutdown, while the playback is parked.
+ * @return: 0 on success, 1 on error
+ */
+int
+checkpoint_write(void)
+{
+	unsigned long seq;
+	int res;
+
+	pthread_mutex_lock(&cp_lock);
+	if (!cp_state.enabled) {
+		pthread_mutex_unlock(&cp_lock);
+		return 1;
+	}
+	seq = ++cp_requested;
+	pthread_cond_signal(&cp_wake);
+	while (cp_written < seq)
+		pthread_cond_wait(&cp_done, &cp_lock);
+	res = cp_result;
+	pthread_mutex_unlock(&cp_lock);
+	return res;
+}
+
+/*
+ * mark the schedule as played completely
+ */
+void
+checkpoint_finish(void)
+{
+	pthread_mutex_lock(&cp_lock);
+	if (cp_state.enabled)
+		cp_state.finished = 1;
+	pthread_mutex_unlock(&cp_lock);
+	checkpoint_write();
+}
+
+/*
+ * end the writer after the checkpoints requested so far are written
+ */
+void
+checkpoint_stop(void)
+{
+	pthread_mutex_lock(&cp_lock);
+	if (!cp_state.enabled) {
+		pthread_mutex_unlock(&cp_lock);
+		return;
+	}
+	cp_state.enabled = 0;
+	cp_running = 0;
+	pthread_cond_signal(&cp_wake);
+	pthread_mutex_unlock(&cp_lock);
+	pthread_join(cp_thread, NULL);
+}
+
+/*
+ * read a checkpoint file
+ * @param path: checkpoint file
+ * @param cp: checkpoint to fill
+ * @return: 0 on success, 1 on error
+ */
+int
+checkpoint_read(char *path, struct checkpoint *cp)
+{
+	FILE *fp;
+	char line[LINE_LENGTH];
+	char *value;
+	int serial, att;
+
+	memset(cp, 0, sizeof(struct checkpoint));
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		printf(ERR "unable to open checkpoint for reading: %s\n", path);
+		return 1;
+	}
+
+	while (fgets(line, LINE_LENGTH, fp)) {
+		if (line[0] == '#' || (value = strchr(line, '=')) == NULL)
+			continue;
+		*value++ = '\0';
+		value[strcspn(value, "\n")] = '\0';
+
+		if (strcmp(line, "schedule") == 0) {
+			strncpy(cp->schedule, value, MAX_LENGTH - 1);
+		} else if (strcmp(line, "hash") == 0) {
+			cp->hash = strtoull(value, NULL, 16);
+		} else if (strcmp(line, "index") == 0) {
+			cp->index = strtoul(value, NULL, 10);
+		} else if (strcmp(line, "position") == 0) {
+			cp->position = strtoull(value, NULL, 10);
+		} else if (strcmp(line, "elapsed") == 0) {
+			cp->elapsed = strtoull(value, NULL, 10);
+		} else if (strcmp(line, "run") == 0) {
+			cp->run = strtoul(value, NULL, 10);
+		} else if (strcmp(line, "runs") == 0) {
+			cp->runs = strtoul(value, NULL, 10);
+		} else if (strcmp(line, "finished") == 0) {
+			cp->finished = atoi(value);
+		} else if (strcmp(line, "device") == 0
+			   && sscanf(value, "%d,%d", &serial, &att) == 2
+			   && cp->nr_devices < MAXDEVICES) {
+			cp->devices[cp->nr_devices].serial = serial;
+			cp->devices[cp->nr_devices++].value = att;
+		}
+	}
+	fclose(fp);
+	return 0;
+}
+
+/*
+ * restore the position of a schedule from a checkpoint. The step to start
+ * with is found by a binary search over the schedule time index.
+ * @param path: checkpoint file
+ * @param s: loaded schedule
+ * @param ud: user data struct, offset and runs are set
+ * @param run: storage for the run to continue with
+ * @return: 0 on success, 1 if the checkpoint can not be used
+ */
+int
+checkpoint_resume(char *path, struct schedule *s, struct user_data *ud,
+		  unsigned int *run)
+{
+	struct checkpoint cp;
+
+	if (checkpoint_read(path, &cp))
+		return 1;
+
+	if (cp.hash != s->hash) {
+		printf(ERR "checkpoint %s was written for a different schedule "
+		       "than %s\n", path, ud->path);
+		return 1;
+	}
+	if (cp.finished) {
+		printf(INFO "schedule of checkpoint %s is already finished\n", path);
+		return 1;
+	}
+	if (cp.position >= s->length) {
+		printf(ERR "checkpoint position is beyond the end of the schedule\n");
+		return 1;
+	}
+
+	ud->offset = (double)cp.position / time_unit_ns(ud);
+	ud->runs = cp.runs;
+	ud->cont = cp.runs == 0;
+	*run = cp.run;
+	resumed_elapsed = cp.elapsed;
+
+	if (!ud->quiet) {
+		printf(INFO "resuming run %lu at step %lu of %lu after %.3fs\n",
+		       cp.run + 1, schedule_seek(s, cp.position), s->count,
+		       (double)cp.elapsed / NSEC_PER_SEC);
+		if (cp.nr_devices)
+			printf(INFO "last value of device (serial %i) was %.2fdB\n",
+			       cp.devices[0].serial,
+			       (double)cp.devices[0].value / MULTIPLIER_STEP);
+	}
+	return 0;
+}
@@ -0,0 +1,59 @@
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+#include "input.h"
+#include "schedule.h"
+#include "LDAhid.h"
+
+#define DEFAULT_CHECKPOINT_INTERVAL 10
+#define CHECKPOINT_LENGTH 1024
+
+/* last value commanded to a device */
+struct checkpoint_device
+{
+	int serial;
+	int value;
+};
+
+/*
+ * position of a running schedule. The schedule position is derived from
+ * the wall clock time the current step started, so a checkpoint taken in
+ * the middle of a step resumes in the middle of it.
+ */
+struct checkpoint
+{
+	char path[MAX_LENGTH];
+	char schedule[MAX_LENGTH];
+	unsigned long long hash;
+	unsigned long index;
+	unsigned long long step_pos;
+	unsigned long long step_wall;
+	unsigned long long step_end;
+	unsigned long long origin;
+	unsigned long long position;
+	unsigned long long elapsed;
+	double speed;
+	unsigned long run;
+	unsigned long runs;
+	unsigned long long interval;
+	unsigned long long last_write;
+	int finished;
+	int enabled;
+	int nr_devices;
+	struct checkpoint_device devices[MAXDEVICES];
+};
+
+int checkpoint_start(char *path, char *schedule, unsigned long long hash,
+		     unsigned int interval);
+void checkpoint_run(unsigned long run, unsigned long runs);
+void checkpoint_step(unsigned long index, unsigned long long pos,
+		     unsigned long long wall, unsigned long long end,
+		     double speed, int serial, int value);
+int checkpoint_write(void);
+void checkpoint_finish(void);
+void checkpoint_stop(void);
+int checkpoint_read(char *path, struct checkpoint *cp);
+int checkpoint_resume(char *path, struct schedule *s, struct user_data *ud,
+		      unsigned int *run);
+
+#endif
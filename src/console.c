@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <pthread.h>
+#include "console.h"
+#include "status.h"
+#include "timing.h"
+#include "control.h"
+#include "LDAhid.h"
+
+#define CLEAR_LINE "\r\x1B[K"
+
+static pthread_t console_thread;
+static volatile int console_running;
+static unsigned int console_rate;
+static int console_lines;
+
+/*
+ * print a line for every device with a slot on the status page. A single
+ * device is shown in one refreshed line, several devices as a table which
+ * is redrawn in place.
+ * @param page: status page
+ */
+static void
+console_draw(struct status_page *page)
+{
+	struct dev_status s;
+	unsigned long long steps;
+	int i, lines = 0;
+
+	if (console_lines > 1)
+		printf("\x1B[%dA", console_lines - 1);
+
+	for (i = 0; i < STATUS_SLOTS; i++) {
+		if (status_read(page, i, &s) || s.writes == 0)
+			continue;
+
+		if (lines)
+			printf("\n");
+		/* closed loop mode has no steps, only writes are counted */
+		steps = s.steps ? s.index + 1 : s.writes;
+		printf(CLEAR_LINE "serial %d: %6.2fdB step %llu", s.serial,
+		       (double)s.attenuation / MULTIPLIER_STEP, steps);
+		if (s.count)
+			printf("/%llu (%5.1f%%)", (unsigned long long)s.count,
+			       100.0 * steps / s.count);
+		printf(" late %.3f ms, max %.3f ms, %llu missed, %llu skipped",
+		       (double)s.last_late / NSEC_PER_MSEC,
+		       (double)s.max_late / NSEC_PER_MSEC,
+		       (unsigned long long)s.missed,
+		       (unsigned long long)s.skipped);
+		if (s.errors)
+			printf(", %llu errors", (unsigned long long)s.errors);
+		lines++;
+	}
+
+	/* keep the cursor at the last line drawn */
+	if (lines < console_lines && console_lines > 1)
+		printf("\x1B[J");
+	if (lines)
+		console_lines = lines;
+	fflush(stdout);
+}
+
+/*
+ * redraw the status at the console rate until stopped
+ */
+static void *
+console_loop(void *arg)
+{
+	struct status_page *page = arg;
+	unsigned long long deadline, period;
+
+	period = NSEC_PER_SEC / console_rate;
+	deadline = time_now_ns();
+	while (console_running) {
+		deadline += period;
+		time_sleep_until_ns(deadline);
+		console_draw(page);
+	}
+	console_draw(page);
+	if (console_lines)
+		printf("\n");
+	return NULL;
+}
+
+/*
+ * show the live state of all devices instead of a line per step. The
+ * display reads the status page, the threads stepping the devices do not
+ * print anything for it.
+ * @param rate: redraws per second
+ * @return: 0 on success, 1 on error
+ */
+int
+console_start(unsigned int rate)
+{
+	struct status_page *page;
+
+	page = status_page();
+	if (page == NULL) {
+		printf(ERR "live status needs a status page\n");
+		return 1;
+	}
+	if (rate == 0) {
+		printf(ERR "live status rate has to be above 0\n");
+		return 1;
+	}
+
+	console_rate = rate;
+	console_lines = 0;
+	console_running = 1;
+	if (pthread_create(&console_thread, NULL, console_loop, page)) {
+		printf(ERR "unable to start live status thread\n");
+		console_running = 0;
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * draw the final state and end the live display
+ */
+void
+console_stop(void)
+{
+	if (!console_running)
+		return;
+	console_running = 0;
+	pthread_join(console_thread, NULL);
+}
@@ -0,0 +1,9 @@
+#ifndef _CONSOLE_H_
+#define _CONSOLE_H_
+
+#define DEFAULT_LIVE_RATE 10
+
+int console_start(unsigned int rate);
+void console_stop(void);
+
+#endif
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdarg.h>
 #include <unistd.h>
 #include <stdbool.h>
 #include <string.h>
@@ -6,7 +7,24 @@
 #include <signal.h>
 #include <libgen.h>
 #include "control.h"
+#include "mem.h"
 #include "input.h"
+#include "keyframe.h"
+#include "scenario.h"
+#include "mixer.h"
+#include "evloop.h"
+#include "devinit.h"
+#include "timing.h"
+#include "schedule.h"
+#include "checkpoint.h"
+#include "feedback.h"
+#include "analyze.h"
+#include "status.h"
+#include "sim.h"
+#include "health.h"
+#include "profile.h"
+#include "reload.h"
+#include "logger.h"
 #include "LDAhid.h"
 
 #define _GNU_SOURCE
@@ -14,7 +32,6 @@
 #define TRUE !FALSE
 #define STRING_LENGTH 12
 #define SLEEP_TIME 1000000
-#define MAX_USLEEP_TIME 1000000
 #define LINE_LENGTH 256
 #define TIME 1
 #define ATT 2
@@ -22,16 +39,29 @@
 #define TRIANGLE 1
 #define SIMPLE 0
 #define SINGLE_DEV 0
-#define SINGLE_DEV_ID 1
-#define MAX_MSG_SIZE 64
-#define MAX_PATH_LENGTH 512
-
-/* pthread struct */
-struct thread_arguments {
-	char *path;
-	int id;
+#define LATENCY_WEIGHT 8
+
+/*
+ * write state per device id of the tool, a library context binds its own
+ * with write_bind()
+ */
+static struct write_state tool_writes[MAXDEVICES + 1];
+static struct write_state *bound_writes[MAXDEVICES + 1];
+
+/* position of a ramp, triangle or hold, see form_begin() */
+struct form
+{
+	unsigned long index;
+	unsigned long count;
+	unsigned long long step;
+	unsigned long long deadline;
+	unsigned long long tolerance;
 };
 
+/* set on shutdown, writes started before it are counted in flight */
+static volatile int writes_stopped;
+static volatile int writes_in_flight;
+
 /*
  * Get device id from serial number
  * @param serial: device serial number
@@ -72,26 +102,6 @@ get_serial_and_name(unsigned int device_count, char *device_name)
 	}
 }
 
-/*
- * use usleep in a safe way for systems not supporting more than 1,000,000
- * microseconds for usleep
- * @param usec: time to sleep
- * @return: returns 0 if time is up
- */
-int
-susleep(unsigned long usec)
-{
-	int res;
-	unsigned long timeleft = usec;
-	while (timeleft > MAX_USLEEP_TIME) {
-		res = usleep(MAX_USLEEP_TIME);
-		if (res != 0)
-			return res;
-		timeleft -= MAX_USLEEP_TIME;
-	}
-	return usleep(timeleft);
-}
-
 /*
  * print out device information of attenuator
  * @param id: attenuator id
@@ -108,158 +118,248 @@ print_dev_info(int id)
 }
 
 /*
- * check device status and return error state if something is wrong
- * @param current_device: id of current device
- * @return: returns success, or error message
+ * hold a playback thread which wants to write after write_stop() until the
+ * program exits. It leaves a simulation, so the virtual clock does not
+ * wait for it.
+ */
+static void
+write_park(void)
+{
+	time_sim_leave();
+	for (;;)
+		pause();
+}
+
+/* errors of this thread go to a buffer instead of stdout, see report() */
+static __thread char *capture_buf;
+static __thread int capture_length;
+
+/*
+ * print a message starting with ERR, WARN or INFO. While a buffer is set
+ * with report_capture(), the first error is kept there without prefix and
+ * newline and all other messages are dropped.
+ * @param fmt: format like printf
+ */
+void
+report(const char *fmt, ...)
+{
+	size_t prefix = strlen(ERR);
+	va_list ap;
+
+	va_start(ap, fmt);
+	if (capture_buf == NULL) {
+		vprintf(fmt, ap);
+	} else if (capture_buf[0] == '\0' && strncmp(fmt, ERR, prefix) == 0) {
+		vsnprintf(capture_buf, capture_length, fmt + prefix, ap);
+		capture_buf[strcspn(capture_buf, "\n")] = '\0';
+	}
+	va_end(ap);
+}
+
+/*
+ * send the messages of report() in this thread to a buffer
+ * @param buf: storage for the first error, NULL to print again
+ * @param length: size of buf
+ */
+void
+report_capture(char *buf, int length)
+{
+	capture_buf = buf;
+	capture_length = length;
+	if (buf && length > 0)
+		buf[0] = '\0';
+}
+
+/*
+ * get the write state of a device
+ * @return: state, NULL for an invalid id
+ */
+static struct write_state *
+write_state(int id)
+{
+	if (id <= 0 || id > MAXDEVICES)
+		return NULL;
+	return bound_writes[id] ? bound_writes[id] : &tool_writes[id];
+}
+
+/*
+ * write an attenuation to a device and publish it on the status page.
+ * Writes to a device lost from the bus are skipped until the health monitor
+ * brings it back, failed writes report the loss to it.
+ * @param id: device id
+ * @param value: attenuation in MULTIPLIER_STEP units
+ * @return: status of the device
+ */
+LVSTATUS
+write_attenuation(int id, int value)
+{
+	struct write_state *ws;
+	LVSTATUS status;
+	unsigned long long issued, done;
+	int skipped;
+
+	__sync_fetch_and_add(&writes_in_flight, 1);
+	if (writes_stopped) {
+		__sync_fetch_and_sub(&writes_in_flight, 1);
+		write_park();
+	}
+
+	skipped = health_skip(id);
+	if (skipped) {
+		status = DEVICE_NOT_READY;
+	} else {
+		issued = time_now_ns();
+		if (sim_present(id))
+			status = fnLDA_SetAttenuation(id, value);
+		else
+			status = DEVICE_NOT_READY;
+		done = time_now_ns();
+		if (status == STATUS_OK)
+			sim_record(id, value);
+		else
+			health_failed(id);
+	}
+	status_write(id, value, skipped ? 2 : status != STATUS_OK);
+
+	if ((ws = write_state(id))) {
+		/* moving average of the write latency, weight 1/LATENCY_WEIGHT */
+		if (status == STATUS_OK) {
+			if (ws->latency_est == 0)
+				ws->latency_est = done - issued;
+			else
+				ws->latency_est = ws->latency_est
+						  - ws->latency_est / LATENCY_WEIGHT
+						  + (done - issued) / LATENCY_WEIGHT;
+			ws->latency_done = done;
+			if (ws->first_done == 0)
+				ws->first_done = done;
+		}
+		/* kept while the device is lost, it is written when it is back */
+		ws->shadow = value;
+	}
+	__sync_fetch_and_sub(&writes_in_flight, 1);
+	return status;
+}
+
+/*
+ * keep the write state of a device in the given storage instead of the
+ * table of the tool, NULL goes back to the table
+ * @param id: device id
+ * @param ws: storage owned by the caller until it binds NULL again
+ */
+void
+write_bind(int id, struct write_state *ws)
+{
+	if (id > 0 && id <= MAXDEVICES)
+		bound_writes[id] = ws;
+}
+
+/*
+ * stop the playback for good: writes in progress are finished, every
+ * thread trying to write afterwards is parked until the program exits.
+ * The devices can be closed once this returns.
+ */
+void
+write_stop(void)
+{
+	struct timespec wait = { 0, 100000 };
+
+	writes_stopped = 1;
+	__sync_synchronize();
+	while (writes_in_flight)
+		nanosleep(&wait, NULL);
+}
+
+/*
+ * get the attenuation last written to a device, without asking the device
+ * @param id: device id
+ * @return: attenuation in MULTIPLIER_STEP units
+ */
+int
+written_attenuation(int id)
+{
+	struct write_state *ws = write_state(id);
+
+	return ws ? ws->shadow : 0;
+}
+
+/*
+ * start looking for the next write to a device, see write_times()
+ * @param id: device id
  */
-char *
-get_device_data(unsigned int current_device)
+void
+write_mark(int id)
 {
-	char *success = "Successfully checked device\n";
-	unsigned int status;
-
-	status = fnLDA_GetAttenuation(current_device);
-	if (status == INVALID_DEVID
-	    || status == DEVICE_NOT_READY)
-		return strncpy(errmsg ,fnLDA_perror(status),
-		     strlen(errmsg));
-
-	status = fnLDA_GetMinAttenuation(current_device);
-	if (status == INVALID_DEVID
-	    || status == DEVICE_NOT_READY)
-		return strncpy(errmsg ,fnLDA_perror(status),
-		     strlen(errmsg));
-
-	status = fnLDA_GetMaxAttenuation(current_device);
-	if (status == INVALID_DEVID
-	    || status == DEVICE_NOT_READY)
-		return strncpy(errmsg ,fnLDA_perror(status),
-		     strlen(errmsg));
-
-	status = fnLDA_GetIdleTime(current_device);
-	if (status == INVALID_DEVID
-	    || status == DEVICE_NOT_READY)
-		return strncpy(errmsg ,fnLDA_perror(status),
-		     strlen(errmsg));
-
-	status = fnLDA_GetDwellTime(current_device);
-	if (status == INVALID_DEVID
-	    || status == DEVICE_NOT_READY)
-		return strncpy(errmsg ,fnLDA_perror(status),
-		     strlen(errmsg));
-
-	status = fnLDA_GetAttenuationStep(current_device);
-	if (status == INVALID_DEVID
-	    || status == DEVICE_NOT_READY)
-		return strncpy(errmsg ,fnLDA_perror(status),
-		     strlen(errmsg));
-
-	status = fnLDA_GetRF_On(current_device);
-	if (status == INVALID_DEVID
-	    || status == DEVICE_NOT_READY)
-		return strncpy(errmsg ,fnLDA_perror(status),
-		     strlen(errmsg));
-
-	status = fnLDA_GetRampStart(current_device);
-	if (status == INVALID_DEVID
-	    || status == DEVICE_NOT_READY)
-		return strncpy(errmsg ,fnLDA_perror(status),
-		     strlen(errmsg));
-
-	status = fnLDA_GetRampEnd(current_device);
-	if (status == INVALID_DEVID
-	    || status == DEVICE_NOT_READY)
-		return strncpy(errmsg ,fnLDA_perror(status),
-		     strlen(errmsg));
-	return success;
+	struct write_state *ws = write_state(id);
+
+	if (ws)
+		ws->first_done = 0;
 }
 
 /*
- * help function to display possible options and correct usage
+ * get the times the first write since write_mark() and the last write to
+ * a device completed
+ * @param id: device id
+ * @param first: storage for the first completion, 0 if none
+ * @param last: storage for the last completion, 0 if none
  */
 void
-call_help(void)
+write_times(int id, unsigned long long *first, unsigned long long *last)
+{
+	struct write_state *ws = write_state(id);
+
+	*first = ws ? ws->first_done : 0;
+	*last = ws ? ws->latency_done : 0;
+}
+
+/*
+ * get the estimated time a write to a device takes
+ * @param id: device id
+ * @return: moving average of the write latency in nanoseconds
+ */
+unsigned long long
+write_latency(int id)
 {
-	printf("-to show this overview use\n");
-	printf("\t-h\n");
-	printf("\r\n");
-
-	printf("-set attenuation with\n");
-	printf("\t-a <attenuation in dB>\n");
-	printf("\r\n");
-
-	printf("-set end attenuation strength in dB with\n");
-	printf("\t-end <dB>\n");
-	printf("\r\n");
-
-	printf("-to use a .csv file\n");
-	printf("\t-f path/to/file\n");
-	printf("\tcsv file is expected to have time;attenuation format\n");
-	printf("\r\n");
-
-	printf("print additional device information\n");
-	printf("\t-i\n");
-	printf("\r\n");
-
-	printf("-log attenuation changes to a .csv file\n");
-	printf("\t-l path/to/logfile\n");
-	printf("\r\n");
-
-	printf("-remove [INFO] output\n");
-	printf("\t-q\n");
-	printf("\r\n");
-
-	printf("-repeat form, or file input until canceled by user\n");
-	printf("\t-r\n");
-	printf("\r\n");
-
-	printf("-set attenuation form with\n");
-	printf("\t-ramp|-triangle\n");
-	printf("\r\n");
-
-	printf("-repeat form, or file input for several times\n");
-	printf("\t-rr <#runs>\n");
-	printf("\r\n");
-
-	printf("-set starting attenuation strength in dB with\n");
-	printf("\t-start <dB>\n");
-	printf("\r\n");
-
-	printf("-set size of steps for attenuation in dB with\n");
-	printf("\t-step <dB>\n");
-	printf("\r\n");
-
-	printf("-set time for attenuation duration with\n");
-	printf("\t-t <time in sec>\n");
-	printf("\r\n");
-
-	printf("\tyou can use s, ms or us to set time units\n");
-	printf("\t\ts -> seconds\n");
-	printf("\t\tms -> milliseconds\n");
-	printf("\t\tus -> microseconds\n");
-	printf("\r\n");
-
-	printf("-use specific device detected by serial number\n");
-	printf("\t-n <serial number>\n");
-	printf("\r\n");
-
-	printf("-to use more than one connected attenuator use\n");
-	printf("\t-md <config_file1> <config_file2> ...\n");
-	printf("\r\n");
-	printf("\t every connected and detected attenuator will be used\n");
-	printf("\t if there are more config files than attenuators detected\n");
-	printf("\t the remaining files will be discarded\n");
-	printf("\r\n");
-
-	printf("-to use more than one connected attenuator (with serial number association) use\n");
-	printf("\t-mds <serial_num_1.csv> <serial_num_2.csv> ...\n");
-	printf("\r\n");
-	printf("\t every attenuator matching with serial number specified in configuration file will be used\n");
-	printf("\t not matching attenuators will be discarded\n");
-	printf("\t [NOTE] file format is: serial number + csv extension, eg. 10314.csv\n");
-	printf("\r\n");
-
-	return;
+	struct write_state *ws = write_state(id);
+
+	return ws ? ws->latency_est : 0;
+}
+
+/*
+ * get the time a write has to be issued before its deadline so the
+ * attenuation is set at the deadline. -latoffset overrides the estimate.
+ * @param id: device id
+ * @param ud: user data struct
+ * @return: lead time in nanoseconds, 0 without compensation
+ */
+unsigned long long
+write_lead(int id, struct user_data *ud)
+{
+	if (ud->lat_offset)
+		return (unsigned long long)ud->lat_offset * NSEC_PER_USEC;
+	if (ud->lat_comp)
+		return write_latency(id);
+	return 0;
+}
+
+/*
+ * log the latency estimate of a device and the time its last write
+ * completed after the deadline, negative if it completed early
+ * @param id: device id
+ * @param index: index of the step
+ * @param deadline: deadline of the write
+ * @param ud: user data struct
+ */
+void
+write_residual(int id, unsigned long index, unsigned long long deadline,
+	       struct user_data *ud)
+{
+	struct write_state *ws = write_state(id);
+
+	if ((!ud->lat_comp && !ud->lat_offset) || ws == NULL)
+		return;
+	log_latency(index, ws->latency_est,
+		    (long long)(ws->latency_done - deadline), ud);
 }
 
 /*
@@ -282,7 +382,7 @@ check_att_limits(int id, int serial, struct user_data *ud, int check)
 			printf(WARN "attenuation has been set to %.2fdB (serial %i)\n",
 				(double)fnLDA_GetMinAttenuation(id) / MULTIPLIER_STEP,
 				serial);
-			fnLDA_SetAttenuation(id, fnLDA_GetMinAttenuation(id));
+			write_attenuation(id, fnLDA_GetMinAttenuation(id));
 			log_attenuation(fnLDA_GetMinAttenuation(id), ud);
 		} else if (ud->attenuation > fnLDA_GetMaxAttenuation(id)) {
 			printf(WARN "%.2f is above maximal attenuation of %.2f (serial %i)\n",
@@ -292,12 +392,12 @@ check_att_limits(int id, int serial, struct user_data *ud, int check)
 			printf(WARN "attenuation has been set to %.2f (serial %i)\n",
 				(double)fnLDA_GetMaxAttenuation(id) / MULTIPLIER_STEP,
 				serial);
-			fnLDA_SetAttenuation(id, fnLDA_GetMaxAttenuation(id));
+			write_attenuation(id, fnLDA_GetMaxAttenuation(id));
 			log_attenuation(fnLDA_GetMaxAttenuation(id), ud);
 		} else {
-			fnLDA_SetAttenuation(id, (ud->attenuation));
+			write_attenuation(id, (ud->attenuation));
 			log_attenuation(ud->attenuation, ud);
-			if (!ud->quiet) {
+			if (!ud->quiet && !ud->live) {
 				printf(INFO "set device (serial %i) to %.2fdB attenuation\n",
 					serial, (double)(fnLDA_GetAttenuation(id)) / MULTIPLIER_STEP);
 					if (ud->us == 1)
@@ -387,18 +487,54 @@ calc_nr_steps(struct user_data *ud)
 }
 
 /*
- * keep attenuation for given time
- * @param ud: user data struct
+ * start a ramp, triangle or hold. Its writes are published as steps with
+ * the deadline of the next write, so monitors see the progress and the
+ * readback verifier keeps clear of the next write.
+ * @param f: form to start
+ * @param count: writes in a run of the form, the index wraps after it
+ * @param ud: user data struct with the time of a step
  */
-void
-attenuation_time(struct user_data *ud)
+static void
+form_begin(struct form *f, unsigned long count, struct user_data *ud)
 {
-	if (ud->us == 1)
-		susleep(TIME_MICROS(ud->atime));
-	else if (ud->ms == 1)
-		susleep(TIME_MILLIS(ud->atime));
-	else
-		susleep(TIME_SECONDS(ud->atime));
+	f->index = 0;
+	f->count = count;
+	f->step = ud->atime * time_unit_ns(ud);
+	f->deadline = time_now_ns();
+	f->tolerance = (unsigned long long)ud->tolerance * NSEC_PER_USEC;
+}
+
+/*
+ * publish a write of a form which was just done
+ */
+static void
+form_written(int id, struct form *f)
+{
+	f->deadline = time_now_ns() + f->step;
+	status_step(id, f->index, f->count, f->deadline);
+	f->index = (f->index + 1) % f->count;
+}
+
+static void
+form_write(int id, struct form *f, int value)
+{
+	write_attenuation(id, value);
+	form_written(id, f);
+}
+
+/*
+ * keep the value of the last write for the time of a step and publish how
+ * late the wait ended
+ */
+static void
+form_wait(int id, struct form *f)
+{
+	unsigned long long now, late;
+
+	time_sleep_until_ns(f->deadline);
+	now = time_now_ns();
+	late = now > f->deadline ? now - f->deadline : 0;
+	status_late(id, late, late > f->tolerance, 0);
 }
 
 /*
@@ -411,6 +547,7 @@ attenuation_time(struct user_data *ud)
 int
 set_ramp(int id, struct user_data *ud)
 {
+	struct form f;
 	int i, cur_att, nr_steps, serial;
 	serial = fnLDA_GetSerialNumber(id);
 	check_att_limits(id, serial, ud, RAMP);
@@ -422,77 +559,79 @@ set_ramp(int id, struct user_data *ud)
 		printf(ERR "start and end attenuation are equal\n");
 		return 1;
 	}
+	/* a run of the ramp writes its start and every step */
+	form_begin(&f, nr_steps + 1, ud);
 
 	if (ud->cont && (ud->start_att < ud->end_att)) {
 		for(;;) {
-			fnLDA_SetAttenuation(id, ud->start_att);
+			form_write(id, &f, ud->start_att);
 			log_attenuation(ud->start_att, ud);
 			for(i = 0; i < nr_steps; i++) {
-				attenuation_time(ud);
-				cur_att = fnLDA_GetAttenuation(id);
-				fnLDA_SetAttenuation(id,
+				form_wait(id, &f);
+				cur_att = written_attenuation(id);
+				form_write(id, &f,
 					cur_att + ud->ramp_steps);
-				if (!ud->quiet)
+				if (!ud->quiet && !ud->live)
 					printf(INFO "attenuation set to %.2fdB\n",
 						((double)cur_att) / MULTIPLIER_STEP);
 				log_attenuation(cur_att + ud->ramp_steps, ud);
 			}
-			cur_att = fnLDA_GetAttenuation(id);
-			if (!ud->quiet)
+			cur_att = written_attenuation(id);
+			if (!ud->quiet && !ud->live)
 				printf(INFO "attenuation set to %.2fdB\n", ((double)cur_att) / MULTIPLIER_STEP);
 		}
 	}
 	if (ud->cont && (ud->start_att > ud->end_att)) {
 		for(;;) {
-			fnLDA_SetAttenuation(id, ud->start_att);
+			form_write(id, &f, ud->start_att);
 			log_attenuation(ud->start_att, ud);
 			for(i = 0; i < nr_steps; i++) {
-				attenuation_time(ud);
-				cur_att = fnLDA_GetAttenuation(id);
-				fnLDA_SetAttenuation(id,
+				form_wait(id, &f);
+				cur_att = written_attenuation(id);
+				form_write(id, &f,
 					cur_att - ud->ramp_steps);
-				if (!ud->quiet)
+				if (!ud->quiet && !ud->live)
 					printf(INFO "attenuation set to %.2fdB\n",
 						((double)cur_att) / MULTIPLIER_STEP);
 				log_attenuation(cur_att - ud->ramp_steps, ud);
 			}
-			cur_att = fnLDA_GetAttenuation(id);
-			if (!ud->quiet)
+			cur_att = written_attenuation(id);
+			if (!ud->quiet && !ud->live)
 				printf(INFO "attenuation set to %.2fdB\n",
 					((double)cur_att) / MULTIPLIER_STEP);
 		}
 	}
 	if (ud->start_att < ud->end_att) {
-		fnLDA_SetAttenuation(id, ud->start_att);
+		form_write(id, &f, ud->start_att);
 		log_attenuation(ud->start_att, ud);
 		for(i = 0; i < nr_steps; i++) {
-			attenuation_time(ud);
-			cur_att = fnLDA_GetAttenuation(id);
-			fnLDA_SetAttenuation(id,
+			form_wait(id, &f);
+			cur_att = written_attenuation(id);
+			form_write(id, &f,
 				cur_att + ud->ramp_steps);
-			if (!ud->quiet)
+			if (!ud->quiet && !ud->live)
 				printf(INFO "attenuation set to %.2fdB\n",
 					((double)cur_att) / MULTIPLIER_STEP);
 			log_attenuation(cur_att + ud->ramp_steps, ud);
 		}
 	}
 	if (ud->start_att > ud->end_att) {
-		fnLDA_SetAttenuation(id, ud->start_att);
+		form_write(id, &f, ud->start_att);
 		log_attenuation(ud->start_att, ud);
 		for(i = 0; i < nr_steps; i++) {
-			attenuation_time(ud);
-			cur_att = fnLDA_GetAttenuation(id);
-			fnLDA_SetAttenuation(id,
+			form_wait(id, &f);
+			cur_att = written_attenuation(id);
+			form_write(id, &f,
 				cur_att - ud->ramp_steps);
-			if (!ud->quiet)
+			if (!ud->quiet && !ud->live)
 				printf(INFO "attenuation set to %.2fdB\n",
 					((double)cur_att) / MULTIPLIER_STEP);
 			log_attenuation(cur_att - ud->ramp_steps, ud);
 		}
 	}
-	attenuation_time(ud);
-	cur_att = fnLDA_GetAttenuation(id);
-	if (!ud->quiet)
+	form_wait(id, &f);
+	cur_att = written_attenuation(id);
+	if (!ud->quiet && !ud->live)
 		printf(INFO "attenuation set to %.2fdB\n",
 			((double)cur_att) / MULTIPLIER_STEP);
 
@@ -511,11 +650,14 @@ set_ramp(int id, struct user_data *ud)
 void
 set_attenuation(int id, struct user_data *ud)
 {
+	struct form f;
 	int serial;
 
 	serial = fnLDA_GetSerialNumber(id);
 	check_att_limits(id, serial, ud, SIMPLE);
-	attenuation_time(ud);
+	form_begin(&f, 1, ud);
+	form_written(id, &f);
+	form_wait(id, &f);
 }
 
 /*
@@ -528,6 +670,7 @@ set_attenuation(int id, struct user_data *ud)
 int
 set_triangle(int id, struct user_data *ud)
 {
+	struct form f;
 	int i, cur_att, nr_steps, serial;
 	serial = fnLDA_GetSerialNumber(id);
 	check_att_limits(id, serial, ud, TRIANGLE);
@@ -539,125 +682,125 @@ set_triangle(int id, struct user_data *ud)
 		printf(ERR "start and end attenuation are equal\n");
 		return 1;
 	}
+	/* a period of the triangle writes its start, the way up and down */
+	form_begin(&f, 2 * nr_steps + 1, ud);
 
-	fnLDA_SetAttenuation(id, ud->start_att);
+	form_write(id, &f, ud->start_att);
 	log_attenuation(ud->start_att, ud);
 	if (ud->cont && (ud->start_att < ud->end_att)) {
 		for(;;) {
 			for (i = 0; i < nr_steps; i++) {
-				attenuation_time(ud);
-				cur_att = fnLDA_GetAttenuation(id);
-				if (!ud->quiet)
+				form_wait(id, &f);
+				cur_att = written_attenuation(id);
+				if (!ud->quiet && !ud->live)
 					printf(INFO "attenuation set to %.2fdB\n",
 						((double)cur_att) / MULTIPLIER_STEP);
-				fnLDA_SetAttenuation(id,
+				form_write(id, &f,
 					cur_att + ud->ramp_steps);
 				log_attenuation(cur_att + ud->ramp_steps, ud);
 			}
 			for (i = 1; i <= nr_steps; i++) {
-				attenuation_time(ud);
-				cur_att = fnLDA_GetAttenuation(id);
-				if (!ud->quiet)
+				form_wait(id, &f);
+				cur_att = written_attenuation(id);
+				if (!ud->quiet && !ud->live)
 					printf(INFO "attenuation set to %.2fdB\n",
 						((double)cur_att) / MULTIPLIER_STEP);
-				fnLDA_SetAttenuation(id,
+				form_write(id, &f,
 					cur_att - ud->ramp_steps);
 				log_attenuation(cur_att - ud->ramp_steps, ud);
 			}
-			fnLDA_SetAttenuation(id, ud->start_att);
+			form_write(id, &f, ud->start_att);
 			log_attenuation(ud->start_att, ud);
 		}
 	}
 	if (ud->start_att < ud->end_att) {
 		for (i = 0; i < nr_steps; i++) {
-			attenuation_time(ud);
-			cur_att = fnLDA_GetAttenuation(id);
-			if (!ud->quiet)
+			form_wait(id, &f);
+			cur_att = written_attenuation(id);
+			if (!ud->quiet && !ud->live)
 				printf(INFO "attenuation set to %.2fdB\n",
 					((double)cur_att) / MULTIPLIER_STEP);
-			fnLDA_SetAttenuation(id, cur_att + ud->ramp_steps);
+			form_write(id, &f, cur_att + ud->ramp_steps);
 			log_attenuation(cur_att + ud->ramp_steps, ud);
 		}
 		for (i = 1; i <= nr_steps; i++) {
-			attenuation_time(ud);
-			cur_att = fnLDA_GetAttenuation(id);
-			if (!ud->quiet)
+			form_wait(id, &f);
+			cur_att = written_attenuation(id);
+			if (!ud->quiet && !ud->live)
 				printf(INFO "attenuation set to %.2fdB\n",
 					((double)cur_att) / MULTIPLIER_STEP);
-			fnLDA_SetAttenuation(id, cur_att - ud->ramp_steps);
+			form_write(id, &f, cur_att - ud->ramp_steps);
 			log_attenuation(cur_att - ud->ramp_steps, ud);
 		}
-		fnLDA_SetAttenuation(id, ud->start_att);
+		form_write(id, &f, ud->start_att);
 		log_attenuation(ud->start_att, ud);
 	}
 	if (ud->cont && (ud->start_att > ud->end_att)) {
 		for(;;) {
 			for (i = 0; i < nr_steps; i++) {
-				attenuation_time(ud);
-				cur_att = fnLDA_GetAttenuation(id);
-				if (!ud->quiet)
+				form_wait(id, &f);
+				cur_att = written_attenuation(id);
+				if (!ud->quiet && !ud->live)
 					printf(INFO "attenuation set to %.2fdB\n",
 						((double)cur_att) / MULTIPLIER_STEP);
-				fnLDA_SetAttenuation(id,
+				form_write(id, &f,
 					cur_att - ud->ramp_steps);
 				log_attenuation(cur_att - ud->ramp_steps, ud);
 			}
 			for (i = 1; i <= nr_steps; i++) {
-				attenuation_time(ud);
-				cur_att = fnLDA_GetAttenuation(id);
-				if (!ud->quiet)
+				form_wait(id, &f);
+				cur_att = written_attenuation(id);
+				if (!ud->quiet && !ud->live)
 					printf(INFO "attenuation set to %.2fdB\n",
 						((double)cur_att) / MULTIPLIER_STEP);
-				fnLDA_SetAttenuation(id,
+				form_write(id, &f,
 					cur_att + ud->ramp_steps);
 				log_attenuation(cur_att + ud->ramp_steps, ud);
 			}
-			fnLDA_SetAttenuation(id, ud->start_att);
+			form_write(id, &f, ud->start_att);
 			log_attenuation(ud->start_att, ud);
 		}
 	}
 	if (ud->start_att > ud->end_att) {
 		for (i = 0; i < nr_steps; i++) {
-			attenuation_time(ud);
-			cur_att = fnLDA_GetAttenuation(id);
-			if (!ud->quiet)
+			form_wait(id, &f);
+			cur_att = written_attenuation(id);
+			if (!ud->quiet && !ud->live)
 				printf(INFO "attenuation set to %.2fdB\n",
 					((double)cur_att) / MULTIPLIER_STEP);
-			fnLDA_SetAttenuation(id, cur_att - ud->ramp_steps);
+			form_write(id, &f, cur_att - ud->ramp_steps);
 			log_attenuation(cur_att - ud->ramp_steps, ud);
 		}
 		for (i = 1; i <= nr_steps; i++) {
-			attenuation_time(ud);
-			cur_att = fnLDA_GetAttenuation(id);
-			if (!ud->quiet)
+			form_wait(id, &f);
+			cur_att = written_attenuation(id);
+			if (!ud->quiet && !ud->live)
 				printf(INFO "attenuation set to %.2fdB\n",
 					((double)cur_att) / MULTIPLIER_STEP);
-			fnLDA_SetAttenuation(id, cur_att + ud->ramp_steps);
+			form_write(id, &f, cur_att + ud->ramp_steps);
 			log_attenuation(cur_att + ud->ramp_steps, ud);
 		}
-		fnLDA_SetAttenuation(id, ud->start_att);
+		form_write(id, &f, ud->start_att);
 		log_attenuation(ud->start_att, ud);
 	}
-	attenuation_time(ud);
-	cur_att = fnLDA_GetAttenuation(id);
-	if (!ud->quiet)
+	form_wait(id, &f);
+	cur_att = written_attenuation(id);
+	if (!ud->quiet && !ud->live)
 		printf(INFO "attenuation set to %.2fdB\n", ((double)cur_att) / MULTIPLIER_STEP);
 	return 0;
 }
 
 /*
  * allocate memory for user data struct
- * return: allocated user data struct address
+ * return: allocated user data struct address, NULL if out of memory
  */
 struct user_data *
 allocate_user_data(void)
 {
-	struct user_data *ud = malloc(sizeof(struct user_data));
+	struct user_data *ud = mem_alloc(sizeof(struct user_data));
 
-	if (ud == NULL) {
+	if (ud == NULL)
 		printf(ERR "could not allocate memory for user data\n");
-		exit(1);
-	}
 	return ud;
 }
 
@@ -671,6 +814,21 @@ set_data(struct user_data *ud, int id)
 {
 	unsigned int i;
 	int res = 0;
+	struct keyframe_schedule ks;
+	struct scenario sc;
+	struct mix mx;
+	struct schedule sched, *play, *next;
+	struct play_stats st;
+	struct reloader *rl = NULL;
+	unsigned long long from, begin, pos;
+	int cut;
+
+	if (!ud->simple && (ud->ramp || ud->triangle))
+		profile_form(id, ud);
+	/* a schedule sizes the ring of the log, it is opened after the load */
+	if (!ud->file)
+		log_open(ud);
+
 	if (ud->simple == 1) {
 		set_attenuation(id, ud);
 	} else if (ud->triangle && ud->cont) {
@@ -697,62 +855,99 @@ set_data(struct user_data *ud, int id)
 			if (res)
 				return;
 		}
-	} else if (ud->file && ud->cont) {
-		while (res == 0)
-			res = read_file(ud->path, id, ud);
-	} else if (ud->file && (ud->runs > 1)) {
-		while (res == 0)
-			res = read_file(ud->path, id, ud);
-	} else if (ud->file && (ud->cont == 0)) {
-		read_file(ud->path, id, ud);
+	} else if (ud->keyframe) {
+		if (keyframe_load(ud->path, &ks, ud))
+			return;
+		for (i = 0; (ud->cont || i < ud->runs) && res == 0; i++) {
+			res = keyframe_play(id, &ks, ud);
+			ud->offset = 0;
+		}
+		keyframe_free(&ks);
+	} else if (ud->scenario) {
+		if (scenario_load(ud->path, &sc))
+			return;
+		if (ud->cont) {
+			while (res == 0)
+				res = scenario_run(id, &sc, ud);
+		} else {
+			for (i = 0; i < ud->runs && res == 0; i++)
+				res = scenario_run(id, &sc, ud);
+		}
+		scenario_free(&sc);
+	} else if (ud->mix) {
+		if (mix_load(ud->path, &mx, ud))
+			return;
+		mix_run(id, &mx, ud);
+		mix_free(&mx);
+	} else if (ud->closed_loop) {
+		memset(&st, 0, sizeof(struct play_stats));
+		closed_loop_run(id, ud, &st);
+	} else if (ud->file) {
+		if (schedule_load(ud->path, &sched, ud))
+			return;
+		profile_schedule(id, ud->path, &sched, ud, 0);
+		ud->log_ring = logger_ring_size(sched.shortest, ud->speed);
+		log_open(ud);
+		i = 0;
+		if (ud->resume[0] != '\0') {
+			if (checkpoint_resume(ud->resume, &sched, ud, &i)) {
+				schedule_free(&sched);
+				return;
+			}
+			/* keep the checkpoint up to date while resuming */
+			if (ud->checkpoint[0] == '\0')
+				memcpy(ud->checkpoint, ud->resume, MAX_LENGTH);
+		}
+		if (ud->checkpoint[0] != '\0'
+		    && checkpoint_start(ud->checkpoint, ud->path, sched.hash,
+					ud->checkpoint_interval)) {
+			schedule_free(&sched);
+			return;
+		}
+		play = &sched;
+		/* a checkpoint belongs to one version of the schedule */
+		if (ud->reload && ud->checkpoint[0] != '\0')
+			printf(WARN "-reload is not used together with a "
+			       "checkpoint\n");
+		else if (ud->reload
+			 && (rl = reload_start(ud->path, id, &sched, ud)))
+			play = reload_current(rl);
+		/* the start offset only applies to the first run */
+		for (; (ud->cont || i < ud->runs) && res == 0; i++) {
+			checkpoint_run(i, ud->cont ? 0 : ud->runs);
+			memset(&st, 0, sizeof(struct play_stats));
+			from = (unsigned long long)(ud->offset * time_unit_ns(ud));
+			begin = time_now_ns();
+			if (rl)
+				reload_arm(rl, &st);
+			res = schedule_play(id, play, ud, &st);
+			ud->offset = 0;
+			if (rl == NULL || res || (next = reload_take(rl, &cut)) == NULL)
+				continue;
+			play = next;
+			/* a stopped run goes on at the same time in the new version */
+			pos = from + (unsigned long long)((time_now_ns() - begin)
+				* (ud->speed > 0 ? ud->speed : 1));
+			if (cut && pos < play->length) {
+				ud->offset = (double)pos / time_unit_ns(ud);
+				i--;
+			}
+		}
+		if (res == 0)
+			checkpoint_finish();
+		checkpoint_stop();
+		if (rl)
+			reload_stop(rl);
+		else
+			schedule_free(&sched);
 	}
 
 	if (ud->atime != 0) {
-		fnLDA_SetAttenuation(id, 0);
+		write_attenuation(id, 0);
 		log_attenuation(0, ud);
 	}
 }
 
-/*
- * check if the user wants to use multiple attenuators
- * @param argc: argument count
- * @param *argv: arguments passed to the program
- * return returns 1 or 2 on multiple devices, else 0
- */
-int
-check_multi_device(char *argv[])
-{
-	if (strncmp(argv[1], "-md", strlen(argv[1])) == 0)
-		return 1;
-	else if (strncmp(argv[1], "-mds", strlen(argv[1])) == 0)
-		return 2;
-	else
-		return 0;
-}
-
-/*
- * get instructions for attenuator from file and start it
- * @param arguments: pthread argument struct
- */
-void *
-start_device(void *arguments)
-{
-	char *path;
-	int id;
-	struct thread_arguments *args = arguments;
-	struct user_data *ud = allocate_user_data();
-	clear_userdata(ud);
-
-	path = args->path;
-	id = args->id;
-
-	pthread_mutex_unlock(&device_mutex);
-
-	read_file(path, id, ud);
-	free(ud);
-	pthread_exit((void *)(intptr_t)args->id);
-}
-
 /*
  * close specific device
  * @param id: device id
@@ -775,7 +970,7 @@ close_single_device(int id, DEVID *working_devices, int quiet)
 }
 
 /*
- * close any open devices
+ * close any open devices, except those still initializing
  * @param nr_active_devices: number of active devices
  * @param working_devices: array of active devices
  */
@@ -785,8 +980,14 @@ close_devices(int nr_active_devices, DEVID *working_devices, int quiet)
 	int i, status, serial = 0;
 
 	for (i = 1; i <= nr_active_devices; i++) {
-		status = fnLDA_CloseDevice(working_devices[i - 1]);
 		serial = fnLDA_GetSerialNumber(working_devices[i - 1]);
+		/* a worker of a timed out init may still use the device */
+		if (init_pending(working_devices[i - 1])) {
+			printf(WARN "device %d (serial %i) is still "
+			       "initializing and is left open\n", i, serial);
+			continue;
+		}
+		status = fnLDA_CloseDevice(working_devices[i - 1]);
 		if (status != 0) {
 			printf(ERR "shutting down device %d (serial %i) failed\n",
 			       i, serial);
@@ -797,20 +998,6 @@ close_devices(int nr_active_devices, DEVID *working_devices, int quiet)
 	}
 }
 
-/*
- * manage termination signal
- * @param sig: signal type
- */
-void sighandler(int sig)
-{
-	DEVID working_devices[MAXDEVICES];
-	int nr_active_devices;
-
-	nr_active_devices = fnLDA_GetDevInfo(working_devices);
-	close_devices(nr_active_devices, working_devices, 0);
-	exit(0);
-}
-
 /*
  * check if quiet flag is enabled
  * @param argc: argument count
@@ -826,318 +1013,3 @@ check_quiet(int argc, char *argv[])
 			return 1;
 	return 0;
 }
-
-/*
- * check if serial number flag is enabled
- * @param argc: argument count
- * @param argv: array of function arguments
- * @return returns 1 if -n is set else 0
- */
-int
-check_serial_number(int argc, char *argv[])
-{
-	int i = 0;
-	for (;i < argc; i++)
-		if (strncmp(argv[i], "-n", strlen(argv[i])) == 0)
-			return 1;
-	return 0;
-}
-
-/*
- * check if info flag is enabled
- * @param argc: argument count
- * @param argv: array of function arguments
- * @return returns 1 if -i is set else 0
- */
-int
-check_info(int argc, char *argv[])
-{
-	int i = 0;
-	for (;i < argc; i++)
-		if (strncmp(argv[i], "-i", strlen(argv[i])) == 0)
-			return 1;
-	return 0;
-}
-
-/*
- * start thread for each active device
- * @param argc: argument count
- * @param argv: arguments given by the user
- * @param file_serial_check: flag to parse serial number from filename
- */
-void
-handle_multi_dev(int argc, char *argv[], int file_serial_check)
-{
-	struct thread_arguments args;
-	pthread_t threads[MAXDEVICES];
-	unsigned int device_count = 0;
-	int length;
-	int i, nr_active_devices, file_count, ret, state, quiet, info, serial;
-	DEVID working_devices[MAXDEVICES];
-	DEVID id;
-	char message[MAX_MSG_SIZE];
-	char device_name[MAX_MODELNAME];
-	void *status;
-
-	device_count = (unsigned int)fnLDA_GetNumDevices();
-
-	quiet = check_quiet(argc, argv);
-	info = check_info(argc, argv);
-
-	if (device_count == 0) {
-		printf(ERR "There is no attenuator connected\n");
-	} else if (device_count > 1 && !quiet) {
-			printf(INFO "There are %d attenuators connected\n", device_count);
-	} else if (!quiet) {
-			printf(INFO "There is %d attenuator connected\n", device_count);
-	}
-
-	nr_active_devices = fnLDA_GetDevInfo(working_devices);
-	if (!quiet) {
-		get_serial_and_name(device_count, device_name);
-		printf(INFO "%d active devices found\n", nr_active_devices);
-	}
-
-	/*
-	 * initiate devices
-	 */
-	for (i = 0; i < nr_active_devices; i++) {
-		id = working_devices[i];
-		state = fnLDA_InitDevice(id);
-		serial = fnLDA_GetSerialNumber(id);
-
-		if (state != 0) {
-			printf(ERR "initialising device %d (serial %i) failed\n",
-			       id, serial);
-			continue;
-		}
-		
-		if (!quiet)
-			printf(INFO "initialized device %d (serial %i) successfully\n",
-			       id, serial);
-
-		if (info)
-			print_dev_info(id);
-	}
-
-	/*
-	 * check devices
-	 */
-	for (i = 0; i < nr_active_devices; i++) {
-		id = working_devices[i];
-		serial = fnLDA_GetSerialNumber(id);
-
-		strncpy(message, get_device_data(id),
-			MAX_MSG_SIZE - 1);
-		if (!strncmp(message,"Successfully checked device\n",
-		    strlen(message)) == 0) {
-			printf(ERR "check failed for device %d (serial %i)\n", id, serial);
-			printf(ERR "%s\n", message);
-		}
-	}
-
-	/* check number of available files */
-	if ((argc - 2) < nr_active_devices)
-		file_count = argc - 2;
-	else
-		file_count = nr_active_devices;
-
-	if (pthread_mutex_init(&device_mutex, NULL)) {
-		printf(ERR "Failed to initialize device mutex\n");
-		return;
-	}
-
-	for (i = 0; i < file_count; i++) {
-		pthread_mutex_lock(&device_mutex);
-		args.path = argv[i + 2];
-
-		if (file_serial_check) {
-			/* Get serial using filename */
-			int file_serial_int, tmp_id;
-			char *file_serial = malloc(sizeof(char) *
-						   MAX_PATH_LENGTH);
-			if ((strlen(args.path) - 4) >= MAX_PATH_LENGTH) {
-				length = MAX_PATH_LENGTH;
-			} else {
-				length = strlen(args.path) - 4;
-			}
-			strncpy(file_serial, args.path, length);
-			file_serial_int = atoi(basename(file_serial));
-			tmp_id = get_id_by_serial(file_serial_int, device_count);
-			free(file_serial);
-			if (tmp_id < 0) {
-				printf(ERR "Filename %s not matching with any device\n", args.path);
-				return;
-			}
-			args.id = tmp_id;
-		} else {
-			args.id = i + 1;
-		}
-
-		ret = pthread_create(&threads[i], NULL, start_device, (void *)&args);
-		if (ret)
-			printf(ERR "Failed to create thread! Error Code: %d\n", ret);
-	}
-
-	for (i = 0; i < file_count; i++) {
-		ret = pthread_join(threads[i], &status);
-
-		if (ret)
-			printf(ERR "Failed to join thread! Error Code: %d\n", ret);
-	}
-
-	close_devices(nr_active_devices, working_devices, quiet);
-	return;
-}
-
-/*
- * handle single connected device
- * @param ud: user data struct
- * @param argc: argument count
- * @param argv: arguments given by the user
- * @param working_devices: array of active devices
- * @param get_serial: check if we need to get device id from serial number
- * return: 0 on success, 1 on error
- */
-int
-handle_single_dev(struct user_data *ud, int argc, char *argv[], DEVID *working_devices,
-		  int get_serial, int device_count)
-{
-	int status, id, serial;
-	char message[64];
-	char *version;
-
-	clear_userdata(ud);
-
-	if (!get_parameters(argc, argv, ud)) {
-		printf(WARN "Usage: %s [options]\n", argv[0]);
-		call_help();
-		exit(1);
-	}
-
-	if (get_serial) {
-		id = get_id_by_serial(ud->serial_number, device_count);
-		if (id < 0) {
-			printf(ERR "unable to find device with serial %i\n", ud->serial_number);
-			return 0;
-		}
-	} else {
-		id = SINGLE_DEV_ID;
-	}
-	
-	if (!ud->quiet) {
-		version = fnLDA_LibVersion();
-		printf(INFO "you are using libversion %s\n", version);
-	}
-
-	status = fnLDA_InitDevice(working_devices[id - 1]);
-	serial = fnLDA_GetSerialNumber(working_devices[id - 1]);
-
-	if (status != 0) {
-		printf(ERR "initialising device %d (serial %i) failed\n",
-		       id, serial);
-		return 0;
-	}
-	else
-		if (!ud->quiet)
-			printf(INFO "initialized device %d (serial %i) successfully\n",
-			       id, serial);
-
-	if (ud->info)
-		print_dev_info(id);
-
-	strncpy(message, get_device_data(working_devices[id - 1]),
-		MAX_MSG_SIZE - 1);
-	if (strncmp(message,"Successfully checked device\n",
-	    strlen(message)) == 0) {
-		if (!ud->quiet)
-			printf(INFO "%s",message);
-	} else {
-		printf(ERR "check failed for the device (serial %i)\n", serial);
-		printf(ERR "%s\n", message);
-		return 0;
-	}
-
-	set_data(ud, id);
-	close_single_device(id, working_devices, ud->quiet);
-	return 1;
-}
-
-/*
- * returns 0 on success, 1 on error
- */
-int
-main(int argc, char *argv[])
-{
-	int device_count, get_serial, mdc = 0;
-	int nr_active_devices, quiet;
-	DEVID working_devices[MAXDEVICES];
-	char device_name[MAX_MODELNAME];
-
-	/* get the uid of caller */
-	uid_t uid = geteuid();
-	fnLDA_Init();
-
-	fnLDA_SetTestMode(FALSE);
-	quiet = check_quiet(argc, argv);
-
-	if (uid != 0) {
-		printf(ERR "This tool needs to be run as root to access USB ports\n");
-		printf("Please run again as root\n");
-		exit(1);
-	}
-
-	if (argc < 2) {
-		printf(ERR "Usage: %s [options]\n", argv[0]);
-		call_help();
-		exit(1);
-	}
-
-	if ((strncmp(argv[1], "-h", strlen(argv[1]))) == 0) {
-		call_help();
-		exit(0);
-	}
-
-	/* Manage termination signal */
-	signal(SIGINT, sighandler);
-	signal(SIGTERM, sighandler);
-	signal(SIGABRT, sighandler);
-
-	mdc = check_multi_device(argv);
-	if (mdc) {
-		if (!quiet)
-			printf(INFO "multidevice support enabled\n");
-		if (mdc == 2)
-			handle_multi_dev(argc, argv, 1);
-		else
-			handle_multi_dev(argc, argv, 0);
-		exit(0);
-	}
-
-	struct user_data *ud = allocate_user_data();
-	device_count = fnLDA_GetNumDevices();
-
-	if (device_count == 0) {
-		printf(ERR "There is no attenuator connected\n");
-	} else if (device_count > 1) {
-		if (!quiet)
-			printf(INFO "There are %d attenuators connected\n", device_count);
-	} else {
-		if (!quiet)
-			printf(INFO "There is %d attenuator connected\n", device_count);
-	}
-
-	if (!quiet)
-		get_serial_and_name(device_count, device_name);
-
-	nr_active_devices = fnLDA_GetDevInfo(working_devices);
-	if (!quiet)
-		printf(INFO "%d active device(s) found\n", nr_active_devices);
-
-	get_serial = check_serial_number(argc, argv);
-	handle_single_dev(ud, argc, argv, working_devices, get_serial, device_count);
-
-	free(ud);
-	return 0;
-}
-
@@ -4,23 +4,49 @@
 #include <stdio.h>
 #include <pthread.h>
 #include "input.h"
+#include "LDAhid.h"
 
 #define ERR "\x1B[31m" "[ERROR]: " "\x1B[0m"
 #define WARN "\x1B[33m" "[WARNING]: " "\x1B[0m"
 #define INFO "\x1B[32m" "[INFO]: " "\x1B[0m"
 
-pthread_mutex_t device_mutex;
-
-char errmsg[64];
+/*
+ * what write_attenuation() keeps about a device: the moving average of the
+ * write latency, the completion of the last write and of the first one
+ * since write_mark(), and the last value written
+ */
+struct write_state
+{
+	unsigned long long latency_est;
+	unsigned long long latency_done;
+	unsigned long long first_done;
+	int shadow;
+};
 
+void report(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void report_capture(char *buf, int length);
 int get_id_by_serial(int serial, unsigned int device_count);
 void get_serial_and_name(unsigned int device_count, char *device_name);
-char * get_device_data(unsigned int current_devices);
 int set_ramp(int id, struct user_data *ud);
 void set_attenuation(int id,struct user_data *ud);
 int set_triangle(int id, struct user_data *ud);
+int calc_nr_steps(struct user_data *ud);
 void print_dev_info(int id);
-int check_multi_device(char *argv[]);
+LVSTATUS write_attenuation(int id, int value);
+int written_attenuation(int id);
+void write_mark(int id);
+void write_times(int id, unsigned long long *first, unsigned long long *last);
+void write_bind(int id, struct write_state *ws);
+void write_stop(void);
+unsigned long long write_latency(int id);
+unsigned long long write_lead(int id, struct user_data *ud);
+void write_residual(int id, unsigned long index, unsigned long long deadline,
+		    struct user_data *ud);
+void check_att_limits(int id, int serial, struct user_data *ud, int check);
+struct user_data *allocate_user_data(void);
+void set_data(struct user_data *ud, int id);
+void close_single_device(int id, DEVID *working_devices, int quiet);
+void close_devices(int nr_active_devices, DEVID *working_devices, int quiet);
 int check_quiet(int argc, char *argv[]);
 
 #endif
@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include "csv.h"
+#include "mem.h"
+#include "timing.h"
+#include "control.h"
+
+/* attenuation is parsed in millionths of a dB */
+#define MICRO_DB 1000000LL
+/* far beyond any device, keeps the parse and the result in range */
+#define MAX_DB 100000LL
+
+#define IS_SPACE(c) ((c) == ' ' || (c) == '\t' || (c) == '\r' \
+		     || (c) == '\n' || (c) == '\v' || (c) == '\f')
+#define IS_DIGIT(c) ((c) >= '0' && (c) <= '9')
+#define IS_SEP(c) ((c) == ',' || (c) == ';')
+
+/*
+ * parse a decimal attenuation in dB into MULTIPLIER_STEP units, rounded to
+ * the nearest step without going through floating point
+ * @param range: set to 1 if the number is beyond MAX_DB
+ * @return: position after the number, NULL if there is none or it is out
+ *          of range
+ */
+static const char *
+parse_att(const char *pos, const char *end, int *att, int *range)
+{
+	long long micro = 0, scale = MICRO_DB;
+	int neg = 0, digits = 0;
+
+	if (pos < end && (*pos == '-' || *pos == '+'))
+		neg = *pos++ == '-';
+	for (; pos < end && IS_DIGIT(*pos); pos++, digits++) {
+		micro = micro * 10 + (*pos - '0');
+		if (micro > MAX_DB) {
+			*range = 1;
+			return NULL;
+		}
+	}
+	micro *= MICRO_DB;
+	if (pos < end && *pos == '.') {
+		for (pos++; pos < end && IS_DIGIT(*pos); pos++, digits++)
+			if (scale > 1) {
+				scale /= 10;
+				micro += (*pos - '0') * scale;
+			}
+	}
+	if (digits == 0)
+		return NULL;
+
+	micro = (micro + MICRO_DB / MULTIPLIER_STEP / 2)
+		/ (MICRO_DB / MULTIPLIER_STEP);
+	*att = (int)(neg ? -micro : micro);
+	return pos;
+}
+
+/*
+ * parse a row of a schedule file between line and end.
+ * <time>,<attenuation in dB>[,<time unit>]
+ * Semicolons are accepted as separator as well, a time unit given in a row
+ * is kept in ud for the following rows.
+ * @param line: start of the row
+ * @param end: end of the row, newline excluded
+ * @param ud: user data struct holding the current time unit
+ * @param duration: storage for step time in nanoseconds
+ * @param att: storage for attenuation in MULTIPLIER_STEP units
+ * @param col: storage for the column of an error, starting at 1
+ * @return: 0 on success, 1 if the row is empty, -1 if it is malformed, -2
+ *          if a value is out of range
+ */
+int
+csv_parse(const char *line, const char *end, struct user_data *ud,
+	  unsigned long long *duration, int *att, unsigned long *col)
+{
+	const char *pos = line, *value, *time;
+	unsigned long long atime = 0;
+	int range = 0;
+
+	while (pos < end && IS_SPACE(*pos))
+		pos++;
+	if (pos == end)
+		return 1;
+
+	if (!IS_DIGIT(*pos))
+		goto error;
+	for (time = pos; pos < end && IS_DIGIT(*pos); pos++) {
+		if (atime > (ULLONG_MAX - 9) / 10) {
+			pos = time;
+			goto out_of_range;
+		}
+		atime = atime * 10 + (*pos - '0');
+	}
+	if (pos == end || !IS_SEP(*pos))
+		goto error;
+
+	for (pos++; pos < end && IS_SPACE(*pos); pos++)
+		;
+	value = parse_att(pos, end, att, &range);
+	if (range)
+		goto out_of_range;
+	if (value == NULL)
+		goto error;
+	pos = value;
+
+	while (pos < end && IS_SPACE(*pos))
+		pos++;
+	if (pos < end) {
+		if (!IS_SEP(*pos))
+			goto error;
+		for (pos++; pos < end && IS_SPACE(*pos); pos++)
+			;
+		ud->ms = end - pos >= 2 && pos[0] == 'm' && pos[1] == 's';
+		ud->us = end - pos >= 2 && pos[0] == 'u' && pos[1] == 's';
+	}
+
+	if (atime > ULLONG_MAX / time_unit_ns(ud)) {
+		pos = time;
+		goto out_of_range;
+	}
+	*duration = atime * time_unit_ns(ud);
+	return 0;
+
+error:
+	*col = pos - line + 1;
+	return -1;
+out_of_range:
+	*col = pos - line + 1;
+	return -2;
+}
+
+/*
+ * open a schedule file for reading by csv_next()
+ * @param r: reader
+ * @param path: path to schedule file
+ * @return: 0 on success, 1 on error
+ */
+int
+csv_open(struct csv_reader *r, const char *path)
+{
+	memset(r, 0, sizeof(struct csv_reader));
+	r->hash = FNV_OFFSET;
+	r->fd = open(path, O_RDONLY);
+	if (r->fd < 0) {
+		report(ERR "unable to open input file for reading: %s\n", path);
+		return 1;
+	}
+	r->buf = mem_alloc(CSV_BUFFER);
+	if (r->buf == NULL) {
+		report(ERR "could not allocate memory for reading %s\n", path);
+		close(r->fd);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * move the rest of the buffer to its start and fill it up
+ * @return: 0 on success, 1 on read error
+ */
+static int
+csv_fill(struct csv_reader *r)
+{
+	ssize_t n;
+
+	memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+	r->len -= r->pos;
+	r->pos = 0;
+	while (r->len < CSV_BUFFER && !r->eof) {
+		n = read(r->fd, r->buf + r->len, CSV_BUFFER - r->len);
+		if (n < 0)
+			return 1;
+		if (n == 0)
+			r->eof = 1;
+		r->len += n;
+	}
+	return 0;
+}
+
+/*
+ * parse the next row of a schedule file, empty rows are skipped
+ * @param r: reader
+ * @param ud: user data struct holding the current time unit
+ * @param duration: storage for step time in nanoseconds
+ * @param att: storage for attenuation in MULTIPLIER_STEP units
+ * @return: 0 on success, 1 at the end of the file, -1 if the row is
+ *          malformed, -2 if a value is out of range, with line and col of
+ *          the reader set
+ */
+int
+csv_next(struct csv_reader *r, struct user_data *ud,
+	 unsigned long long *duration, int *att)
+{
+	char *line, *nl, *pos;
+	int res;
+
+	for (;;) {
+		nl = memchr(r->buf + r->pos, '\n', r->len - r->pos);
+		if (nl == NULL && !r->eof) {
+			if (r->pos == 0 && r->len == CSV_BUFFER) {
+				r->line++;
+				r->col = CSV_BUFFER;
+				return -1;
+			}
+			if (csv_fill(r)) {
+				r->col = 0;
+				return -1;
+			}
+			continue;
+		}
+		if (nl == NULL && r->pos == r->len)
+			return 1;
+
+		line = r->buf + r->pos;
+		if (nl == NULL)
+			nl = r->buf + r->len;
+		for (pos = line; pos < nl; pos++) {
+			r->hash ^= (unsigned char)*pos;
+			r->hash *= FNV_PRIME;
+		}
+		if (nl < r->buf + r->len) {
+			r->hash ^= '\n';
+			r->hash *= FNV_PRIME;
+			r->pos = nl - r->buf + 1;
+		} else {
+			r->pos = r->len;
+		}
+		r->line++;
+
+		res = csv_parse(line, nl, ud, duration, att, &r->col);
+		if (res != 1)
+			return res;
+	}
+}
+
+/*
+ * close a schedule file
+ * @param r: reader
+ */
+void
+csv_close(struct csv_reader *r)
+{
+	close(r->fd);
+	free(r->buf);
+	r->buf = NULL;
+}
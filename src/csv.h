@@ -0,0 +1,37 @@
+#ifndef _CSV_H_
+#define _CSV_H_
+
+#include <stddef.h>
+#include "input.h"
+
+#ifndef CSV_BUFFER
+#define CSV_BUFFER (1 << 20)
+#endif
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+/*
+ * reader of schedule files which scans whole buffers for rows instead of
+ * reading line by line. The content is hashed while reading, so a
+ * checkpoint can be matched to its schedule.
+ */
+struct csv_reader
+{
+	int fd;
+	char *buf;
+	size_t len;
+	size_t pos;
+	int eof;
+	unsigned long line;
+	unsigned long col;
+	unsigned long long hash;
+};
+
+int csv_parse(const char *line, const char *end, struct user_data *ud,
+	      unsigned long long *duration, int *att, unsigned long *col);
+int csv_open(struct csv_reader *r, const char *path);
+int csv_next(struct csv_reader *r, struct user_data *ud,
+	     unsigned long long *duration, int *att);
+void csv_close(struct csv_reader *r);
+
+#endif
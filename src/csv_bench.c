@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "csv.h"
+#include "timing.h"
+#include "control.h"
+
+#define BENCH_ROWS 10000000UL
+#define BENCH_FILE "/tmp/csv_bench.csv"
+#define LINE_LENGTH 256
+
+/*
+ * write a schedule with rows of varying time and attenuation
+ */
+static int
+bench_write(char *path, unsigned long rows)
+{
+	FILE *fp;
+	unsigned long i;
+
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		printf(ERR "unable to open %s for writing\n", path);
+		return 1;
+	}
+	fprintf(fp, "1,0,us\n");
+	for (i = 1; i < rows; i++)
+		fprintf(fp, "%lu,%lu.%02lu\n", 100 + i % 900, i % 64,
+			i % 20 * 5);
+	fclose(fp);
+	return 0;
+}
+
+/*
+ * parse rows with strtok and atof like get_entry() did
+ */
+static unsigned long
+bench_strtok(char *path, long long *sum)
+{
+	FILE *fp;
+	char line[LINE_LENGTH], *token;
+	unsigned long rows = 0;
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return 0;
+	while (fgets(line, LINE_LENGTH, fp)) {
+		token = strtok(line, ",");
+		if (token == NULL)
+			continue;
+		*sum += atol(token);
+		token = strtok(NULL, ",\n");
+		if (token == NULL)
+			continue;
+		*sum += (int)(atof(token) * MULTIPLIER_STEP);
+		rows++;
+	}
+	fclose(fp);
+	return rows;
+}
+
+/*
+ * parse rows read with fgets by parse_row()
+ */
+static unsigned long
+bench_parse_row(char *path, long long *sum)
+{
+	FILE *fp;
+	char line[LINE_LENGTH];
+	struct user_data ud;
+	unsigned long long duration;
+	unsigned long rows = 0;
+	int att;
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return 0;
+	clear_userdata(&ud);
+	while (fgets(line, LINE_LENGTH, fp))
+		if (parse_row(line, &ud, &duration, &att) == 0) {
+			*sum += duration + att;
+			rows++;
+		}
+	fclose(fp);
+	return rows;
+}
+
+/*
+ * parse rows with the buffered reader used by schedule_load()
+ */
+static unsigned long
+bench_reader(char *path, long long *sum)
+{
+	struct csv_reader r;
+	struct user_data ud;
+	unsigned long long duration;
+	unsigned long rows = 0;
+	int att;
+
+	if (csv_open(&r, path))
+		return 0;
+	clear_userdata(&ud);
+	while (csv_next(&r, &ud, &duration, &att) == 0) {
+		*sum += duration + att;
+		rows++;
+	}
+	csv_close(&r);
+	return rows;
+}
+
+static void
+bench_run(char *name, unsigned long (*fn)(char *, long long *), char *path)
+{
+	unsigned long long start, time;
+	unsigned long rows;
+	long long sum = 0;
+
+	start = time_now_ns();
+	rows = fn(path, &sum);
+	time = time_now_ns() - start;
+	printf("%-12s %10lu rows %8.3f s %12.0f rows/s (sum %lld)\n",
+	       name, rows, (double)time / NSEC_PER_SEC,
+	       time ? (double)rows * NSEC_PER_SEC / time : 0, sum);
+}
+
+/*
+ * compare the schedule parsers on a large file
+ * usage: csv_bench [path [rows]]
+ * The file is created with the given number of rows if it does not exist.
+ */
+int
+main(int argc, char *argv[])
+{
+	char *path = argc > 1 ? argv[1] : BENCH_FILE;
+	unsigned long rows = argc > 2 ? strtoul(argv[2], NULL, 10) : BENCH_ROWS;
+
+	if (access(path, R_OK) && bench_write(path, rows))
+		return 1;
+
+	/* the first pass brings the file into the page cache */
+	bench_run("strtok/atof", bench_strtok, path);
+	bench_run("strtok/atof", bench_strtok, path);
+	bench_run("parse_row", bench_parse_row, path);
+	bench_run("csv_next", bench_reader, path);
+	return 0;
+}
@@ -0,0 +1,293 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "devinit.h"
+#include "mem.h"
+#include "timing.h"
+#include "control.h"
+#include "LDAhid.h"
+
+/* shared state of the init workers */
+struct init_pool
+{
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct dev_init_result *jobs;
+	unsigned long long *started;
+	int count;
+	int next;
+	int finished;
+	int refs;
+	int fast;
+};
+
+/*
+ * devices with a worker inside their init or check. A timed out worker
+ * stays here until the device answers, the device must not be closed.
+ */
+static int init_busy[MAXDEVICES + 1];
+static pthread_mutex_t busy_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define CHECK_QUERY(call) do {						\
+	status = (unsigned int)(call);					\
+	if (status == INVALID_DEVID || status == DEVICE_NOT_READY) {	\
+		snprintf(message, length, "%s", fnLDA_perror(status));	\
+		return 1;						\
+	}								\
+} while (0)
+
+/*
+ * check device status without touching shared buffers, so it can be
+ * called for several devices at once
+ * @param id: device id
+ * @param fast: 1 to only check what is needed for playback
+ * @param message: storage for the error message
+ * @param length: size of message
+ * @return: 0 on success, 1 if the check failed
+ */
+int
+check_device(DEVID id, int fast, char *message, int length)
+{
+	unsigned int status;
+
+	CHECK_QUERY(fnLDA_GetAttenuation(id));
+	CHECK_QUERY(fnLDA_GetMinAttenuation(id));
+	CHECK_QUERY(fnLDA_GetMaxAttenuation(id));
+	if (fast)
+		return 0;
+
+	CHECK_QUERY(fnLDA_GetIdleTime(id));
+	CHECK_QUERY(fnLDA_GetDwellTime(id));
+	CHECK_QUERY(fnLDA_GetAttenuationStep(id));
+	CHECK_QUERY(fnLDA_GetRF_On(id));
+	CHECK_QUERY(fnLDA_GetRampStart(id));
+	CHECK_QUERY(fnLDA_GetRampEnd(id));
+	return 0;
+}
+
+/*
+ * mark a device as being initialized or done
+ */
+static void
+set_busy(DEVID id, int busy)
+{
+	if (id == 0 || id > MAXDEVICES)
+		return;
+	pthread_mutex_lock(&busy_lock);
+	init_busy[id] = busy;
+	pthread_mutex_unlock(&busy_lock);
+}
+
+/*
+ * check if a worker is still inside the init or check of a device, like
+ * one left behind after a timeout
+ * @param id: device id
+ * @return: 1 if the device is busy, else 0
+ */
+int
+init_pending(DEVID id)
+{
+	int busy;
+
+	if (id == 0 || id > MAXDEVICES)
+		return 0;
+	pthread_mutex_lock(&busy_lock);
+	busy = init_busy[id];
+	pthread_mutex_unlock(&busy_lock);
+	return busy;
+}
+
+/*
+ * drop a reference to the pool and free it with the last one. Workers
+ * stuck in a timed out device keep the pool alive until they return.
+ */
+static void
+release_pool(struct init_pool *pool)
+{
+	int refs;
+
+	refs = --pool->refs;
+	pthread_mutex_unlock(&pool->lock);
+	if (refs)
+		return;
+
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->cond);
+	free(pool->jobs);
+	free(pool->started);
+	free(pool);
+}
+
+/*
+ * take devices from the pool until all are initialized
+ * @param arg: init pool
+ */
+static void *
+init_worker(void *arg)
+{
+	struct init_pool *pool = arg;
+	struct dev_init_result r;
+	unsigned long long start;
+	int i;
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->next < pool->count) {
+		i = pool->next++;
+		r = pool->jobs[i];
+		start = time_now_ns();
+		pool->started[i] = start;
+		pthread_mutex_unlock(&pool->lock);
+
+		set_busy(r.id, 1);
+		r.state = INIT_OK;
+		if (fnLDA_InitDevice(r.id) != 0) {
+			r.state = INIT_FAILED;
+			snprintf(r.message, MAX_INIT_MSG, "initialising failed");
+		}
+		r.init_time = time_now_ns() - start;
+
+		if (r.state == INIT_OK) {
+			start = time_now_ns();
+			if (check_device(r.id, pool->fast, r.message,
+					 MAX_INIT_MSG))
+				r.state = INIT_CHECK_FAILED;
+			r.check_time = time_now_ns() - start;
+		}
+		set_busy(r.id, 0);
+
+		pthread_mutex_lock(&pool->lock);
+		/* a timed out device has already been counted */
+		if (pool->jobs[i].state == INIT_PENDING) {
+			pool->jobs[i] = r;
+			pool->finished++;
+			pthread_cond_signal(&pool->cond);
+		}
+	}
+	release_pool(pool);
+	return NULL;
+}
+
+/*
+ * initialize and check devices concurrently with a bounded number of
+ * worker threads. A device not done within the timeout is reported as
+ * timed out, its worker is left behind and the other devices continue.
+ * init_pending() tells when such a worker returned.
+ * @param ids: device ids
+ * @param count: number of devices
+ * @param workers: maximum number of worker threads
+ * @param timeout_ms: time allowed per device in milliseconds
+ * @param fast: 1 to only check what is needed for playback
+ * @param results: storage for count results
+ * @return: number of devices initialized and checked successfully
+ */
+int
+init_devices(DEVID *ids, int count, unsigned int workers,
+	     unsigned int timeout_ms, int fast,
+	     struct dev_init_result *results)
+{
+	struct init_pool *pool;
+	pthread_condattr_t attr;
+	pthread_t thread;
+	struct timespec ts;
+	unsigned long long timeout, now, wake;
+	int i, ok = 0, started = 0;
+
+	if (count <= 0)
+		return 0;
+
+	pool = mem_calloc(1, sizeof(struct init_pool));
+	if (pool == NULL)
+		return 0;
+	pool->jobs = mem_calloc(count, sizeof(struct dev_init_result));
+	pool->started = mem_calloc(count, sizeof(unsigned long long));
+	if (pool->jobs == NULL || pool->started == NULL) {
+		free(pool->jobs);
+		free(pool->started);
+		free(pool);
+		return 0;
+	}
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&pool->cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	for (i = 0; i < count; i++) {
+		pool->jobs[i].id = ids[i];
+		pool->jobs[i].serial = fnLDA_GetSerialNumber(ids[i]);
+		pool->jobs[i].state = INIT_PENDING;
+	}
+	pool->count = count;
+	pool->fast = fast;
+	pool->refs = 1;
+
+	if (workers == 0)
+		workers = 1;
+	if (workers > (unsigned int)count)
+		workers = count;
+	timeout = (unsigned long long)timeout_ms * NSEC_PER_MSEC;
+
+	pthread_mutex_lock(&pool->lock);
+	for (i = 0; i < (int)workers; i++) {
+		pool->refs++;
+		if (pthread_create(&thread, NULL, init_worker, pool)) {
+			pool->refs--;
+			continue;
+		}
+		pthread_detach(thread);
+		started++;
+	}
+
+	if (started == 0) {
+		printf(WARN "unable to start init workers, initializing devices one by one\n");
+		pool->refs++;
+		pthread_mutex_unlock(&pool->lock);
+		init_worker(pool);
+		pthread_mutex_lock(&pool->lock);
+	}
+
+	while (pool->finished < count) {
+		now = time_now_ns();
+		wake = now + timeout;
+		for (i = 0; i < count; i++) {
+			if (pool->jobs[i].state != INIT_PENDING
+			    || pool->started[i] == 0)
+				continue;
+			if (now - pool->started[i] >= timeout) {
+				pool->jobs[i].state = INIT_TIMEOUT;
+				pool->jobs[i].init_time = now - pool->started[i];
+				snprintf(pool->jobs[i].message, MAX_INIT_MSG,
+					 "no answer within %u ms", timeout_ms);
+				pool->finished++;
+				/* replace the stuck worker for devices left */
+				if (pool->next < count) {
+					pool->refs++;
+					if (pthread_create(&thread, NULL,
+							   init_worker, pool))
+						pool->refs--;
+					else
+						pthread_detach(thread);
+				}
+			} else if (pool->started[i] + timeout < wake) {
+				wake = pool->started[i] + timeout;
+			}
+		}
+		if (pool->finished == count)
+			break;
+
+		ts.tv_sec = wake / NSEC_PER_SEC;
+		ts.tv_nsec = wake % NSEC_PER_SEC;
+		pthread_cond_timedwait(&pool->cond, &pool->lock, &ts);
+	}
+
+	memcpy(results, pool->jobs, count * sizeof(struct dev_init_result));
+	release_pool(pool);
+
+	for (i = 0; i < count; i++)
+		if (results[i].state == INIT_OK)
+			ok++;
+	return ok;
+}
@@ -0,0 +1,32 @@
+#ifndef _DEVINIT_H_
+#define _DEVINIT_H_
+
+#include "LDAhid.h"
+
+#define INIT_OK 0
+#define INIT_FAILED 1
+#define INIT_CHECK_FAILED 2
+#define INIT_TIMEOUT 3
+#define INIT_PENDING 4
+
+#define DEFAULT_INIT_WORKERS 4
+#define DEFAULT_INIT_TIMEOUT 5000
+#define MAX_INIT_MSG 64
+
+struct dev_init_result
+{
+	DEVID id;
+	int serial;
+	int state;
+	unsigned long long init_time;
+	unsigned long long check_time;
+	char message[MAX_INIT_MSG];
+};
+
+int check_device(DEVID id, int fast, char *message, int length);
+int init_pending(DEVID id);
+int init_devices(DEVID *ids, int count, unsigned int workers,
+		 unsigned int timeout_ms, int fast,
+		 struct dev_init_result *results);
+
+#endif
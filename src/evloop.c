@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include "evloop.h"
+#include "timing.h"
+#include "control.h"
+#include "status.h"
+#include "input.h"
+#include "LDAhid.h"
+
+#define LINE_LENGTH 256
+#define MAX_EVENTS 32
+
+/*
+ * stop playback on a device and release its timer and file
+ * @param epfd: epoll instance
+ * @param dev: device state
+ */
+static void
+ev_finish(int epfd, struct ev_device *dev)
+{
+	epoll_ctl(epfd, EPOLL_CTL_DEL, dev->fd, NULL);
+	close(dev->fd);
+	fclose(dev->fp);
+	dev->done = 1;
+}
+
+/*
+ * set the next row of the device file and arm the timer for the row after.
+ * @param dev: device state
+ * @return: 0 if the timer is armed, 1 if the file is played completely
+ */
+static int
+ev_step(struct ev_device *dev)
+{
+	char line[LINE_LENGTH];
+	struct itimerspec its;
+	unsigned long long duration, now, late, tolerance;
+	int att, res;
+
+	do {
+		if (!fgets(line, LINE_LENGTH, dev->fp))
+			return 1;
+		res = parse_row(line, &dev->ud, &duration, &att);
+	} while (res == 1);
+
+	if (res < 0) {
+		printf(ERR "malformed row in %s (serial %i): %s", dev->path,
+		       dev->serial, line);
+		return 1;
+	}
+
+	if (att < dev->min)
+		att = dev->min;
+	else if (att > dev->max)
+		att = dev->max;
+	now = time_now_ns();
+	write_attenuation(dev->id, att);
+	log_attenuation(att, &dev->ud);
+	write_residual(dev->id, dev->steps, dev->deadline, &dev->ud);
+	/* missed like in schedule_play(), beyond the tolerance of the user */
+	late = now > dev->issue ? now - dev->issue : 0;
+	tolerance = (unsigned long long)dev->ud.tolerance * NSEC_PER_USEC;
+	status_late(dev->id, late, late > tolerance, 0);
+	dev->steps++;
+
+	/* the timer expires early by the write latency of the device */
+	dev->deadline += duration;
+	dev->issue = dev->deadline - write_lead(dev->id, &dev->ud);
+	status_step(dev->id, dev->steps - 1, 0, dev->deadline);
+	memset(&its, 0, sizeof(struct itimerspec));
+	its.it_value.tv_sec = dev->issue / NSEC_PER_SEC;
+	its.it_value.tv_nsec = dev->issue % NSEC_PER_SEC;
+	if (timerfd_settime(dev->fd, TFD_TIMER_ABSTIME, &its, NULL)) {
+		printf(ERR "unable to arm timer for device %d (serial %i)\n",
+		       dev->id, dev->serial);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * step a device whose timer expired
+ * @param epfd: epoll instance
+ * @param dev: device state
+ * @param quiet: 1 to suppress [INFO] output
+ * @return: 1 if the device finished, else 0
+ */
+static int
+ev_expired(int epfd, struct ev_device *dev, int quiet)
+{
+	if (!ev_step(dev))
+		return 0;
+
+	ev_finish(epfd, dev);
+	if (!quiet)
+		printf(INFO "device %d (serial %i) finished after %lu steps\n",
+		       dev->id, dev->serial, dev->steps);
+	return 1;
+}
+
+/*
+ * find the active device due next, used instead of the timers when
+ * running on the virtual clock
+ * @param devs: array of devices
+ * @param count: number of devices, at least one of them active
+ * @return: device with the earliest issue time
+ */
+static struct ev_device *
+ev_next(struct ev_device *devs, int count)
+{
+	struct ev_device *next = NULL;
+	int i;
+
+	for (i = 0; i < count; i++)
+		if (!devs[i].done && (next == NULL || devs[i].issue < next->issue))
+			next = &devs[i];
+	return next;
+}
+
+/*
+ * play a file on each given device from a single thread. Every device gets
+ * a timerfd armed with the absolute deadline of its next step, expired
+ * timers are dispatched through epoll. The number of threads stays the
+ * same no matter how many devices are used.
+ * @param devs: array of devices with id, serial and path set
+ * @param count: number of devices
+ * @param quiet: 1 to suppress [INFO] output
+ * @return: 0 on success, 1 on error
+ */
+int
+evloop_run(struct ev_device *devs, int count, int quiet)
+{
+	struct epoll_event ev, events[MAX_EVENTS];
+	struct ev_device *dev;
+	unsigned long long start;
+	uint64_t expirations;
+	int epfd, i, n, active = 0;
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0) {
+		printf(ERR "unable to create epoll instance\n");
+		return 1;
+	}
+
+	start = time_now_ns();
+	for (i = 0; i < count; i++) {
+		dev = &devs[i];
+		dev->done = 1;
+		log_open(&dev->ud);
+		dev->fp = fopen(dev->path, "r");
+		if (dev->fp == NULL) {
+			printf(ERR "unable to open input file for reading: %s\n",
+			       dev->path);
+			continue;
+		}
+
+		dev->fd = timerfd_create(CLOCK_MONOTONIC,
+					 TFD_NONBLOCK | TFD_CLOEXEC);
+		if (dev->fd < 0) {
+			printf(ERR "unable to create timer for device %d "
+			       "(serial %i)\n", dev->id, dev->serial);
+			fclose(dev->fp);
+			continue;
+		}
+
+		ev.events = EPOLLIN;
+		ev.data.ptr = dev;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, dev->fd, &ev);
+
+		dev->min = fnLDA_GetMinAttenuation(dev->id);
+		dev->max = fnLDA_GetMaxAttenuation(dev->id);
+		dev->deadline = start;
+		dev->issue = start;
+		dev->steps = 0;
+		dev->done = 0;
+		active++;
+
+		if (ev_step(dev)) {
+			ev_finish(epfd, dev);
+			active--;
+		}
+	}
+
+	while (active) {
+		/* timers run on the real clock, step by the virtual one */
+		if (time_is_virtual()) {
+			dev = ev_next(devs, count);
+			time_sleep_until_ns(dev->issue);
+			active -= ev_expired(epfd, dev, quiet);
+			continue;
+		}
+
+		n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			printf(ERR "waiting for device timers failed\n");
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			dev = events[i].data.ptr;
+			if (read(dev->fd, &expirations, sizeof(expirations)) < 0)
+				continue;
+			active -= ev_expired(epfd, dev, quiet);
+		}
+	}
+
+	for (i = 0; i < count; i++)
+		if (!devs[i].done)
+			ev_finish(epfd, &devs[i]);
+	close(epfd);
+	return active ? 1 : 0;
+}
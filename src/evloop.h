@@ -0,0 +1,29 @@
+#ifndef _EVLOOP_H_
+#define _EVLOOP_H_
+
+#include <stdio.h>
+#include "input.h"
+
+/*
+ * state of a device driven by the event loop, each device has its own
+ * timer and steps independently of all others
+ */
+struct ev_device
+{
+	int id;
+	int serial;
+	int fd;
+	int min;
+	int max;
+	int done;
+	FILE *fp;
+	char *path;
+	unsigned long long deadline;
+	unsigned long long issue;
+	unsigned long steps;
+	struct user_data ud;
+};
+
+int evloop_run(struct ev_device *devs, int count, int quiet);
+
+#endif
@@ -0,0 +1,312 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <math.h>
+#include <sys/stat.h>
+#include "feedback.h"
+#include "keyframe.h"
+#include "timing.h"
+#include "control.h"
+#include "input.h"
+#include "LDAhid.h"
+
+/*
+ * pick a field of a measurement line
+ * @param line: NUL terminated line without newline
+ * @param column: field to use starting at 1, 0 for the last one
+ * @param value: storage for the measurement
+ * @return: 0 on success, 1 if the line holds no such number
+ */
+static int
+parse_measurement(char *line, unsigned int column, double *value)
+{
+	char *pos, *end, *field = NULL;
+	unsigned int nr = 0;
+
+	for (pos = line; *pos != '\0' && *pos != '#'; pos = end) {
+		pos += strspn(pos, ",; \t\r");
+		if (*pos == '\0' || *pos == '#')
+			break;
+		end = pos + strcspn(pos, ",; \t\r");
+		nr++;
+		field = pos;
+		if (nr == column)
+			break;
+	}
+
+	if (field == NULL || (column && nr != column))
+		return 1;
+	*value = strtod(field, &end);
+	return end == field;
+}
+
+/*
+ * split the buffer of a feed in lines and publish the latest value
+ */
+static void
+feed_lines(struct feed *f)
+{
+	char *start = f->buf, *nl;
+	double value = 0;
+	int found = 0;
+
+	while ((nl = memchr(start, '\n', f->buf + f->len - start)) != NULL) {
+		*nl = '\0';
+		if (parse_measurement(start, f->column, &value) == 0)
+			found = 1;
+		start = nl + 1;
+	}
+
+	/* keep an incomplete line for the next read, drop overlong ones */
+	f->len -= start - f->buf;
+	if (f->len == FEED_BUFFER)
+		f->len = 0;
+	memmove(f->buf, start, f->len);
+
+	if (found) {
+		pthread_mutex_lock(&f->lock);
+		f->value = value;
+		f->seq++;
+		pthread_mutex_unlock(&f->lock);
+	}
+}
+
+/*
+ * read new data of a feed as it arrives. Only data appended after the open
+ * is read, a truncated file is read again from its beginning.
+ */
+static void *
+feed_reader(void *arg)
+{
+	struct feed *f = arg;
+	struct pollfd pfd;
+	struct stat sb;
+	struct timespec idle = {0, FEED_IDLE_MS * NSEC_PER_MSEC};
+	ssize_t n;
+
+	pfd.fd = f->fd;
+	pfd.events = POLLIN;
+
+	while (f->running) {
+		n = read(f->fd, f->buf + f->len, FEED_BUFFER - f->len);
+		if (n > 0) {
+			f->offset += n;
+			f->len += n;
+			feed_lines(f);
+		} else if (n < 0 && errno == EAGAIN) {
+			/* pipe without pending data */
+			poll(&pfd, 1, FEED_IDLE_MS);
+		} else {
+			/* end of a file, or a pipe without writer */
+			if (fstat(f->fd, &sb) == 0 && S_ISREG(sb.st_mode)
+			    && sb.st_size < f->offset) {
+				lseek(f->fd, 0, SEEK_SET);
+				f->offset = 0;
+				f->len = 0;
+			}
+			nanosleep(&idle, NULL);
+		}
+	}
+	return NULL;
+}
+
+/*
+ * open a measurement feed and start reading it in the background
+ * @param f: feed to set up
+ * @param path: file or fifo to read
+ * @param column: field holding the measurement, 0 for the last one
+ * @return: 0 on success, 1 on error
+ */
+int
+feed_open(struct feed *f, char *path, unsigned int column)
+{
+	struct stat sb;
+
+	memset(f, 0, sizeof(struct feed));
+	f->column = column;
+
+	/* does not block on a fifo without writer */
+	f->fd = open(path, O_RDONLY | O_NONBLOCK);
+	if (f->fd < 0) {
+		report(ERR "unable to open feed for reading: %s\n", path);
+		return 1;
+	}
+
+	/* old measurements of a file do not describe the link anymore */
+	if (fstat(f->fd, &sb) == 0 && S_ISREG(sb.st_mode)) {
+		f->offset = lseek(f->fd, 0, SEEK_END);
+		if (f->offset < 0)
+			f->offset = 0;
+	}
+
+	pthread_mutex_init(&f->lock, NULL);
+	f->running = 1;
+	if (pthread_create(&f->thread, NULL, feed_reader, f)) {
+		report(ERR "unable to start feed reader\n");
+		pthread_mutex_destroy(&f->lock);
+		close(f->fd);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * get the latest measurement of a feed
+ * @param f: feed
+ * @param value: storage for the measurement
+ * @return: number of measurements read so far, 0 if none yet
+ */
+unsigned long
+feed_get(struct feed *f, double *value)
+{
+	unsigned long seq;
+
+	pthread_mutex_lock(&f->lock);
+	*value = f->value;
+	seq = f->seq;
+	pthread_mutex_unlock(&f->lock);
+	return seq;
+}
+
+/*
+ * stop reading a feed and close it
+ * @param f: feed
+ */
+void
+feed_close(struct feed *f)
+{
+	f->running = 0;
+	pthread_join(f->thread, NULL);
+	pthread_mutex_destroy(&f->lock);
+	close(f->fd);
+}
+
+/*
+ * count a write of the controller in the statistics of the run
+ * @param st: statistics
+ * @param seq: measurement the write followed
+ * @param value: attenuation written
+ */
+static void
+note_write(struct play_stats *st, unsigned long seq, int value)
+{
+	if (st->lock)
+		pthread_mutex_lock(st->lock);
+	st->index = seq;
+	st->value = value;
+	st->steps++;
+	if (st->lock)
+		pthread_mutex_unlock(st->lock);
+}
+
+/*
+ * hold a measurement at the target value by adjusting the attenuation with
+ * a PI controller. Higher attenuation is expected to lower the measurement,
+ * like RSSI or throughput do. Each control period the attenuation changes
+ * by the step size of the device at most, unless set otherwise by the user.
+ * The controller only acts on new measurements and runs until stopped.
+ * @param id: device id
+ * @param ud: user data struct
+ * @param st: counts the writes, setting stop ends the control
+ * @return: 0 on success, 1 on error
+ */
+int
+closed_loop_run(int id, struct user_data *ud, struct play_stats *st)
+{
+	struct feed f;
+	unsigned long long period, deadline, reported;
+	unsigned long seq, last_seq = 0, writes = 0;
+	int resolution, min, max, att, value, max_step, high, low;
+	double measurement, error, integral = 0, base, output, dt;
+
+	if (isnan(ud->target)) {
+		report(ERR "closed loop control needs a target set with -target\n");
+		return 1;
+	}
+	if (ud->ctl_rate == 0) {
+		report(ERR "control rate has to be above 0\n");
+		return 1;
+	}
+
+	resolution = fnLDA_GetDevResolution(id);
+	if (resolution <= 0)
+		resolution = 1;
+	min = fnLDA_GetMinAttenuation(id);
+	max = fnLDA_GetMaxAttenuation(id);
+
+	max_step = resolution;
+	if (ud->ctl_step > 0)
+		max_step = quantize(ud->ctl_step * MULTIPLIER_STEP, resolution,
+				    resolution, max - min);
+
+	if (feed_open(&f, ud->feed, ud->feed_column))
+		return 1;
+
+	att = quantize(ud->start_att, resolution, min, max);
+	base = att;
+	write_attenuation(id, att);
+	log_attenuation(att, ud);
+	note_write(st, 0, att);
+
+	if (!ud->quiet)
+		report(INFO "holding %.2f at %u updates/s, starting at %.2fdB\n",
+		       ud->target, ud->ctl_rate, (double)att / MULTIPLIER_STEP);
+
+	period = NSEC_PER_SEC / ud->ctl_rate;
+	dt = (double)period / NSEC_PER_SEC;
+	deadline = time_now_ns();
+	reported = deadline;
+	for (;;) {
+		deadline += period;
+		if (schedule_wait(deadline, st))
+			break;
+
+		seq = feed_get(&f, &measurement);
+		if (seq == last_seq)
+			continue;
+		last_seq = seq;
+
+		error = measurement - ud->target;
+		output = base + (ud->kp * error + ud->ki * (integral + error * dt))
+			 * MULTIPLIER_STEP;
+
+		value = quantize(output, resolution, min, max);
+		high = output >= max;
+		low = output <= min;
+		if (value > att + max_step) {
+			value = att + max_step;
+			high = 1;
+		} else if (value < att - max_step) {
+			value = att - max_step;
+			low = 1;
+		}
+
+		/* stop integrating while the range or the step holds the output */
+		if ((!high || error < 0) && (!low || error > 0))
+			integral += error * dt;
+		if (value == att)
+			continue;
+
+		write_attenuation(id, value);
+		log_attenuation(value, ud);
+		att = value;
+		note_write(st, seq, value);
+		writes++;
+		if (!ud->quiet
+		    && time_now_ns() - reported >= FEED_REPORT_MS * NSEC_PER_MSEC) {
+			report(INFO "measured %.2f, set attenuation to %.2fdB, "
+			       "%lu writes\n", measurement,
+			       (double)att / MULTIPLIER_STEP, writes);
+			reported = time_now_ns();
+			writes = 0;
+		}
+	}
+
+	feed_close(&f);
+	return 0;
+}
@@ -0,0 +1,41 @@
+#ifndef _FEEDBACK_H_
+#define _FEEDBACK_H_
+
+#include <pthread.h>
+#include <sys/types.h>
+#include "input.h"
+#include "schedule.h"
+
+#define DEFAULT_CTL_RATE 10
+#define DEFAULT_KP 0.5
+#define DEFAULT_KI 0.2
+#define FEED_BUFFER 4096
+#define FEED_IDLE_MS 10
+/* interval of the progress output of the controller */
+#define FEED_REPORT_MS 1000
+
+/*
+ * measurement feed read by a thread of its own. Only the latest value is
+ * kept, seq counts the values read so far, so the controller can tell a
+ * new measurement from an old one.
+ */
+struct feed
+{
+	int fd;
+	unsigned int column;
+	volatile int running;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	double value;
+	unsigned long seq;
+	off_t offset;
+	size_t len;
+	char buf[FEED_BUFFER];
+};
+
+int feed_open(struct feed *f, char *path, unsigned int column);
+unsigned long feed_get(struct feed *f, double *value);
+void feed_close(struct feed *f);
+int closed_loop_run(int id, struct user_data *ud, struct play_stats *st);
+
+#endif
@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <signal.h>
+#include "health.h"
+#include "timing.h"
+#include "control.h"
+#include "sim.h"
+#include "LDAhid.h"
+
+/*
+ * state of a device watched by the health monitor. Playback threads only
+ * set lost and count skipped writes, everything else is done by the
+ * monitor.
+ */
+struct dev_health
+{
+	int serial;
+	int used;
+	volatile int lost;
+	int reported;
+	unsigned long long lost_at;
+	unsigned long skipped;
+	unsigned long outages;
+};
+
+static pthread_t health_thread;
+static volatile int health_running;
+static struct user_data *health_ud;
+static struct dev_health devs[MAXDEVICES + 1];
+
+/*
+ * mark a device as lost, the first one to notice sets the time
+ * @param id: device id
+ */
+static void
+mark_lost(int id)
+{
+	if (__sync_bool_compare_and_swap(&devs[id].lost, 0, 1))
+		devs[id].lost_at = time_now_ns();
+}
+
+/*
+ * bring a lost device back: initialize it again and write the attenuation
+ * of the step playing now, so the playback continues where it would be
+ * without the outage
+ * @param id: device id
+ * @return: 0 if the device is back, 1 if it has to be tried again
+ */
+static int
+reconnect(int id)
+{
+	struct dev_health *d = &devs[id];
+	unsigned long long outage;
+	unsigned long skipped;
+	unsigned int status;
+	int value;
+
+	/* a device which only failed a write may still be open */
+	status = (unsigned int)fnLDA_GetAttenuation(id);
+	if ((status == INVALID_DEVID || status == DEVICE_NOT_READY)
+	    && fnLDA_InitDevice(id) != 0)
+		return 1;
+
+	/*
+	 * writes of the playback go through from here on, the value is read
+	 * afterwards, so a step skipped until now is not missed
+	 */
+	d->lost = 0;
+	__sync_synchronize();
+	value = written_attenuation(id);
+	if (fnLDA_SetAttenuation(id, value) != STATUS_OK) {
+		d->lost = 1;
+		return 1;
+	}
+	/* the status page already holds the value, see write_attenuation() */
+	sim_record(id, value);
+
+	outage = time_now_ns() - d->lost_at;
+	skipped = __sync_lock_test_and_set(&d->skipped, 0);
+	d->outages++;
+	d->reported = 0;
+
+	if (!health_ud->quiet)
+		printf(INFO "device %d (serial %i) is back after %.3f s, %lu "
+		       "writes skipped\n", id, d->serial,
+		       (double)outage / NSEC_PER_SEC, skipped);
+	log_outage(d->serial, outage, skipped, health_ud);
+	return 0;
+}
+
+/*
+ * compare the devices on the bus to the watched ones, lost devices are
+ * brought back as soon as their serial number is enumerated again
+ */
+static void
+health_check(void)
+{
+	DEVID list[MAXDEVICES];
+	int present[MAXDEVICES + 1];
+	int i, n, id;
+
+	memset(present, 0, sizeof(present));
+	/* only a count of the devices rescans the bus */
+	fnLDA_GetNumDevices();
+	n = fnLDA_GetDevInfo(list);
+	for (i = 0; i < n; i++) {
+		id = list[i];
+		if (id > 0 && id <= MAXDEVICES && devs[id].serial
+		    && fnLDA_GetSerialNumber(id) == devs[id].serial)
+			present[id] = sim_present(id);
+	}
+
+	for (id = 1; id <= MAXDEVICES && health_running; id++) {
+		if (!devs[id].used)
+			continue;
+		if (!devs[id].lost && !present[id])
+			mark_lost(id);
+		if (!devs[id].lost)
+			continue;
+		if (!devs[id].reported) {
+			printf(WARN "device %d (serial %i) is lost, its steps "
+			       "are skipped until it is back\n", id,
+			       devs[id].serial);
+			devs[id].reported = 1;
+		}
+		if (present[id])
+			reconnect(id);
+	}
+}
+
+/*
+ * check the devices at a fixed interval, takes part in a simulation as a
+ * helper so outages happen at the same virtual time in every run
+ */
+static void *
+health_loop(void *arg)
+{
+	unsigned long long deadline;
+	sigset_t set;
+
+	/* signals are handled by the threads of the program */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	time_sim_enter_helper();
+	deadline = time_now_ns();
+	while (health_running) {
+		deadline += HEALTH_PERIOD_NS;
+		time_sleep_until_ns(deadline);
+		health_check();
+	}
+	time_sim_leave();
+	return NULL;
+}
+
+/*
+ * watch all devices on the bus in a thread of its own. A device is lost
+ * when a write to it fails or it is not enumerated anymore. Its writes are
+ * skipped while the playback keeps its clock, when the same serial number
+ * shows up again it is initialized in the background and set to the
+ * attenuation of the current step. Other devices are not held up.
+ * @param ud: user data struct with quiet flag and log file
+ * @return: 0 on success, 1 on error
+ */
+int
+health_start(struct user_data *ud)
+{
+	DEVID list[MAXDEVICES];
+	int i, n;
+
+	memset(devs, 0, sizeof(devs));
+	n = fnLDA_GetDevInfo(list);
+	for (i = 0; i < n; i++)
+		if (list[i] > 0 && list[i] <= MAXDEVICES)
+			devs[list[i]].serial = fnLDA_GetSerialNumber(list[i]);
+
+	health_ud = ud;
+	health_running = 1;
+	time_sim_add(1);
+	if (pthread_create(&health_thread, NULL, health_loop, NULL)) {
+		printf(ERR "unable to start device health monitor\n");
+		time_sim_add(-1);
+		health_running = 0;
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * end the health monitor and report devices which did not come back
+ */
+void
+health_stop(void)
+{
+	int id;
+
+	if (!health_running)
+		return;
+	health_running = 0;
+	/* the monitor may sleep on the virtual clock, let it move on */
+	time_sim_leave();
+	pthread_join(health_thread, NULL);
+
+	for (id = 1; id <= MAXDEVICES; id++)
+		if (devs[id].used && devs[id].lost)
+			printf(WARN "device %d (serial %i) did not come back, "
+			       "%lu writes skipped\n", id, devs[id].serial,
+			       devs[id].skipped);
+}
+
+/*
+ * check if a write has to be skipped because its device is lost
+ * @param id: device id
+ * @return: 1 if the device is lost, else 0
+ */
+int
+health_skip(int id)
+{
+	if (!health_running || id <= 0 || id > MAXDEVICES)
+		return 0;
+	if (!devs[id].used)
+		devs[id].used = 1;
+	if (!devs[id].lost)
+		return 0;
+	__sync_fetch_and_add(&devs[id].skipped, 1);
+	return 1;
+}
+
+/*
+ * report a failed write, the device is treated as lost
+ * @param id: device id
+ */
+void
+health_failed(int id)
+{
+	if (!health_running || id <= 0 || id > MAXDEVICES || !devs[id].serial)
+		return;
+	mark_lost(id);
+	__sync_fetch_and_add(&devs[id].skipped, 1);
+}
@@ -0,0 +1,14 @@
+#ifndef _HEALTH_H_
+#define _HEALTH_H_
+
+#include "input.h"
+
+/* interval of the checks for lost and returning devices */
+#define HEALTH_PERIOD_NS 200000000ULL
+
+int health_start(struct user_data *ud);
+void health_stop(void);
+int health_skip(int id);
+void health_failed(int id);
+
+#endif
@@ -4,10 +4,22 @@
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <math.h>
 #include <time.h>
 #include <sys/time.h>
 #include "input.h"
 #include "control.h"
+#include "keyframe.h"
+#include "timing.h"
+#include "schedule.h"
+#include "csv.h"
+#include "plan.h"
+#include "profile.h"
+#include "reload.h"
+#include "checkpoint.h"
+#include "feedback.h"
+#include "console.h"
+#include "logger.h"
 #include "LDAhid.h"
 
 #define FALSE 0
@@ -20,40 +32,28 @@
 #define TIME_UNIT 3
 
 /*
- * returns token on given place in .csv file
+ * parse a row of a .csv file without modifying it. Like in read_file a time
+ * unit given in a row is kept for the following rows.
+ * <time>,<attenuation in dB>[,<time unit>]
+ * Semicolons are accepted as separator as well.
+ * @param line: row to parse
+ * @param ud: user data struct holding the current time unit
+ * @param duration: storage for step time in nanoseconds
+ * @param att: storage for attenuation in MULTIPLIER_STEP units
+ * @return: 0 on success, 1 if the row is empty, -1 if it is malformed, -2
+ *          if a value is out of range
  */
-char*
-get_entry(char* line, int entry)
-{
-	char* token;
-	for (token = strtok(line, ","); token && *token;
-	     token = strtok(NULL, ",\n")) {
-		if (!--entry)
-			return token;
-	}
-	return NULL;
-}
-
-/*
- * set attenuation time if present in csv file
- * @param time_unit: time unit flag
- * @param ud: user data struct
- */
-void
-set_time_unit(char *time_unit, struct user_data *ud)
+int
+parse_row(const char *line, struct user_data *ud, unsigned long long *duration,
+	  int *att)
 {
-	ud->ms = 0;
-	ud->us = 0;
+	unsigned long col;
 
-	if (strncmp(time_unit, "ms\n", strlen(time_unit)) == 0) {
-		ud->ms = 1;
-	}
-	else if (strncmp(time_unit, "us", strlen(time_unit)) == 0)
-		ud->us = 1;
+	return csv_parse(line, line + strlen(line), ud, duration, att, &col);
 }
 
 /*
- * open .csv file and checks it for correct entries.
+ * open .csv file, checks it for correct entries and plays it.
  * time is expected to be in the first entry followed by the
  * attenuation.
  * @param path: path to config file
@@ -64,32 +64,19 @@ set_time_unit(char *time_unit, struct user_data *ud)
 int
 read_file(char *path, int id, struct user_data *ud)
 {
-	FILE *fp;
-	char *tmp;
-	char *time_unit;
-	char line[LINE_LENGTH];
+	struct schedule s;
+	struct play_stats st;
 
-	fp = fopen(path, "r");
-
-	if (fp == NULL) {
-                printf(ERR "unable to open input file for reading: %s\n", path);
+	if (schedule_load(path, &s, ud))
 		return 1;
-	}
-
-	while (fgets(line, LINE_LENGTH, fp)) {
-		tmp = strdup(line);
-		ud->atime = atol(get_entry(tmp, TIME));
-		tmp = strdup(line);
-		ud->attenuation = (int)(atof(get_entry(tmp, ATT))* MULTIPLIER_STEP);
-		tmp = strdup(line);
-		time_unit = get_entry(tmp, TIME_UNIT);
-		if (time_unit)
-			set_time_unit(time_unit, ud);
-		set_attenuation(id, ud);
-		free(tmp);
-	}
+	/* the threads of -md play next to each other on the bus */
+	profile_schedule(id, path, &s, ud, 1);
+	ud->log_ring = logger_ring_size(s.shortest, ud->speed);
+	log_open(ud);
 
-	fclose(fp);
+	memset(&st, 0, sizeof(struct play_stats));
+	schedule_play(id, &s, ud, &st);
+	schedule_free(&s);
 
 	if (!ud->cont && (ud->runs >= 1)) {
 		ud->runs -= 1;
@@ -102,9 +89,26 @@ read_file(char *path, int id, struct user_data *ud)
 	return 0;
 }
 
+/*
+ * open the log file of the user data when its playback is loaded, so
+ * the first logged step does not open it on the timing critical thread
+ * @param ud: user data struct
+ * @return: return 0 on success, 1 if no log, 2 if logfile couldn't be opened
+ */
+int
+log_open(struct user_data *ud)
+{
+	if (ud->log != 1)
+		return 1;
+	if (ud->logger == NULL && (ud->logger = logger_open(ud)) == NULL)
+		return 2;
+	return 0;
+}
+
 /*
  * log the current change of attenuation to a file including
- * a timestamp. Always append the file by default.
+ * a timestamp. Always append the file by default. The line is written by
+ * the background logger, which also rotates and compresses the file.
  * <timestamp>,<attenuation>
  * @param att: attenuation in db
  * @param ud: user data struct
@@ -113,26 +117,127 @@ read_file(char *path, int id, struct user_data *ud)
 int
 log_attenuation(unsigned int att, struct user_data *ud)
 {
+	if (ud->log != 1)
+		return 1;
+	if (ud->logger == NULL && (ud->logger = logger_open(ud)) == NULL)
+		return 2;
+
+	logger_attenuation(ud->logger, att);
+	return 0;
+}
 
+/*
+ * log a step which missed its deadline to the logfile. The line starts
+ * with '#' to keep the file readable as <timestamp>,<attenuation> list.
+ * #<timestamp>,late|skipped,<step index>,<lateness in ns>
+ * @param index: index of the step in the schedule
+ * @param late: lateness in nanoseconds
+ * @param skipped: 1 if the step was dropped
+ * @param ud: user data struct
+ * @return: return 0 on success, 1 if no log, 2 if logfile couldn't be opened
+ */
+int
+log_overrun(unsigned long index, unsigned long long late, int skipped,
+	    struct user_data *ud)
+{
 	if (ud->log != 1)
 		return 1;
+	if (ud->logger == NULL && (ud->logger = logger_open(ud)) == NULL)
+		return 2;
 
-	FILE *fp;
+	logger_overrun(ud->logger, index, late, skipped);
+	return 0;
+}
 
-        fp = fopen(ud->logfile, "a");
-        if (fp == NULL) {
-                printf(ERR "unable to open logfile for writing: %s\n", ud->logfile);
-                return 2;
-        }
+/*
+ * log the write latency estimate and residual error of a step issued early
+ * to the logfile, like log_overrun() as a line starting with '#'.
+ * #<timestamp>,latency,<step index>,<estimate in ns>,<residual in ns>
+ * @param index: index of the step
+ * @param estimate: estimated write latency in nanoseconds
+ * @param residual: completion of the write after its deadline in nanoseconds
+ * @param ud: user data struct
+ * @return: return 0 on success, 1 if no log, 2 if logfile couldn't be opened
+ */
+int
+log_latency(unsigned long index, unsigned long long estimate,
+	    long long residual, struct user_data *ud)
+{
+	if (ud->log != 1)
+		return 1;
+	if (ud->logger == NULL && (ud->logger = logger_open(ud)) == NULL)
+		return 2;
+
+	logger_latency(ud->logger, index, estimate, residual);
+	return 0;
+}
+
+/*
+ * log an attenuation read back from a device which differs from the value
+ * written to it, like log_overrun() as a line starting with '#'.
+ * #<timestamp>,mismatch,<serial>,<written dB>,<read back dB>
+ * @param serial: serial number of the device
+ * @param commanded: attenuation written in MULTIPLIER_STEP units
+ * @param readback: attenuation read back in MULTIPLIER_STEP units
+ * @param ud: user data struct
+ * @return: return 0 on success, 1 if no log, 2 if logfile couldn't be opened
+ */
+int
+log_mismatch(int serial, unsigned int commanded, unsigned int readback,
+	     struct user_data *ud)
+{
+	if (ud->log != 1)
+		return 1;
+	if (ud->logger == NULL && (ud->logger = logger_open(ud)) == NULL)
+		return 2;
+
+	logger_mismatch(ud->logger, serial, commanded, readback);
+	return 0;
+}
+
+/*
+ * log the end of an outage of a device, like log_overrun() as a line
+ * starting with '#'. It is written when the device is back.
+ * #<timestamp>,outage,<serial>,<duration in ns>,<skipped writes>
+ * @param serial: serial number of the device
+ * @param duration: time the device was lost in nanoseconds
+ * @param skipped: writes skipped while it was lost
+ * @param ud: user data struct
+ * @return: return 0 on success, 1 if no log, 2 if logfile couldn't be opened
+ */
+int
+log_outage(int serial, unsigned long long duration, unsigned long skipped,
+	   struct user_data *ud)
+{
+	if (ud->log != 1)
+		return 1;
+	if (ud->logger == NULL && (ud->logger = logger_open(ud)) == NULL)
+		return 2;
 
-	double real_att = (double) att / MULTIPLIER_STEP;
-        struct timespec ts;
-        clock_gettime (CLOCK_REALTIME, &ts);
-        fprintf (fp, "%u.%09u,", (unsigned int) ts.tv_sec, (unsigned int) ts.tv_nsec);
-        fprintf(fp, "%.2f\n", real_att);
+	logger_outage(ud->logger, serial, duration, skipped);
+	return 0;
+}
 
-        fclose( fp );
+/*
+ * log a new version of the schedule parsed while it plays, like
+ * log_overrun() as a line starting with '#'. Rejected versions have 0 steps.
+ * #<timestamp>,reload,<steps>,<parse time in ns>,<1 if rejected>
+ * @param steps: steps of the new version
+ * @param parse: time of the parse in nanoseconds
+ * @param failed: 1 if the playing version was kept
+ * @param ud: user data struct
+ * @return: return 0 on success, 1 if no log, 2 if logfile couldn't be opened
+ */
+int
+log_reload(unsigned long steps, unsigned long long parse, int failed,
+	   struct user_data *ud)
+{
+	if (ud->log != 1)
+		return 1;
+	if (ud->logger == NULL && (ud->logger = logger_open(ud)) == NULL)
+		return 2;
 
+	logger_reload(ud->logger, steps, parse, failed);
 	return 0;
 }
 
@@ -156,7 +261,7 @@ get_parameters(int argc, char *argv[], struct user_data *ud)
 			if ((i + 1) < argc)
 				ud->attenuation = (int)(atof(argv[i + 1]) * MULTIPLIER_STEP);
 			else {
-				printf(ERR "you set the -a switch, but missed to enter an attenuation\n");
+				report(ERR "you set the -a switch, but missed to enter an attenuation\n");
 				return 0;
 			}
 		} else if (strncmp(argv[i], "-i", strlen(argv[i])) == 0) {
@@ -165,29 +270,29 @@ get_parameters(int argc, char *argv[], struct user_data *ud)
 			if ((i + 1) < argc)
 				ud->atime = atol(argv[i + 1]);
 			else {
-				printf(ERR "You missed to set a time\n");
+				report(ERR "You missed to set a time\n");
 				return 0;
 			}
 		} else if (strncmp(argv[i], "-step", strlen(argv[i])) == 0) {
 			if ((i + 1) < argc)
 				ud->ramp_steps = (int)(atof(argv[i + 1]) * MULTIPLIER_STEP);
 			else {
-				printf(WARN "no attenuation steps set\n");
-				printf(WARN "Step size will be set to device minimum\n");
+				report(WARN "no attenuation steps set\n");
+				report(WARN "Step size will be set to device minimum\n");
 				//TODO: set steps du resolution if none is set
 			}
 		} else if (strncmp(argv[i], "-start", strlen(argv[i])) == 0) {
 			if ((i + 1) < argc)
 				ud->start_att = (int)(atof(argv[i + 1]) * MULTIPLIER_STEP);
 			else {
-				printf(ERR "no start attenuation set\n");
+				report(ERR "no start attenuation set\n");
 				return 0;
 			}
 		} else if (strncmp(argv[i], "-end", strlen(argv[i])) == 0) {
 			if ((i + 1) < argc)
 				ud->end_att = (int)(atof(argv[i + 1]) * MULTIPLIER_STEP);
 			else {
-				printf(ERR "no end attenuation set\n");
+				report(ERR "no end attenuation set\n");
 				return 0;
 			}
 		} else if (strncmp(argv[i],"-f", strlen(argv[i])) == 0) {
@@ -197,7 +302,204 @@ get_parameters(int argc, char *argv[], struct user_data *ud)
 				ud->file = 1;
 			}
 			else {
-				printf(ERR "no file specified\n");
+				report(ERR "no file specified\n");
+				return 0;
+			}
+		} else if (strncmp(argv[i], "-kf\0", strlen(argv[i]) + 1) == 0) {
+			if ((i + 1) < argc) {
+				strncpy(ud->path, argv[i + 1], MAX_LENGTH - 1);
+				ud->path[MAX_LENGTH - 1] = '\0';
+				ud->keyframe = 1;
+			} else {
+				report(ERR "no keyframe file specified\n");
+				return 0;
+			}
+		} else if (strncmp(argv[i], "-sc\0", strlen(argv[i]) + 1) == 0) {
+			if ((i + 1) < argc) {
+				strncpy(ud->path, argv[i + 1], MAX_LENGTH - 1);
+				ud->path[MAX_LENGTH - 1] = '\0';
+				ud->scenario = 1;
+			} else {
+				report(ERR "no scenario file specified\n");
+				return 0;
+			}
+		} else if (strncmp(argv[i], "-mix\0", strlen(argv[i]) + 1) == 0) {
+			if ((i + 1) < argc) {
+				strncpy(ud->path, argv[i + 1], MAX_LENGTH - 1);
+				ud->path[MAX_LENGTH - 1] = '\0';
+				ud->mix = 1;
+			} else {
+				report(ERR "no mix file specified\n");
+				return 0;
+			}
+		} else if (strncmp(argv[i], "-rate\0", strlen(argv[i]) + 1) == 0) {
+			if ((i + 1) < argc)
+				ud->update_rate = atoi(argv[i + 1]);
+			else {
+				report(ERR "no update rate set\n");
+				return 0;
+			}
+		} else if (strncmp(argv[i], "-overrun\0", strlen(argv[i]) + 1) == 0) {
+			if ((i + 1) < argc
+			    && (ud->overrun = get_overrun_policy(argv[i + 1])) >= 0) {
+				i++;
+			} else {
+				report(ERR "overrun policy has to be catchup, skip or stretch\n");
+				return 0;
+			}
+		} else if (strncmp(argv[i], "-speed\0", strlen(argv[i]) + 1) == 0) {
+			if ((i + 1) < argc && atof(argv[i + 1]) > 0)
+				ud->speed = atof(argv[i + 1]);
+			else {
+				report(ERR "speed factor has to be above 0\n");
+				return 0;
+			}
+		} else if (strncmp(argv[i], "-offset\0", strlen(argv[i]) + 1) == 0) {
+			if ((i + 1) < argc && atof(argv[i + 1]) >= 0)
+				ud->offset = atof(argv[i + 1]);
+			else {
+				report(ERR "no valid start offset set\n");
+				return 0;
+			}
+		} else if (strncmp(argv[i], "-tolerance\0", strlen(argv[i]) + 1) == 0) {
+			if ((i + 1) < argc)
+				ud->tolerance = atol(argv[i + 1]);
+			else {
+				report(ERR "no tolerance set\n");
+				return 0;
+			}
+		} else if (strncmp(argv[i], "-latcomp\0", strlen(argv[i]) + 1) == 0) {
+			ud->lat_comp = 1;
+		} else if (strncmp(argv[i], "-latoffset\0", strlen(argv[i]) + 1) == 0) {
+			if ((i + 1) < argc && atol(argv[i + 1]) > 0)
+				ud->lat_offset = atol(argv[i + 1]);
+			else {
+				report(ERR "latency offset has to be above 0\n");
+				return 0;
+			}
+		} else if (strncmp(argv[i], "-dry-run\0", strlen(argv[i]) + 1) == 0) {
+			ud->dry_run = 1;
+		} else if (strncmp(argv[i], "-floor\0", strlen(argv[i]) + 1) == 0) {
+			if ((i + 1) < argc)
+				ud->floor = atol(argv[i + 1]);
+			else {
+				report(ERR "no step floor set\n");
+				return 0;
+			}
+		} else if (strncmp(argv[i], "-merge\0", strlen(argv[i]) + 1) == 0) {
+			ud->merge = 1;
+		} else if (strncmp(argv[i], "-profile-dir\0", strlen(argv[i]) + 1) == 0) {
+			if ((i + 1) < argc) {
+				strncpy(ud->profile_dir, argv[i + 1], MAX_LENGTH - 1);
+				ud->profile_dir[MAX_LENGTH - 1] = '\0';
+			} else {
+				report(ERR "no profile directory specified\n");
+				return 0;
+			}
+		} else if (strncmp(argv[i], "-reload\0", strlen(argv[i]) + 1) == 0) {
+			if (ud->reload == 0)
+				ud->reload = RELOAD_RUN;
+		} else if (strncmp(argv[i], "-reload-now\0", strlen(argv[i]) + 1) == 0) {
+			ud->reload = RELOAD_NOW;
+		} else if (strncmp(argv[i], "-reconnect\0", strlen(argv[i]) + 1) == 0) {
+			ud->reconnect = 1;
+		} else if (strncmp(argv[i], "-verify\0", strlen(argv[i]) + 1) == 0) {
+			if ((i + 1) < argc && atoi(argv[i + 1]) > 0)
+				ud->verify_rate = atoi(argv[i + 1]);
+			else {
+				report(ERR "readback rate has to be above 0\n");
+				return 0;
+			}
+		} else if (strncmp(argv[i], "-checkpoint\0", strlen(argv[i]) + 1) == 0) {
+			if ((i + 1) < argc) {
+				strncpy(ud->checkpoint, argv[i + 1], MAX_LENGTH - 1);
+				ud->checkpoint[MAX_LENGTH - 1] = '\0';
+			} else {
+				report(ERR "please specify a checkpoint filename\n");
+				return 0;
+			}
+		} else if (strncmp(argv[i], "-checkpoint-interval\0", strlen(argv[i]) + 1) == 0) {
+			if ((i + 1) < argc && atoi(argv[i + 1]) > 0)
+				ud->checkpoint_interval = atoi(argv[i + 1]);
+			else {
+				report(ERR "checkpoint interval has to be above 0\n");
+				return 0;
+			}
+		} else if (strncmp(argv[i], "-resume\0", strlen(argv[i]) + 1) == 0) {
+			if ((i + 1) < argc) {
+				strncpy(ud->resume, argv[i + 1], MAX_LENGTH - 1);
+				ud->resume[MAX_LENGTH - 1] = '\0';
+			} else {
+				report(ERR "please specify a checkpoint to resume from\n");
+				return 0;
+			}
+		} else if (strncmp(argv[i], "-status\0", strlen(argv[i]) + 1) == 0) {
+			if ((i + 1) < argc) {
+				strncpy(ud->status, argv[i + 1], MAX_LENGTH - 1);
+				ud->status[MAX_LENGTH - 1] = '\0';
+			} else {
+				report(ERR "no name for the status page specified\n");
+				return 0;
+			}
+		} else if (strncmp(argv[i], "-feed\0", strlen(argv[i]) + 1) == 0) {
+			if ((i + 1) < argc) {
+				strncpy(ud->feed, argv[i + 1], MAX_LENGTH - 1);
+				ud->feed[MAX_LENGTH - 1] = '\0';
+				ud->closed_loop = 1;
+			} else {
+				report(ERR "no measurement feed specified\n");
+				return 0;
+			}
+		} else if (strncmp(argv[i], "-feed-col\0", strlen(argv[i]) + 1) == 0) {
+			if ((i + 1) < argc)
+				ud->feed_column = atoi(argv[i + 1]);
+			else {
+				report(ERR "no feed column set\n");
+				return 0;
+			}
+		} else if (strncmp(argv[i], "-target\0", strlen(argv[i]) + 1) == 0) {
+			if ((i + 1) < argc)
+				ud->target = atof(argv[i + 1]);
+			else {
+				report(ERR "no target value set\n");
+				return 0;
+			}
+		} else if (strncmp(argv[i], "-kp\0", strlen(argv[i]) + 1) == 0) {
+			if ((i + 1) < argc)
+				ud->kp = atof(argv[i + 1]);
+			else {
+				report(ERR "no proportional gain set\n");
+				return 0;
+			}
+		} else if (strncmp(argv[i], "-ki\0", strlen(argv[i]) + 1) == 0) {
+			if ((i + 1) < argc)
+				ud->ki = atof(argv[i + 1]);
+			else {
+				report(ERR "no integral gain set\n");
+				return 0;
+			}
+		} else if (strncmp(argv[i], "-live\0", strlen(argv[i]) + 1) == 0) {
+			ud->live = 1;
+		} else if (strncmp(argv[i], "-live-rate\0", strlen(argv[i]) + 1) == 0) {
+			if ((i + 1) < argc && atoi(argv[i + 1]) > 0) {
+				ud->live_rate = atoi(argv[i + 1]);
+				ud->live = 1;
+			} else {
+				report(ERR "live status rate has to be above 0\n");
+				return 0;
+			}
+		} else if (strncmp(argv[i], "-ctl-rate\0", strlen(argv[i]) + 1) == 0) {
+			if ((i + 1) < argc)
+				ud->ctl_rate = atoi(argv[i + 1]);
+			else {
+				report(ERR "no control rate set\n");
+				return 0;
+			}
+		} else if (strncmp(argv[i], "-ctl-step\0", strlen(argv[i]) + 1) == 0) {
+			if ((i + 1) < argc)
+				ud->ctl_step = atof(argv[i + 1]);
+			else {
+				report(ERR "no control step set\n");
 				return 0;
 			}
 		} else if (strncmp(argv[i], "-q", strlen(argv[i])) == 0) {
@@ -207,26 +509,49 @@ get_parameters(int argc, char *argv[], struct user_data *ud)
 				ud->ms = 0;
 				ud->us = 0;
 				if (!quiet)
-					printf(INFO "time in seconds\n");
+					report(INFO "time in seconds\n");
 		} else if (strncmp(argv[i],"ms", strlen(argv[i])) == 0) {
 			ud->ms = 1;
 			if (!quiet)
-				printf(INFO "time in milliseconds\n");
+				report(INFO "time in milliseconds\n");
 		} else if (strncmp(argv[i],"us", strlen(argv[i])) == 0) {
 			ud->us = 1;
 			if (!quiet)
-				printf(INFO "time in useconds\n");
+				report(INFO "time in useconds\n");
 		} else if (strncmp(argv[i], "-l", strlen(argv[i])) == 0) {
 			if ((i + 1) < argc) {
 				strncpy(ud->logfile, argv[i + 1], MAX_LENGTH - 1);
 				ud->logfile[MAX_LENGTH - 1] = '\0';
 				ud->log = 1;
 				if (!quiet)
-					printf(INFO "logging to file: %s\n", ud->logfile);
+					report(INFO "logging to file: %s\n", ud->logfile);
 			} else {
-				printf(ERR "please specify a logfile filename\n");
+				report(ERR "please specify a logfile filename\n");
+				return 0;
+			}
+		} else if (strncmp(argv[i], "-log-size\0", strlen(argv[i]) + 1) == 0) {
+			if ((i + 1) < argc && atol(argv[i + 1]) > 0)
+				ud->log_size = atol(argv[i + 1]);
+			else {
+				report(ERR "log segment size has to be above 0\n");
+				return 0;
+			}
+		} else if (strncmp(argv[i], "-log-time\0", strlen(argv[i]) + 1) == 0) {
+			if ((i + 1) < argc && atoi(argv[i + 1]) > 0)
+				ud->log_time = atoi(argv[i + 1]);
+			else {
+				report(ERR "log segment time has to be above 0\n");
+				return 0;
+			}
+		} else if (strncmp(argv[i], "-log-keep\0", strlen(argv[i]) + 1) == 0) {
+			if ((i + 1) < argc && atoi(argv[i + 1]) > 0)
+				ud->log_keep = atoi(argv[i + 1]);
+			else {
+				report(ERR "number of log segments to keep has to be above 0\n");
 				return 0;
 			}
+		} else if (strncmp(argv[i], "-log-gzip\0", strlen(argv[i]) + 1) == 0) {
+			ud->log_gzip = 1;
 		} else if (strncmp(argv[i], "-ramp\0", strlen(argv[i]) + 1) == 0) {
 				ud->ramp = 1;
 		} else if (strncmp(argv[i],"-triangle", strlen(argv[i])) == 0) {
@@ -243,7 +568,7 @@ get_parameters(int argc, char *argv[], struct user_data *ud)
 			if ((i + 1) < argc)
 				ud->serial_number = atoi(argv[i + 1]);
 			else {
-				printf(ERR "You missed to insert serial number\n");
+				report(ERR "You missed to insert serial number\n");
 				return 0;
 			}
 
@@ -271,11 +596,48 @@ clear_userdata(struct user_data *ud)
 	ud->cont = 0;
 	ud->simple = 0;
 	ud->file = 0;
+	ud->keyframe = 0;
+	ud->scenario = 0;
+	ud->mix = 0;
+	ud->update_rate = DEFAULT_UPDATE_RATE;
 	ud->info = 0;
 	ud->runs = 1;
 	ud->log = 0;
+	ud->log_size = 0;
+	ud->log_time = 0;
+	ud->log_keep = 0;
+	ud->log_ring = 0;
+	ud->log_gzip = 0;
+	ud->logger = NULL;
+	ud->overrun = OVERRUN_STRETCH;
+	ud->tolerance = DEFAULT_TOLERANCE;
+	ud->lat_comp = 0;
+	ud->lat_offset = 0;
+	ud->verify_rate = 0;
+	ud->reconnect = 0;
+	ud->dry_run = 0;
+	ud->floor = DEFAULT_FLOOR;
+	ud->merge = 0;
+	ud->reload = 0;
+	ud->speed = 1;
+	ud->offset = 0;
+	ud->checkpoint_interval = DEFAULT_CHECKPOINT_INTERVAL;
+	ud->closed_loop = 0;
+	ud->ctl_rate = DEFAULT_CTL_RATE;
+	ud->live = 0;
+	ud->live_rate = DEFAULT_LIVE_RATE;
+	ud->feed_column = 0;
+	ud->target = NAN;
+	ud->kp = DEFAULT_KP;
+	ud->ki = DEFAULT_KI;
+	ud->ctl_step = 0;
 	ud->quiet=0;
 	memset(ud->path, '\0', sizeof(ud->path));
 	memset(ud->logfile, '\0', sizeof(ud->logfile));
+	memset(ud->checkpoint, '\0', sizeof(ud->checkpoint));
+	memset(ud->resume, '\0', sizeof(ud->resume));
+	memset(ud->status, '\0', sizeof(ud->status));
+	memset(ud->feed, '\0', sizeof(ud->feed));
+	memset(ud->profile_dir, '\0', sizeof(ud->profile_dir));
 }
 
@@ -13,6 +13,8 @@
  * */
 #define MULTIPLIER_STEP 20
 
+struct logger;
+
 struct user_data
 {
 	unsigned long atime;
@@ -25,23 +27,72 @@ struct user_data
 	unsigned int cont;
 	unsigned int simple;
 	unsigned int file;
+	unsigned int keyframe;
+	unsigned int scenario;
+	unsigned int mix;
+	unsigned int update_rate;
 	unsigned int info;
 	unsigned int runs;
 	unsigned int ms;
 	unsigned int us;
 	unsigned int log;
+	unsigned long log_size;
+	unsigned int log_time;
+	unsigned int log_keep;
+	unsigned long log_ring;
+	unsigned int log_gzip;
+	int overrun;
+	double speed;
+	double offset;
+	unsigned long tolerance;
+	unsigned int lat_comp;
+	unsigned long lat_offset;
+	unsigned int verify_rate;
+	unsigned int reconnect;
+	unsigned int dry_run;
+	unsigned long floor;
+	unsigned int merge;
+	unsigned int reload;
+	unsigned int checkpoint_interval;
+	unsigned int closed_loop;
+	unsigned int ctl_rate;
+	unsigned int live;
+	unsigned int live_rate;
+	unsigned int feed_column;
+	double target;
+	double kp;
+	double ki;
+	double ctl_step;
 	unsigned int quiet;
 	unsigned int serial_number;
 	char path[128];
 	char logfile[128];
+	char checkpoint[128];
+	char resume[128];
+	char feed[128];
+	char status[128];
+	char profile_dir[128];
+	struct logger *logger;
 };
 
 int read_file(char *patch, int id, struct user_data *ud);
-char * get_entry(char* line, int entry);
+int parse_row(const char *line, struct user_data *ud, unsigned long long *duration,
+	      int *att);
 int get_parameters(int argc, char *argv[], struct user_data *ud);
 void print_userdata(struct user_data *ud);
 void clear_userdata(struct user_data *ud);
+int log_open(struct user_data *ud);
 int log_attenuation(unsigned int att, struct user_data *ud);
+int log_overrun(unsigned long index, unsigned long long late, int skipped,
+		struct user_data *ud);
+int log_latency(unsigned long index, unsigned long long estimate,
+		long long residual, struct user_data *ud);
+int log_mismatch(int serial, unsigned int commanded, unsigned int readback,
+		 struct user_data *ud);
+int log_outage(int serial, unsigned long long duration, unsigned long skipped,
+	       struct user_data *ud);
+int log_reload(unsigned long steps, unsigned long long parse, int failed,
+	       struct user_data *ud);
 
 #endif
 
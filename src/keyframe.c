@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <math.h>
+#include "keyframe.h"
+#include "mem.h"
+#include "timing.h"
+#include "control.h"
+#include "status.h"
+#include "input.h"
+#include "LDAhid.h"
+
+#define LINE_LENGTH 256
+#define INITIAL_FRAMES 64
+
+/*
+ * map interpolation name of a keyframe row to its type
+ * @param name: interpolation name, may be followed by whitespace
+ * @return: interpolation type, -1 if unknown
+ */
+int
+get_interp(char *name)
+{
+	size_t len;
+
+	while (isspace((unsigned char)*name))
+		name++;
+	len = strcspn(name, " \t\r\n");
+
+	if (len == 0)
+		return INTERP_LINEAR;
+	if (len == 4 && strncmp(name, "hold", len) == 0)
+		return INTERP_HOLD;
+	if (len == 6 && strncmp(name, "linear", len) == 0)
+		return INTERP_LINEAR;
+	if (len == 5 && strncmp(name, "cubic", len) == 0)
+		return INTERP_CUBIC;
+	if (len == 11 && strncmp(name, "exponential", len) == 0)
+		return INTERP_EXPONENTIAL;
+	return -1;
+}
+
+/*
+ * append a keyframe to the schedule, growing it if needed
+ * @param ks: keyframe schedule
+ * @param kf: keyframe to append
+ * @return: 0 on success, 1 if out of memory
+ */
+int
+add_keyframe(struct keyframe_schedule *ks, struct keyframe *kf)
+{
+	struct keyframe *frames;
+	unsigned int size;
+
+	if (ks->count == ks->size) {
+		size = ks->size ? ks->size * 2 : INITIAL_FRAMES;
+		frames = mem_realloc(ks->frames, size * sizeof(struct keyframe));
+		if (frames == NULL)
+			return 1;
+		ks->frames = frames;
+		ks->size = size;
+	}
+	ks->frames[ks->count++] = *kf;
+	return 0;
+}
+
+/*
+ * read a keyframe file. Every row is expected to look like
+ * <time>,<attenuation in dB>[,hold|linear|cubic|exponential]
+ * where time is the offset from the start of the schedule in the time unit
+ * set by the user. Empty rows and rows starting with '#' are skipped.
+ * @param path: path to keyframe file
+ * @param ks: keyframe schedule to fill
+ * @param ud: user data struct
+ * @return: 0 on success, 1 on error
+ */
+int
+keyframe_load(char *path, struct keyframe_schedule *ks, struct user_data *ud)
+{
+	FILE *fp;
+	char line[LINE_LENGTH];
+	char *pos, *end;
+	struct keyframe kf;
+	unsigned long long unit;
+	unsigned int nr_line = 0;
+	double time;
+
+	memset(ks, 0, sizeof(struct keyframe_schedule));
+	unit = time_unit_ns(ud);
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		printf(ERR "unable to open keyframe file for reading: %s\n", path);
+		return 1;
+	}
+
+	while (fgets(line, LINE_LENGTH, fp)) {
+		nr_line++;
+		pos = line;
+		while (isspace((unsigned char)*pos))
+			pos++;
+		if (*pos == '\0' || *pos == '#')
+			continue;
+
+		time = strtod(pos, &end);
+		if (end == pos || *end != ',' || time < 0)
+			goto malformed;
+		pos = end + 1;
+		kf.attenuation = strtod(pos, &end) * MULTIPLIER_STEP;
+		if (end == pos)
+			goto malformed;
+		kf.time = (unsigned long long)(time * unit + 0.5);
+		kf.interp = INTERP_LINEAR;
+		if (*end == ',')
+			kf.interp = get_interp(end + 1);
+		if (kf.interp < 0) {
+			printf(ERR "%s:%u: unknown interpolation\n", path, nr_line);
+			goto error;
+		}
+
+		if (ks->count && kf.time < ks->frames[ks->count - 1].time) {
+			printf(ERR "%s:%u: keyframe time goes backwards\n",
+			       path, nr_line);
+			goto error;
+		}
+
+		if (add_keyframe(ks, &kf)) {
+			printf(ERR "could not allocate memory for keyframes\n");
+			goto error;
+		}
+	}
+	fclose(fp);
+
+	if (ks->count == 0) {
+		printf(ERR "no keyframes found in %s\n", path);
+		return 1;
+	}
+	return 0;
+
+malformed:
+	printf(ERR "%s:%u: expected <time>,<attenuation>[,<interpolation>]\n",
+	       path, nr_line);
+error:
+	fclose(fp);
+	keyframe_free(ks);
+	return 1;
+}
+
+/*
+ * cubic hermite interpolation between keyframe i and i + 1 using
+ * catmull-rom tangents from the neighbouring keyframes
+ */
+static double
+interp_cubic(struct keyframe *f, unsigned int i, unsigned int count,
+	     double s)
+{
+	double p0, p1, m0, m1, h;
+
+	p0 = f[i].attenuation;
+	p1 = f[i + 1].attenuation;
+	h = (double)(f[i + 1].time - f[i].time);
+
+	if (i > 0 && f[i + 1].time > f[i - 1].time)
+		m0 = (p1 - f[i - 1].attenuation) /
+		     (double)(f[i + 1].time - f[i - 1].time);
+	else
+		m0 = (p1 - p0) / h;
+
+	if (i + 2 < count && f[i + 2].time > f[i].time)
+		m1 = (f[i + 2].attenuation - p0) /
+		     (double)(f[i + 2].time - f[i].time);
+	else
+		m1 = (p1 - p0) / h;
+
+	return (2 * s * s * s - 3 * s * s + 1) * p0
+	       + (s * s * s - 2 * s * s + s) * h * m0
+	       + (-2 * s * s * s + 3 * s * s) * p1
+	       + (s * s * s - s * s) * h * m1;
+}
+
+/*
+ * interpolate linear in the power domain, which results in a fade that
+ * is linear in signal power instead of linear in dB
+ */
+static double
+interp_exponential(double a0, double a1, double s)
+{
+	double p0, p1;
+
+	p0 = pow(10, -a0 / (10.0 * MULTIPLIER_STEP));
+	p1 = pow(10, -a1 / (10.0 * MULTIPLIER_STEP));
+	return -10.0 * MULTIPLIER_STEP * log10((1 - s) * p0 + s * p1);
+}
+
+/*
+ * calculate attenuation of the schedule at a given time. As time only moves
+ * forward during playback the current segment is kept in seg, so each
+ * lookup is O(1).
+ * @param ks: keyframe schedule
+ * @param seg: index of the current segment, start with 0
+ * @param t: offset from start of the schedule in nanoseconds
+ * @return: attenuation in MULTIPLIER_STEP units
+ */
+double
+keyframe_value(struct keyframe_schedule *ks, unsigned int *seg,
+	       unsigned long long t)
+{
+	struct keyframe *f = ks->frames;
+	unsigned int i;
+	double s;
+
+	while (*seg + 1 < ks->count && t >= f[*seg + 1].time)
+		(*seg)++;
+	i = *seg;
+
+	if (i + 1 >= ks->count || t <= f[i].time)
+		return f[i].attenuation;
+
+	s = (double)(t - f[i].time) / (double)(f[i + 1].time - f[i].time);
+
+	switch (f[i].interp) {
+	case INTERP_HOLD:
+		return f[i].attenuation;
+	case INTERP_CUBIC:
+		return interp_cubic(f, i, ks->count, s);
+	case INTERP_EXPONENTIAL:
+		return interp_exponential(f[i].attenuation,
+					  f[i + 1].attenuation, s);
+	default:
+		return f[i].attenuation
+		       + (f[i + 1].attenuation - f[i].attenuation) * s;
+	}
+}
+
+/*
+ * round attenuation to the next step the device is able to set and keep
+ * it in device limits
+ * @param value: attenuation in MULTIPLIER_STEP units
+ * @param resolution: step size of the device
+ * @param min: minimal attenuation of the device
+ * @param max: maximal attenuation of the device
+ * @return: attenuation the device is able to set
+ */
+int
+quantize(double value, int resolution, int min, int max)
+{
+	int att;
+
+	att = (int)floor(value / resolution + 0.5) * resolution;
+	if (att < min)
+		return min;
+	if (att > max)
+		return max;
+	return att;
+}
+
+/*
+ * play a keyframe schedule on a device. Intermediate values are calculated
+ * at the update rate set by the user, rounded to the device resolution and
+ * only written to the device if they differ from the last value.
+ * Playback starts at the offset set by the user and runs faster or slower
+ * than real time by the speed factor.
+ * @param id: device id
+ * @param ks: keyframe schedule
+ * @param ud: user data struct
+ * @return: 0 on success, 1 on error
+ */
+int
+keyframe_play(int id, struct keyframe_schedule *ks, struct user_data *ud)
+{
+	unsigned long long start, period, t, next, end, offset, due, now, issue;
+	unsigned int seg = 0;
+	int value, last, resolution, min, max;
+	double speed;
+
+	if (ud->update_rate == 0) {
+		printf(ERR "update rate has to be above 0\n");
+		return 1;
+	}
+
+	resolution = fnLDA_GetDevResolution(id);
+	if (resolution <= 0)
+		resolution = 1;
+	min = fnLDA_GetMinAttenuation(id);
+	max = fnLDA_GetMaxAttenuation(id);
+
+	/* the update rate is kept in wall clock time */
+	speed = ud->speed > 0 ? ud->speed : 1;
+	period = (unsigned long long)(NSEC_PER_SEC * speed / ud->update_rate);
+	offset = (unsigned long long)(ud->offset * time_unit_ns(ud));
+	end = ks->frames[ks->count - 1].time;
+	last = -1;
+
+	if (offset > end) {
+		printf(ERR "offset is beyond the end of the keyframes\n");
+		return 1;
+	}
+
+	if (!ud->quiet)
+		printf(INFO "playing %u keyframes at %u updates/s in %.2fdB steps\n",
+		       ks->count, ud->update_rate,
+		       (double)resolution / MULTIPLIER_STEP);
+
+	start = time_now_ns();
+	for (t = offset;; t = next) {
+		value = quantize(keyframe_value(ks, &seg, t), resolution,
+				 min, max);
+		if (value != last) {
+			due = start + (unsigned long long)((t - offset) / speed);
+			issue = due - write_lead(id, ud);
+			time_sleep_until_ns(issue);
+			now = time_now_ns();
+			write_attenuation(id, value);
+			log_attenuation(value, ud);
+			write_residual(id, seg, due, ud);
+			last = value;
+			status_late(id, now > issue ? now - issue : 0, 0, 0);
+			status_step(id, seg, ks->count,
+				    due + (unsigned long long)(period / speed));
+		}
+
+		if (t >= end)
+			break;
+
+		/* never step over a keyframe and skip holds completely */
+		next = seg + 1 < ks->count ? ks->frames[seg + 1].time : end;
+		if (ks->frames[seg].interp != INTERP_HOLD && t + period < next)
+			next = t + period;
+	}
+
+	return 0;
+}
+
+/*
+ * free memory of a keyframe schedule
+ * @param ks: keyframe schedule
+ */
+void
+keyframe_free(struct keyframe_schedule *ks)
+{
+	free(ks->frames);
+	memset(ks, 0, sizeof(struct keyframe_schedule));
+}
@@ -0,0 +1,40 @@
+#ifndef _KEYFRAME_H_
+#define _KEYFRAME_H_
+
+#include "input.h"
+
+#define INTERP_HOLD 0
+#define INTERP_LINEAR 1
+#define INTERP_CUBIC 2
+#define INTERP_EXPONENTIAL 3
+
+#define DEFAULT_UPDATE_RATE 100
+
+/*
+ * single keyframe of a schedule, the interpolation describes how to get
+ * from this keyframe to the next one
+ */
+struct keyframe
+{
+	unsigned long long time;
+	double attenuation;
+	int interp;
+};
+
+struct keyframe_schedule
+{
+	struct keyframe *frames;
+	unsigned int count;
+	unsigned int size;
+};
+
+int get_interp(char *name);
+int add_keyframe(struct keyframe_schedule *ks, struct keyframe *kf);
+int keyframe_load(char *path, struct keyframe_schedule *ks, struct user_data *ud);
+double keyframe_value(struct keyframe_schedule *ks, unsigned int *seg,
+		      unsigned long long t);
+int quantize(double value, int resolution, int min, int max);
+int keyframe_play(int id, struct keyframe_schedule *ks, struct user_data *ud);
+void keyframe_free(struct keyframe_schedule *ks);
+
+#endif
@@ -0,0 +1,439 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <pthread.h>
+#include "libattenuator.h"
+#include "mem.h"
+#include "control.h"
+#include "input.h"
+#include "devinit.h"
+#include "schedule.h"
+#include "feedback.h"
+#include "logger.h"
+#include "LDAhid.h"
+
+#define FALSE 0
+#define TRUE !FALSE
+
+/* state of a single device */
+struct att_context
+{
+	DEVID id;
+	int serial;
+	int state;
+	int thread_active;
+	int loaded;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	struct user_data ud;
+	struct schedule sched;
+	struct play_stats st;
+	struct write_state writes;
+	char error[ATT_ERROR_LENGTH];
+};
+
+static pthread_once_t lib_once = PTHREAD_ONCE_INIT;
+
+/*
+ * initialize the vendor library once per process
+ */
+static void
+lib_init(void)
+{
+	fnLDA_Init();
+	fnLDA_SetTestMode(FALSE);
+}
+
+/*
+ * let the vendor library simulate devices instead of using the USB bus, so
+ * a harness can be tested without attenuators. The mode is kept by the
+ * vendor library and applies to devices opened afterwards.
+ * @param on: 1 for simulated devices, 0 for real ones
+ */
+void
+att_test_mode(int on)
+{
+	pthread_once(&lib_once, lib_init);
+	fnLDA_SetTestMode(on ? TRUE : FALSE);
+}
+
+/*
+ * keep an error message in the context
+ * @return: always 1, to be returned by the caller
+ */
+static int
+set_error(struct att_context *ctx, const char *msg)
+{
+	snprintf(ctx->error, ATT_ERROR_LENGTH, "%s", msg);
+	return 1;
+}
+
+/*
+ * number of attenuators connected
+ */
+int
+att_device_count(void)
+{
+	pthread_once(&lib_once, lib_init);
+	return fnLDA_GetNumDevices();
+}
+
+/*
+ * open a device and create a context for it
+ * @param serial: serial number of the device, 0 for the first one found
+ * @param error: storage for an error message, may be NULL
+ * @param length: size of error
+ * @return: context of the device, NULL on error
+ */
+struct att_context *
+att_open(int serial, char *error, int length)
+{
+	struct att_context *ctx;
+	DEVID devices[MAXDEVICES];
+	char message[MAX_INIT_MSG];
+	int i, count;
+
+	pthread_once(&lib_once, lib_init);
+
+	ctx = mem_calloc(1, sizeof(struct att_context));
+	if (ctx == NULL) {
+		if (error)
+			snprintf(error, length, "could not allocate memory for context");
+		return NULL;
+	}
+
+	fnLDA_GetNumDevices();
+	count = fnLDA_GetDevInfo(devices);
+	for (i = 0; i < count; i++)
+		if (serial == 0 || fnLDA_GetSerialNumber(devices[i]) == serial)
+			break;
+	if (i == count) {
+		if (error)
+			snprintf(error, length, "no device with serial %d found",
+				 serial);
+		free(ctx);
+		return NULL;
+	}
+
+	ctx->id = devices[i];
+	ctx->serial = fnLDA_GetSerialNumber(ctx->id);
+	if (fnLDA_InitDevice(ctx->id) != 0) {
+		if (error)
+			snprintf(error, length, "initialising device (serial %d) "
+				 "failed", ctx->serial);
+		free(ctx);
+		return NULL;
+	}
+	if (check_device(ctx->id, 1, message, MAX_INIT_MSG)) {
+		if (error)
+			snprintf(error, length, "check failed for the device "
+				 "(serial %d): %s", ctx->serial, message);
+		fnLDA_CloseDevice(ctx->id);
+		free(ctx);
+		return NULL;
+	}
+
+	write_bind(ctx->id, &ctx->writes);
+	pthread_mutex_init(&ctx->lock, NULL);
+	clear_userdata(&ctx->ud);
+	ctx->ud.quiet = 1;
+	ctx->state = ATT_IDLE;
+	return ctx;
+}
+
+/*
+ * stop a running playback, close the device and free the context
+ * @param ctx: device context
+ */
+void
+att_close(struct att_context *ctx)
+{
+	if (ctx == NULL)
+		return;
+
+	if (ctx->thread_active) {
+		ctx->st.stop = 1;
+		pthread_join(ctx->thread, NULL);
+	}
+	if (ctx->loaded)
+		schedule_free(&ctx->sched);
+	if (ctx->ud.logger)
+		logger_close(ctx->ud.logger);
+	write_bind(ctx->id, NULL);
+	fnLDA_CloseDevice(ctx->id);
+	pthread_mutex_destroy(&ctx->lock);
+	free(ctx);
+}
+
+/*
+ * description of the last error of a context
+ */
+const char *
+att_error(struct att_context *ctx)
+{
+	return ctx->error;
+}
+
+/*
+ * serial number of the device of a context
+ */
+int
+att_serial(struct att_context *ctx)
+{
+	return ctx->serial;
+}
+
+/*
+ * configure a context with the options of the command line tool, like
+ * time unit, -overrun, -speed, -offset, -rr, -r or -l. Options which use
+ * state of the whole process are refused. A log file is opened here and
+ * owned by the context.
+ * @param ctx: device context
+ * @param argc: number of options including argv[0], which is ignored
+ * @param argv: options
+ * @return: 0 on success, 1 on error
+ */
+int
+att_configure(struct att_context *ctx, int argc, char *argv[])
+{
+	struct user_data ud;
+	struct logger *lg = ctx->ud.logger;
+	int res;
+
+	if (ctx->state == ATT_RUNNING)
+		return set_error(ctx, "playback is running");
+
+	ud = ctx->ud;
+	report_capture(ctx->error, ATT_ERROR_LENGTH);
+	res = get_parameters(argc, argv, &ud);
+	report_capture(NULL, 0);
+	if (!res)
+		return ctx->error[0] ? 1 : set_error(ctx, "invalid options");
+	if (ud.checkpoint[0] || ud.resume[0] || ud.status[0] || ud.live
+	    || ud.verify_rate || ud.reconnect || ud.reload)
+		return set_error(ctx, "-checkpoint, -resume, -status, -live, "
+				 "-verify, -reconnect and -reload are only "
+				 "supported by the tool");
+
+	if (lg && strcmp(ud.logfile, ctx->ud.logfile) != 0) {
+		logger_close(lg);
+		lg = NULL;
+	}
+	ud.logger = lg;
+	if (ud.logfile[0] && ud.logger == NULL
+	    && (ud.logger = logger_create(&ud)) == NULL) {
+		ctx->ud.logger = NULL;
+		return set_error(ctx, "unable to open log file");
+	}
+	ctx->ud = ud;
+	return 0;
+}
+
+/*
+ * set the attenuation of a device immediately
+ * @param ctx: device context
+ * @param attenuation: attenuation in dB
+ * @return: 0 on success, 1 on error
+ */
+int
+att_set(struct att_context *ctx, double attenuation)
+{
+	LVSTATUS status;
+	int value;
+
+	if (ctx->state == ATT_RUNNING)
+		return set_error(ctx, "playback is running");
+
+	value = (int)floor(attenuation * MULTIPLIER_STEP + 0.5);
+	if (value < fnLDA_GetMinAttenuation(ctx->id)
+	    || value > fnLDA_GetMaxAttenuation(ctx->id))
+		return set_error(ctx, "attenuation out of device limits");
+	status = write_attenuation(ctx->id, value);
+	if (status != STATUS_OK)
+		return set_error(ctx, fnLDA_perror(status));
+	log_attenuation(value, &ctx->ud);
+	return 0;
+}
+
+/*
+ * get the attenuation of a device
+ * @param ctx: device context
+ * @param attenuation: storage for the attenuation in dB
+ * @return: 0 on success, 1 on error
+ */
+int
+att_get(struct att_context *ctx, double *attenuation)
+{
+	int value;
+
+	value = fnLDA_GetAttenuation(ctx->id);
+	if (value < 0)
+		return set_error(ctx, fnLDA_perror(value));
+	*attenuation = (double)value / MULTIPLIER_STEP;
+	return 0;
+}
+
+/*
+ * load a schedule file for playback, replacing a loaded one. The time unit
+ * set with att_configure() applies.
+ * @param ctx: device context
+ * @param path: path to the schedule file
+ * @return: 0 on success, 1 on error
+ */
+int
+att_load(struct att_context *ctx, char *path)
+{
+	struct schedule sched;
+	int res;
+
+	if (ctx->state == ATT_RUNNING)
+		return set_error(ctx, "playback is running");
+	report_capture(ctx->error, ATT_ERROR_LENGTH);
+	res = schedule_load(path, &sched, &ctx->ud);
+	report_capture(NULL, 0);
+	if (res)
+		return ctx->error[0] ? 1 : set_error(ctx, "unable to load "
+						      "schedule");
+
+	if (ctx->loaded)
+		schedule_free(&ctx->sched);
+	ctx->sched = sched;
+	ctx->loaded = 1;
+	return 0;
+}
+
+/*
+ * play the loaded schedule as often as configured, or hold the measurement
+ * of a feed set with -feed until stopped
+ */
+static void *
+play_thread(void *arg)
+{
+	struct att_context *ctx = arg;
+	struct user_data ud = ctx->ud;
+	char error[ATT_ERROR_LENGTH];
+	unsigned int i;
+	int res = 0, state;
+
+	report_capture(error, ATT_ERROR_LENGTH);
+	if (ud.closed_loop)
+		res = closed_loop_run(ctx->id, &ud, &ctx->st);
+	else
+		for (i = 0; (ud.cont || i < ud.runs) && res == 0
+		     && !ctx->st.stop; i++) {
+			res = schedule_play(ctx->id, &ctx->sched, &ud, &ctx->st);
+			ud.offset = 0;
+		}
+
+	if (res)
+		state = ATT_FAILED;
+	else if (ctx->st.stop)
+		state = ATT_STOPPED;
+	else
+		state = ATT_DONE;
+
+	report_capture(NULL, 0);
+
+	pthread_mutex_lock(&ctx->lock);
+	if (res)
+		snprintf(ctx->error, ATT_ERROR_LENGTH, "%s",
+			 error[0] ? error : "playback failed");
+	ctx->state = state;
+	pthread_mutex_unlock(&ctx->lock);
+	return NULL;
+}
+
+/*
+ * wait for a playback thread which has already finished
+ */
+static void
+reap_thread(struct att_context *ctx)
+{
+	int state;
+
+	pthread_mutex_lock(&ctx->lock);
+	state = ctx->state;
+	pthread_mutex_unlock(&ctx->lock);
+
+	if (ctx->thread_active && state != ATT_RUNNING) {
+		pthread_join(ctx->thread, NULL);
+		ctx->thread_active = 0;
+	}
+}
+
+/*
+ * start playing the loaded schedule in the background, or the closed loop
+ * control if a feed was configured
+ * @param ctx: device context
+ * @return: 0 on success, 1 on error
+ */
+int
+att_start(struct att_context *ctx)
+{
+	pthread_mutex_lock(&ctx->lock);
+	if (ctx->state == ATT_RUNNING) {
+		pthread_mutex_unlock(&ctx->lock);
+		return set_error(ctx, "playback is running");
+	}
+	pthread_mutex_unlock(&ctx->lock);
+
+	if (!ctx->loaded && !ctx->ud.closed_loop)
+		return set_error(ctx, "no schedule loaded");
+
+	reap_thread(ctx);
+	memset(&ctx->st, 0, sizeof(struct play_stats));
+	ctx->st.lock = &ctx->lock;
+	ctx->state = ATT_RUNNING;
+
+	if (pthread_create(&ctx->thread, NULL, play_thread, ctx)) {
+		ctx->state = ATT_FAILED;
+		return set_error(ctx, "unable to start playback thread");
+	}
+	ctx->thread_active = 1;
+	return 0;
+}
+
+/*
+ * ask a running playback to stop. It ends within a few milliseconds, which
+ * att_poll() reports as ATT_STOPPED.
+ * @param ctx: device context
+ * @return: 0 on success, 1 if no playback is running
+ */
+int
+att_stop(struct att_context *ctx)
+{
+	if (!ctx->thread_active)
+		return set_error(ctx, "no playback running");
+	ctx->st.stop = 1;
+	return 0;
+}
+
+/*
+ * get the progress of a playback
+ * @param ctx: device context
+ * @param status: storage for the progress, may be NULL
+ * @return: state of the context
+ */
+int
+att_poll(struct att_context *ctx, struct att_status *status)
+{
+	int state;
+
+	pthread_mutex_lock(&ctx->lock);
+	state = ctx->state;
+	if (status) {
+		status->state = state;
+		status->attenuation = (double)ctx->st.value / MULTIPLIER_STEP;
+		status->step = ctx->st.index;
+		status->count = ctx->loaded ? ctx->sched.count : 0;
+		status->steps = ctx->st.steps;
+		status->missed = ctx->st.missed;
+		status->skipped = ctx->st.skipped;
+		status->max_late = ctx->st.max_late;
+	}
+	pthread_mutex_unlock(&ctx->lock);
+
+	reap_thread(ctx);
+	return state;
+}
@@ -0,0 +1,59 @@
+#ifndef _LIBATTENUATOR_H_
+#define _LIBATTENUATOR_H_
+
+/*
+ * libattenuator - control Lab Brick attenuators from within a program
+ *
+ * Every device is handled through a context of its own. No function of the
+ * library exits the program or prints, errors are returned and described by
+ * att_error(). Schedules are played in a thread of the context, so starting,
+ * stopping and polling a playback never blocks the caller.
+ *
+ * A context holds all state of its playback: the options, the schedule,
+ * the write latency estimate of -latcomp, the last value written, the log
+ * file of -l and the last error. Options of the tool which need state of
+ * the whole process, like -status, -checkpoint or -reconnect, are refused
+ * by att_configure(). Only the vendor library is shared by all contexts,
+ * its test mode is set with att_test_mode(). A device must not be opened
+ * by two contexts.
+ */
+
+#define ATT_ERROR_LENGTH 128
+
+/* states of a context */
+#define ATT_IDLE 0
+#define ATT_RUNNING 1
+#define ATT_DONE 2
+#define ATT_STOPPED 3
+#define ATT_FAILED 4
+
+struct att_context;
+
+/* progress of a schedule playback */
+struct att_status
+{
+	int state;
+	double attenuation;
+	unsigned long step;
+	unsigned long count;
+	unsigned long steps;
+	unsigned long missed;
+	unsigned long skipped;
+	unsigned long long max_late;
+};
+
+void att_test_mode(int on);
+int att_device_count(void);
+struct att_context *att_open(int serial, char *error, int length);
+void att_close(struct att_context *ctx);
+const char *att_error(struct att_context *ctx);
+int att_serial(struct att_context *ctx);
+int att_configure(struct att_context *ctx, int argc, char *argv[]);
+int att_set(struct att_context *ctx, double attenuation);
+int att_get(struct att_context *ctx, double *attenuation);
+int att_load(struct att_context *ctx, char *path);
+int att_start(struct att_context *ctx);
+int att_stop(struct att_context *ctx);
+int att_poll(struct att_context *ctx, struct att_status *status);
+
+#endif
@@ -0,0 +1,658 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <dirent.h>
+#include <zlib.h>
+#include "logger.h"
+#include "mem.h"
+#include "timing.h"
+#include "control.h"
+#include "input.h"
+
+#define LOG_BATCH 1024
+#define LOG_GZ_FLUSH_NS 1000000000ULL
+#define LOG_PATH_LENGTH (MAX_LENGTH + 16)
+
+#define RECORD_ATTENUATION 0
+#define RECORD_LATE 1
+#define RECORD_SKIPPED 2
+#define RECORD_LATENCY 3
+#define RECORD_MISMATCH 4
+#define RECORD_OUTAGE 5
+#define RECORD_RELOAD 6
+
+/* entry of the log, formatted by the writer thread */
+struct log_record
+{
+	volatile unsigned long ready;
+	struct timespec ts;
+	unsigned long long late;
+	long long residual;
+	unsigned long index;
+	unsigned int att;
+	int type;
+};
+
+/*
+ * log file shared by all users of the same path. Steps only append records
+ * to the ring, the writer thread formats, compresses and rotates. Slots of
+ * the ring are claimed with compare and swap and marked ready once filled,
+ * so neither side ever waits for the other. If the ring is full, records
+ * are dropped and counted instead of waiting.
+ */
+struct logger
+{
+	char path[MAX_LENGTH];
+	unsigned long max_size;
+	unsigned int max_time;
+	unsigned int keep;
+	int compress;
+	int segmented;
+
+	struct log_record *ring;
+	unsigned long size;
+	volatile unsigned long head;
+	volatile unsigned long tail;
+	volatile unsigned long dropped;
+
+	pthread_t thread;
+	volatile int running;
+
+	FILE *fp;
+	gzFile gz;
+	unsigned long segment;
+	unsigned long long written;
+	unsigned long long opened;
+	unsigned long long flushed;
+	struct logger *next;
+};
+
+static struct logger *loggers;
+static pthread_mutex_t loggers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * name of a segment, the log file itself unless segments are used
+ */
+static void
+segment_name(struct logger *lg, unsigned long segment, char *name)
+{
+	if (!lg->segmented)
+		snprintf(name, LOG_PATH_LENGTH, "%s", lg->path);
+	else
+		snprintf(name, LOG_PATH_LENGTH, "%s.%04lu%s", lg->path, segment,
+			 lg->compress ? ".gz" : "");
+}
+
+/*
+ * write a formatted line to the current segment
+ */
+static void
+segment_write(struct logger *lg, const char *line, int length)
+{
+	if (lg->gz)
+		gzwrite(lg->gz, line, length);
+	else
+		fwrite(line, 1, length, lg->fp);
+	lg->written += length;
+}
+
+/*
+ * open the next segment and write its header, which holds the time base
+ * of the time stamps. Lines starting with '#' are ignored by readers of
+ * the log, so the header does not change its format.
+ * @return: 0 on success, 1 on error
+ */
+static int
+segment_open(struct logger *lg)
+{
+	char name[LOG_PATH_LENGTH];
+	char line[256];
+	struct timespec ts;
+	int length;
+
+	segment_name(lg, lg->segment, name);
+	if (lg->compress)
+		lg->gz = gzopen(name, "ab");
+	else
+		lg->fp = fopen(name, "a");
+	if (lg->gz == NULL && lg->fp == NULL) {
+		printf(ERR "unable to open logfile for writing: %s\n", name);
+		return 1;
+	}
+
+	/* drop the oldest segment to keep the disk usage bounded */
+	if (lg->segmented && lg->keep && lg->segment >= lg->keep) {
+		segment_name(lg, lg->segment - lg->keep, name);
+		unlink(name);
+	}
+
+	time_realtime(&ts);
+	lg->opened = time_now_ns();
+	lg->flushed = lg->opened;
+	lg->written = 0;
+	length = snprintf(line, sizeof(line), "#segment,%lu,realtime,%u.%09u,"
+			  "monotonic,%llu\n", lg->segment,
+			  (unsigned int)ts.tv_sec, (unsigned int)ts.tv_nsec,
+			  lg->opened);
+	segment_write(lg, line, length);
+	return 0;
+}
+
+static void
+segment_close(struct logger *lg)
+{
+	if (lg->gz)
+		gzclose(lg->gz);
+	if (lg->fp)
+		fclose(lg->fp);
+	lg->gz = NULL;
+	lg->fp = NULL;
+}
+
+/*
+ * size of the current segment on disk, compressed data still buffered by
+ * zlib is not counted
+ */
+static unsigned long long
+segment_size(struct logger *lg)
+{
+	if (lg->gz)
+		return (unsigned long long)gzoffset(lg->gz);
+	return lg->written;
+}
+
+/*
+ * start a new segment if the current one is too large or too old
+ */
+static void
+segment_rotate(struct logger *lg, unsigned long long now)
+{
+	if (!lg->segmented)
+		return;
+	if ((lg->max_size && segment_size(lg) >= lg->max_size)
+	    || (lg->max_time && now - lg->opened
+		>= (unsigned long long)lg->max_time * NSEC_PER_SEC)) {
+		segment_close(lg);
+		lg->segment++;
+		segment_open(lg);
+	}
+}
+
+/*
+ * format a record like the lines written before by log_attenuation() and
+ * log_overrun()
+ */
+static int
+format_record(struct log_record *r, char *line, int size)
+{
+	if (r->type == RECORD_ATTENUATION)
+		return snprintf(line, size, "%u.%09u,%.2f\n",
+				(unsigned int)r->ts.tv_sec,
+				(unsigned int)r->ts.tv_nsec,
+				(double)r->att / MULTIPLIER_STEP);
+	if (r->type == RECORD_MISMATCH)
+		return snprintf(line, size, "#%u.%09u,mismatch,%lu,%.2f,%.2f\n",
+				(unsigned int)r->ts.tv_sec,
+				(unsigned int)r->ts.tv_nsec, r->index,
+				(double)r->att / MULTIPLIER_STEP,
+				(double)r->late / MULTIPLIER_STEP);
+	if (r->type == RECORD_OUTAGE)
+		return snprintf(line, size, "#%u.%09u,outage,%lu,%llu,%lld\n",
+				(unsigned int)r->ts.tv_sec,
+				(unsigned int)r->ts.tv_nsec, r->index, r->late,
+				r->residual);
+	if (r->type == RECORD_RELOAD)
+		return snprintf(line, size, "#%u.%09u,reload,%lu,%llu,%lld\n",
+				(unsigned int)r->ts.tv_sec,
+				(unsigned int)r->ts.tv_nsec, r->index, r->late,
+				r->residual);
+	if (r->type == RECORD_LATENCY)
+		return snprintf(line, size, "#%u.%09u,latency,%lu,%llu,%lld\n",
+				(unsigned int)r->ts.tv_sec,
+				(unsigned int)r->ts.tv_nsec, r->index, r->late,
+				r->residual);
+	return snprintf(line, size, "#%u.%09u,%s,%lu,%llu\n",
+			(unsigned int)r->ts.tv_sec, (unsigned int)r->ts.tv_nsec,
+			r->type == RECORD_SKIPPED ? "skipped" : "late",
+			r->index, r->late);
+}
+
+/*
+ * take records out of the ring in batches and write them, the producers
+ * are never held up by file operations
+ */
+static void *
+logger_thread(void *arg)
+{
+	struct logger *lg = arg;
+	struct log_record batch[LOG_BATCH];
+	struct log_record *r;
+	unsigned long count, dropped, i, tail;
+	unsigned long long now;
+	char line[128];
+	sigset_t set;
+	int length;
+
+	/* signals are handled by the threads of the program */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	for (;;) {
+		tail = lg->tail;
+		for (count = 0; count < LOG_BATCH; count++, tail++) {
+			r = &lg->ring[tail % lg->size];
+			if (r->ready != tail + 1)
+				break;
+			__sync_synchronize();
+			batch[count] = *r;
+		}
+		__sync_synchronize();
+		lg->tail = tail;
+		dropped = __sync_lock_test_and_set(&lg->dropped, 0);
+
+		if (lg->fp == NULL && lg->gz == NULL) {
+			/* segment could not be opened, records are lost */
+			if (!lg->running && count == 0)
+				break;
+			time_sleep_until_ns(time_now_ns() + LOG_FLUSH_NS);
+			segment_open(lg);
+			continue;
+		}
+
+		if (dropped) {
+			length = snprintf(line, sizeof(line), "#dropped,%lu\n",
+					  dropped);
+			segment_write(lg, line, length);
+		}
+		for (i = 0; i < count; i++) {
+			length = format_record(&batch[i], line, sizeof(line));
+			segment_write(lg, line, length);
+			if (lg->max_size && lg->written >= lg->max_size)
+				segment_rotate(lg, time_now_ns());
+		}
+
+		if (count == LOG_BATCH)
+			continue;
+
+		now = time_now_ns();
+		if (lg->fp)
+			fflush(lg->fp);
+		else if (now - lg->flushed >= LOG_GZ_FLUSH_NS) {
+			gzflush(lg->gz, Z_SYNC_FLUSH);
+			lg->flushed = now;
+		}
+		segment_rotate(lg, now);
+
+		if (!lg->running && count == 0)
+			break;
+		time_sleep_until_ns(now + LOG_FLUSH_NS);
+	}
+
+	segment_close(lg);
+	return NULL;
+}
+
+/*
+ * get the number of a segment of the log from the name of a file
+ * @param lg: logger
+ * @param file: name of the file without directory
+ * @param base: name of the log without directory
+ * @param segment: storage for the number
+ * @return: 1 if the file is a segment, else 0
+ */
+static int
+segment_number(struct logger *lg, const char *file, const char *base,
+	       unsigned long *segment)
+{
+	size_t length = strlen(base);
+	char *end;
+
+	if (strncmp(file, base, length) || file[length] != '.'
+	    || file[length + 1] < '0' || file[length + 1] > '9')
+		return 0;
+	*segment = strtoul(file + length + 1, &end, 10);
+	return strcmp(end, lg->compress ? ".gz" : "") == 0;
+}
+
+/*
+ * get the first segment number after those of earlier runs, so a restarted
+ * run never overwrites segments. Segments of earlier runs beyond the number
+ * kept with -log-keep are deleted, the oldest first.
+ */
+static unsigned long
+first_free_segment(struct logger *lg)
+{
+	char dir[LOG_PATH_LENGTH], name[LOG_PATH_LENGTH];
+	unsigned long segment, next = 0;
+	const char *base;
+	struct dirent *de;
+	DIR *d;
+
+	if (!lg->segmented)
+		return 0;
+
+	base = strrchr(lg->path, '/');
+	if (base == NULL) {
+		base = lg->path;
+		snprintf(dir, sizeof(dir), ".");
+	} else {
+		snprintf(dir, sizeof(dir), "%.*s",
+			 base == lg->path ? 1 : (int)(base - lg->path), lg->path);
+		base++;
+	}
+
+	d = opendir(dir);
+	if (d == NULL)
+		return 0;
+	while ((de = readdir(d)) != NULL)
+		if (segment_number(lg, de->d_name, base, &segment)
+		    && segment >= next)
+			next = segment + 1;
+
+	/* the segment opened next counts as kept */
+	if (lg->keep && next >= lg->keep) {
+		rewinddir(d);
+		while ((de = readdir(d)) != NULL)
+			if (segment_number(lg, de->d_name, base, &segment)
+			    && segment + lg->keep <= next) {
+				segment_name(lg, segment, name);
+				unlink(name);
+			}
+	}
+	closedir(d);
+	return next;
+}
+
+/*
+ * create a logger for the log file set in the user data and start its
+ * writer thread. Rotation and compression are taken from the user data.
+ * @param ud: user data struct
+ * @return: logger, NULL on error
+ */
+struct logger *
+logger_create(struct user_data *ud)
+{
+	struct logger *lg;
+
+	lg = mem_calloc(1, sizeof(struct logger));
+	if (lg == NULL) {
+		printf(ERR "could not allocate memory for logger\n");
+		return NULL;
+	}
+	lg->size = ud->log_ring ? ud->log_ring : LOG_RING_SIZE;
+	lg->ring = mem_calloc(lg->size, sizeof(struct log_record));
+	if (lg->ring == NULL) {
+		printf(ERR "could not allocate memory for log buffer\n");
+		free(lg);
+		return NULL;
+	}
+
+	memcpy(lg->path, ud->logfile, MAX_LENGTH);
+	lg->max_size = ud->log_size * 1024;
+	lg->max_time = ud->log_time;
+	lg->keep = ud->log_keep;
+	lg->compress = ud->log_gzip;
+	lg->segmented = lg->max_size || lg->max_time || lg->compress;
+	lg->segment = first_free_segment(lg);
+
+	if (segment_open(lg))
+		goto error;
+	lg->running = 1;
+	if (pthread_create(&lg->thread, NULL, logger_thread, lg)) {
+		printf(ERR "unable to start logger thread\n");
+		segment_close(lg);
+		goto error;
+	}
+	return lg;
+
+error:
+	free(lg->ring);
+	free(lg);
+	return NULL;
+}
+
+/*
+ * write the pending records of a logger from logger_create() and close it
+ */
+void
+logger_close(struct logger *lg)
+{
+	lg->running = 0;
+	pthread_join(lg->thread, NULL);
+	free(lg->ring);
+	free(lg);
+}
+
+/*
+ * get the logger of the log file set in the user data, creating it on
+ * first use. Loggers are shared by path, rotation and compression are set
+ * by the first user of a path. All of them are closed at exit.
+ * @param ud: user data struct
+ * @return: logger, NULL on error
+ */
+struct logger *
+logger_open(struct user_data *ud)
+{
+	static int registered;
+	struct logger *lg;
+
+	pthread_mutex_lock(&loggers_lock);
+	for (lg = loggers; lg; lg = lg->next)
+		if (strcmp(lg->path, ud->logfile) == 0)
+			goto out;
+
+	lg = logger_create(ud);
+	if (lg == NULL)
+		goto out;
+	lg->next = loggers;
+	loggers = lg;
+	if (!registered) {
+		atexit(logger_close_all);
+		registered = 1;
+	}
+out:
+	pthread_mutex_unlock(&loggers_lock);
+	return lg;
+}
+
+/*
+ * add a record to the ring, never blocks
+ */
+static void
+logger_push(struct logger *lg, struct log_record *r)
+{
+	struct log_record *slot;
+	unsigned long head;
+
+	do {
+		head = lg->head;
+		if (head - lg->tail >= lg->size) {
+			__sync_fetch_and_add(&lg->dropped, 1);
+			return;
+		}
+	} while (!__sync_bool_compare_and_swap(&lg->head, head, head + 1));
+
+	slot = &lg->ring[head % lg->size];
+	slot->ts = r->ts;
+	slot->late = r->late;
+	slot->residual = r->residual;
+	slot->index = r->index;
+	slot->att = r->att;
+	slot->type = r->type;
+	__sync_synchronize();
+	slot->ready = head + 1;
+}
+
+/*
+ * log a change of attenuation
+ * @param lg: logger
+ * @param att: attenuation in MULTIPLIER_STEP units
+ */
+void
+logger_attenuation(struct logger *lg, unsigned int att)
+{
+	struct log_record r;
+
+	time_realtime(&r.ts);
+	r.type = RECORD_ATTENUATION;
+	r.att = att;
+	r.index = 0;
+	r.late = 0;
+	r.residual = 0;
+	logger_push(lg, &r);
+}
+
+/*
+ * log a step which missed its deadline
+ * @param lg: logger
+ * @param index: index of the step in the schedule
+ * @param late: lateness in nanoseconds
+ * @param skipped: 1 if the step was dropped
+ */
+void
+logger_overrun(struct logger *lg, unsigned long index, unsigned long long late,
+	       int skipped)
+{
+	struct log_record r;
+
+	time_realtime(&r.ts);
+	r.type = skipped ? RECORD_SKIPPED : RECORD_LATE;
+	r.att = 0;
+	r.index = index;
+	r.late = late;
+	r.residual = 0;
+	logger_push(lg, &r);
+}
+
+/*
+ * log the write latency estimate and residual error of a step
+ * @param lg: logger
+ * @param index: index of the step
+ * @param estimate: estimated write latency in nanoseconds
+ * @param residual: completion of the write after its deadline in nanoseconds
+ */
+void
+logger_latency(struct logger *lg, unsigned long index,
+	       unsigned long long estimate, long long residual)
+{
+	struct log_record r;
+
+	time_realtime(&r.ts);
+	r.type = RECORD_LATENCY;
+	r.att = 0;
+	r.index = index;
+	r.late = estimate;
+	r.residual = residual;
+	logger_push(lg, &r);
+}
+
+/*
+ * log an attenuation read back which differs from the value written
+ * @param lg: logger
+ * @param serial: serial number of the device
+ * @param commanded: attenuation written in MULTIPLIER_STEP units
+ * @param readback: attenuation read back in MULTIPLIER_STEP units
+ */
+void
+logger_mismatch(struct logger *lg, int serial, unsigned int commanded,
+		unsigned int readback)
+{
+	struct log_record r;
+
+	time_realtime(&r.ts);
+	r.type = RECORD_MISMATCH;
+	r.att = commanded;
+	r.index = (unsigned long)serial;
+	r.late = readback;
+	r.residual = 0;
+	logger_push(lg, &r);
+}
+
+/*
+ * log the end of an outage of a device
+ * @param lg: logger
+ * @param serial: serial number of the device
+ * @param duration: time the device was lost in nanoseconds
+ * @param skipped: writes skipped while it was lost
+ */
+void
+logger_outage(struct logger *lg, int serial, unsigned long long duration,
+	      unsigned long skipped)
+{
+	struct log_record r;
+
+	time_realtime(&r.ts);
+	r.type = RECORD_OUTAGE;
+	r.att = 0;
+	r.index = (unsigned long)serial;
+	r.late = duration;
+	r.residual = (long long)skipped;
+	logger_push(lg, &r);
+}
+
+/*
+ * log a new version of a schedule parsed while playing
+ * @param lg: logger
+ * @param steps: steps of the new version, 0 if it was rejected
+ * @param parse: time of the parse in nanoseconds
+ * @param failed: 1 if the playing version was kept
+ */
+void
+logger_reload(struct logger *lg, unsigned long steps, unsigned long long parse,
+	      int failed)
+{
+	struct log_record r;
+
+	time_realtime(&r.ts);
+	r.type = RECORD_RELOAD;
+	r.att = 0;
+	r.index = steps;
+	r.late = parse;
+	r.residual = failed;
+	logger_push(lg, &r);
+}
+
+/*
+ * get the number of records the ring of a log file needs, so memory is
+ * sized once when the schedule is loaded. The writer empties the ring every
+ * LOG_FLUSH_NS, a step writes up to three records and the ring holds four
+ * times what comes in between.
+ * @param interval: shortest step of the schedule in nanoseconds
+ * @param speed: playback speed, 0 for normal speed
+ * @return: ring size, a power of two between LOG_RING_MIN and LOG_RING_SIZE
+ */
+unsigned long
+logger_ring_size(unsigned long long interval, double speed)
+{
+	unsigned long size = LOG_RING_MIN;
+	double records;
+
+	if (speed > 0)
+		interval = (unsigned long long)(interval / speed);
+	if (interval == 0)
+		return LOG_RING_SIZE;
+	records = 4.0 * 3 * LOG_FLUSH_NS / interval;
+	while (size < records && size < LOG_RING_SIZE)
+		size *= 2;
+	return size < LOG_RING_SIZE ? size : LOG_RING_SIZE;
+}
+
+/*
+ * write all pending records and close all log files, runs at exit
+ */
+void
+logger_close_all(void)
+{
+	struct logger *lg;
+
+	pthread_mutex_lock(&loggers_lock);
+	while ((lg = loggers)) {
+		loggers = lg->next;
+		logger_close(lg);
+	}
+	pthread_mutex_unlock(&loggers_lock);
+}
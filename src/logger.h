@@ -0,0 +1,32 @@
+#ifndef _LOGGER_H_
+#define _LOGGER_H_
+
+#include "input.h"
+
+/* records buffered per log file at most and at least */
+#ifndef LOG_RING_SIZE
+#define LOG_RING_SIZE 16384
+#endif
+#define LOG_RING_MIN 256
+#define LOG_FLUSH_NS 20000000ULL
+
+struct logger;
+
+struct logger *logger_create(struct user_data *ud);
+void logger_close(struct logger *lg);
+struct logger *logger_open(struct user_data *ud);
+void logger_attenuation(struct logger *lg, unsigned int att);
+void logger_overrun(struct logger *lg, unsigned long index,
+		    unsigned long long late, int skipped);
+void logger_latency(struct logger *lg, unsigned long index,
+		    unsigned long long estimate, long long residual);
+void logger_mismatch(struct logger *lg, int serial, unsigned int commanded,
+		     unsigned int readback);
+void logger_outage(struct logger *lg, int serial, unsigned long long duration,
+		   unsigned long skipped);
+void logger_reload(struct logger *lg, unsigned long steps,
+		   unsigned long long parse, int failed);
+void logger_close_all(void);
+unsigned long logger_ring_size(unsigned long long interval, double speed);
+
+#endif
@@ -0,0 +1,1457 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <signal.h>
+#include <libgen.h>
+#include <pthread.h>
+#include "control.h"
+#include "mem.h"
+#include "input.h"
+#include "evloop.h"
+#include "devinit.h"
+#include "timing.h"
+#include "schedule.h"
+#include "checkpoint.h"
+#include "analyze.h"
+#include "status.h"
+#include "console.h"
+#include "verify.h"
+#include "health.h"
+#include "plan.h"
+#include "sim.h"
+#include "channel.h"
+#include "batch.h"
+#include "profile.h"
+#include "calibrate.h"
+#include "LDAhid.h"
+
+#define FALSE 0
+#define TRUE !FALSE
+#define SINGLE_DEV_ID 1
+#define MAX_PATH_LENGTH 512
+#define MAX_MSG_SIZE 64
+
+/* pthread struct */
+struct thread_arguments {
+	char *path;
+	int id;
+	int live;
+	unsigned int lat_comp;
+	unsigned long lat_offset;
+	unsigned int merge;
+	char *profile_dir;
+};
+
+/*
+ * help function to display possible options and correct usage
+ */
+void
+call_help(void)
+{
+	printf("-to show this overview use\n");
+	printf("\t-h\n");
+	printf("\r\n");
+
+	printf("-analyze timing of a log written with -l, as first argument\n");
+	printf("\t-analyze <log> [-f <file>] [s|ms|us] [-speed <factor>] [-tolerance <time in us>]\n");
+	printf("\r\n");
+
+	printf("-set attenuation with\n");
+	printf("\t-a <attenuation in dB>\n");
+	printf("\r\n");
+
+	printf("-set end attenuation strength in dB with\n");
+	printf("\t-end <dB>\n");
+	printf("\r\n");
+
+	printf("-to use a .csv file\n");
+	printf("\t-f path/to/file\n");
+	printf("\tcsv file is expected to have time;attenuation format\n");
+	printf("\r\n");
+
+	printf("-to use a keyframe file\n");
+	printf("\t-kf path/to/file\n");
+	printf("\tkeyframe file is expected to have time,attenuation[,interpolation] format\n");
+	printf("\ttime is the offset from the start of the schedule\n");
+	printf("\tinterpolation is one of hold, linear, cubic or exponential\n");
+	printf("\r\n");
+
+	printf("-to use a scenario file\n");
+	printf("\t-sc path/to/file\n");
+	printf("\tscenario files know the statements\n");
+	printf("\t\thold <dB> <time> [s|ms|us]\n");
+	printf("\t\tramp|triangle <start dB> <end dB> <step dB> <time> [s|ms|us]\n");
+	printf("\t\trepeat <count>|forever { ... }\n");
+	printf("\t\tsegment <name> { ... }\n");
+	printf("\t\tcall <name>\n");
+	printf("\t\tunit s|ms|us\n");
+	printf("\r\n");
+
+	printf("-to sum several layers of attenuation on one device\n");
+	printf("\t-mix path/to/file\n");
+	printf("\tevery row of the mix file adds a layer\n");
+	printf("\t\tfile <path/to/csv>\n");
+	printf("\t\tramp|triangle <start dB> <end dB> <step dB> <time>\n");
+	printf("\t\tfading <Doppler Hz> <samples per second> [sinusoids [seed]]\n");
+	printf("\t\toffset <dB>\n");
+	printf("\t\tlength <time> -> time of a run, longest layer by default\n");
+	printf("\r\n");
+
+	printf("-set number of updates per second for keyframe files with\n");
+	printf("\t-rate <updates per second>\n");
+	printf("\r\n");
+
+	printf("print additional device information\n");
+	printf("\t-i\n");
+	printf("\r\n");
+
+	printf("-log attenuation changes to a .csv file\n");
+	printf("\t-l path/to/logfile\n");
+	printf("\t\t-log-size <KiB> -log-time <s> -> start a new segment of the log\n");
+	printf("\t\t-log-keep <#segments> -> remove the oldest segments\n");
+	printf("\t\t-log-gzip -> compress the log while writing it\n");
+	printf("\r\n");
+
+	printf("-remove [INFO] output\n");
+	printf("\t-q\n");
+	printf("\r\n");
+
+	printf("-repeat form, or file input until canceled by user\n");
+	printf("\t-r\n");
+	printf("\r\n");
+
+	printf("-swap in changes of file input while it plays\n");
+	printf("\t-reload|-reload-now\n");
+	printf("\t\t-reload -> with the next repetition, -reload-now -> at once\n");
+	printf("\r\n");
+
+	printf("-set attenuation form with\n");
+	printf("\t-ramp|-triangle\n");
+	printf("\r\n");
+
+	printf("-choose how to handle steps of a file which are late\n");
+	printf("\t-overrun catchup|skip|stretch\n");
+	printf("\t\tstretch -> keep every step for its full time (default)\n");
+	printf("\t\tcatchup -> issue late steps immediately\n");
+	printf("\t\tskip -> drop steps whose time is over\n");
+	printf("\r\n");
+
+	printf("-count steps later than this as missed deadline\n");
+	printf("\t-tolerance <time in us>\n");
+	printf("\r\n");
+
+	printf("-issue steps early by the write latency of the device\n");
+	printf("\t-latcomp -> estimate the latency while playing\n");
+	printf("\t-latoffset <time in us> -> use a fixed latency instead\n");
+	printf("\r\n");
+
+	printf("-compare the attenuation read back to the value written\n");
+	printf("\t-verify <checks per second>\n");
+	printf("\r\n");
+
+	printf("-predict the timeline of -a, -f, -ramp, -triangle or -md without devices\n");
+	printf("\t-dry-run\n");
+	printf("\t\t-floor <time in us> -> shortest step the devices follow, 1000 by default\n");
+	printf("\r\n");
+
+	printf("-measure write, readback and sleep timing of all devices, as first argument\n");
+	printf("\t-calibrate [-cal-writes <#writes>] [-profile-dir <dir>]\n");
+	printf("\t\ta profile <serial>.profile is written per device, to %s by default\n",
+	       DEFAULT_PROFILE_DIR);
+	printf("\r\n");
+
+	printf("-combine steps shorter than the calibrated profile of the device allows\n");
+	printf("\t-merge [-profile-dir <dir>]\n");
+	printf("\t\twithout -merge such steps are reported\n");
+	printf("\r\n");
+
+	printf("-play on simulated devices and a virtual clock, recording every write\n");
+	printf("\t-sim <timeline file>\n");
+	printf("\t\tthe timeline holds time, serial and attenuation of each write\n");
+	printf("\t\t-sim-drop <serial>:<start>:<length> -> device drops off the bus, times in s\n");
+	printf("\r\n");
+
+	printf("-bring devices back which drop off the bus, their steps are skipped meanwhile\n");
+	printf("\t-reconnect\n");
+	printf("\r\n");
+
+	printf("-play file input faster or slower than real time\n");
+	printf("\t-speed <factor>\n");
+	printf("\r\n");
+
+	printf("-start file or keyframe input at an offset\n");
+	printf("\t-offset <time>\n");
+	printf("\r\n");
+
+	printf("-save the position of file input periodically\n");
+	printf("\t-checkpoint <file>\n");
+	printf("\r\n");
+
+	printf("-set seconds between two checkpoints\n");
+	printf("\t-checkpoint-interval <seconds>\n");
+	printf("\r\n");
+
+	printf("-continue file input from a checkpoint\n");
+	printf("\t-resume <file>\n");
+	printf("\r\n");
+
+	printf("-publish the live state of the devices in shared memory\n");
+	printf("\t-status <name>\n");
+	printf("\r\n");
+
+	printf("-show a live status line per device instead of a line per step\n");
+	printf("\t-live\n");
+	printf("\t\t-live-rate <Hz> -> redraws per second, 10 by default\n");
+	printf("\r\n");
+
+	printf("-play correlated fading of several links on their devices\n");
+	printf("\t-channel <model file> [s|ms|us] -> time unit of the path loss\n");
+	printf("\r\n");
+
+	printf("-play the rounds of an experiment one after the other\n");
+	printf("\t-batch <manifest>\n");
+	printf("\tevery row holds the options of a round, e.g.\n");
+	printf("\t\tms -n <serial> -f <file> -rr <#runs> -l <logfile> -pause <time>\n");
+	printf("\r\n");
+
+	printf("-hold a measurement read from a file or fifo at a target value\n");
+	printf("\t-feed <file> -target <value>\n");
+	printf("\t\t-feed-col <column> -> field of a line to use, last one by default\n");
+	printf("\t\t-kp <gain> -ki <gain> -> PI controller gains in dB per unit\n");
+	printf("\t\t-ctl-rate <Hz> -> control updates per second\n");
+	printf("\t\t-ctl-step <dB> -> maximal change per update\n");
+	printf("\t\t-start <dB> -> initial attenuation\n");
+	printf("\r\n");
+
+	printf("-repeat form, or file input for several times\n");
+	printf("\t-rr <#runs>\n");
+	printf("\r\n");
+
+	printf("-set starting attenuation strength in dB with\n");
+	printf("\t-start <dB>\n");
+	printf("\r\n");
+
+	printf("-set size of steps for attenuation in dB with\n");
+	printf("\t-step <dB>\n");
+	printf("\r\n");
+
+	printf("-set time for attenuation duration with\n");
+	printf("\t-t <time in sec>\n");
+	printf("\r\n");
+
+	printf("\tyou can use s, ms or us to set time units\n");
+	printf("\t\ts -> seconds\n");
+	printf("\t\tms -> milliseconds\n");
+	printf("\t\tus -> microseconds\n");
+	printf("\r\n");
+
+	printf("-use specific device detected by serial number\n");
+	printf("\t-n <serial number>\n");
+	printf("\r\n");
+
+	printf("-to use more than one connected attenuator use\n");
+	printf("\t-md <config_file1> <config_file2> ...\n");
+	printf("\r\n");
+	printf("\t every connected and detected attenuator will be used\n");
+	printf("\t if there are more config files than attenuators detected\n");
+	printf("\t the remaining files will be discarded\n");
+	printf("\r\n");
+
+	printf("-drive all devices from a single event loop instead of a thread per device\n");
+	printf("\t-md|-mds -ev <config_file1> <config_file2> ...\n");
+	printf("\r\n");
+
+	printf("-initialize devices in multi device mode with a number of parallel workers\n");
+	printf("\t-init-workers <#workers>\n");
+	printf("\r\n");
+
+	printf("-give up on a device that does not finish initialization in time\n");
+	printf("\t-init-timeout <time in ms>\n");
+	printf("\r\n");
+
+	printf("-only check what is needed for playback when starting multiple devices\n");
+	printf("\t-fast-check\n");
+	printf("\r\n");
+
+	printf("-to use more than one connected attenuator (with serial number association) use\n");
+	printf("\t-mds <serial_num_1.csv> <serial_num_2.csv> ...\n");
+	printf("\r\n");
+	printf("\t every attenuator matching with serial number specified in configuration file will be used\n");
+	printf("\t not matching attenuators will be discarded\n");
+	printf("\t [NOTE] file format is: serial number + csv extension, eg. 10314.csv\n");
+	printf("\r\n");
+
+	return;
+}
+
+/*
+ * check if the user wants to use multiple attenuators
+ * @param argc: argument count
+ * @param *argv: arguments passed to the program
+ * return returns 1 or 2 on multiple devices, else 0
+ */
+int
+check_multi_device(char *argv[])
+{
+	if (strncmp(argv[1], "-md", strlen(argv[1])) == 0)
+		return 1;
+	else if (strncmp(argv[1], "-mds", strlen(argv[1])) == 0)
+		return 2;
+	else
+		return 0;
+}
+
+/*
+ * get instructions for attenuator from file and start it
+ * @param arguments: pthread argument struct
+ */
+void *
+start_device(void *arguments)
+{
+	char *path;
+	int id;
+	struct thread_arguments *args = arguments;
+	struct user_data ud;
+
+	path = args->path;
+	id = args->id;
+
+	time_sim_enter();
+	clear_userdata(&ud);
+	ud.live = args->live;
+	ud.lat_comp = args->lat_comp;
+	ud.lat_offset = args->lat_offset;
+	ud.merge = args->merge;
+	if (args->profile_dir) {
+		strncpy(ud.profile_dir, args->profile_dir, MAX_LENGTH - 1);
+		ud.profile_dir[MAX_LENGTH - 1] = '\0';
+	}
+
+	read_file(path, id, &ud);
+	time_sim_leave();
+	pthread_exit((void *)(intptr_t)id);
+}
+
+/*
+ * start the status page and the monitors reading it as set by the user:
+ * live console, readback verification and device health. On error the
+ * ones already started are stopped again.
+ * @param ud: user data struct with status, live, verify and reconnect
+ * @return: 0 on success, 1 on error
+ */
+int
+monitors_start(struct user_data *ud)
+{
+	if ((ud->status[0] || ud->live || ud->verify_rate)
+	    && status_open(ud->status[0] ? ud->status : NULL))
+		return 1;
+	if (ud->live && console_start(ud->live_rate)) {
+		status_close();
+		return 1;
+	}
+	if (ud->verify_rate && verify_start(ud)) {
+		console_stop();
+		status_close();
+		return 1;
+	}
+	if (ud->reconnect && health_start(ud)) {
+		verify_stop();
+		console_stop();
+		status_close();
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * stop the monitors in the reverse order of monitors_start() and remove
+ * the status page
+ */
+void
+monitors_stop(void)
+{
+	health_stop();
+	verify_stop();
+	console_stop();
+	status_close();
+}
+
+/* the signal handler wakes the shutdown thread through this pipe */
+static int shutdown_pipe[2];
+static volatile sig_atomic_t shutting_down;
+
+/*
+ * wait for a termination signal and shut down from a thread of its own:
+ * the playback is stopped at its next write, then the checkpoint is taken,
+ * the monitors are joined and the devices are closed. The status page is
+ * only unlinked, playback threads still sleeping may update it until exit.
+ */
+void *
+shutdown_loop(void *arg)
+{
+	DEVID working_devices[MAXDEVICES];
+	int nr_active_devices;
+	sigset_t set;
+	char sig;
+
+	/* signals are handled by the threads of the program */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	while (read(shutdown_pipe[0], &sig, 1) != 1)
+		;
+	shutting_down = 1;
+
+	write_stop();
+	checkpoint_write();
+	health_stop();
+	verify_stop();
+	console_stop();
+	status_unlink();
+	nr_active_devices = fnLDA_GetDevInfo(working_devices);
+	close_devices(nr_active_devices, working_devices, 0);
+	exit(0);
+}
+
+/*
+ * manage termination signal, only wakes the shutdown thread
+ * @param sig: signal type
+ */
+void sighandler(int sig)
+{
+	char c = sig;
+
+	if (shutting_down)
+		return;
+	if (write(shutdown_pipe[1], &c, 1) != 1)
+		return;
+	/* abort() ends the program once the handler returns, wait instead */
+	if (sig == SIGABRT)
+		for (;;)
+			pause();
+}
+
+/*
+ * start the thread doing the shutdown on a termination signal
+ * @return: 0 on success, 1 on error
+ */
+int
+shutdown_start(void)
+{
+	pthread_t thread;
+
+	if (pipe(shutdown_pipe)
+	    || pthread_create(&thread, NULL, shutdown_loop, NULL)) {
+		printf(ERR "unable to start shutdown thread\n");
+		return 1;
+	}
+	pthread_detach(thread);
+	signal(SIGINT, sighandler);
+	signal(SIGTERM, sighandler);
+	signal(SIGABRT, sighandler);
+	return 0;
+}
+
+/*
+ * check if serial number flag is enabled
+ * @param argc: argument count
+ * @param argv: array of function arguments
+ * @return returns 1 if -n is set else 0
+ */
+int
+check_serial_number(int argc, char *argv[])
+{
+	int i = 0;
+	for (;i < argc; i++)
+		if (strncmp(argv[i], "-n", strlen(argv[i])) == 0)
+			return 1;
+	return 0;
+}
+
+/*
+ * check if info flag is enabled
+ * @param argc: argument count
+ * @param argv: array of function arguments
+ * @return returns 1 if -i is set else 0
+ */
+int
+check_info(int argc, char *argv[])
+{
+	int i = 0;
+	for (;i < argc; i++)
+		if (strncmp(argv[i], "-i", strlen(argv[i])) == 0)
+			return 1;
+	return 0;
+}
+
+/*
+ * check if the event loop engine is enabled
+ * @param argc: argument count
+ * @param argv: array of function arguments
+ * @return returns 1 if -ev is set else 0
+ */
+int
+check_evloop(int argc, char *argv[])
+{
+	int i = 0;
+	for (;i < argc; i++)
+		if (strncmp(argv[i], "-ev\0", strlen(argv[i]) + 1) == 0)
+			return 1;
+	return 0;
+}
+
+/*
+ * check if the fast device check is enabled
+ * @param argc: argument count
+ * @param argv: array of function arguments
+ * @return returns 1 if -fast-check is set else 0
+ */
+int
+check_fast(int argc, char *argv[])
+{
+	int i = 0;
+	for (;i < argc; i++)
+		if (strncmp(argv[i], "-fast-check\0", strlen(argv[i]) + 1) == 0)
+			return 1;
+	return 0;
+}
+
+/*
+ * check if the live status display is enabled
+ * @param argc: argument count
+ * @param argv: array of function arguments
+ * @return returns 1 if -live or -live-rate is set else 0
+ */
+int
+check_live(int argc, char *argv[])
+{
+	int i = 0;
+	for (;i < argc; i++)
+		if (strncmp(argv[i], "-live\0", strlen(argv[i]) + 1) == 0
+		    || strncmp(argv[i], "-live-rate\0", strlen(argv[i]) + 1) == 0)
+			return 1;
+	return 0;
+}
+
+/*
+ * check if the write latency compensation is enabled
+ * @param argc: argument count
+ * @param argv: array of function arguments
+ * @return returns 1 if -latcomp is set else 0
+ */
+int
+check_latcomp(int argc, char *argv[])
+{
+	int i = 0;
+	for (;i < argc; i++)
+		if (strncmp(argv[i], "-latcomp\0", strlen(argv[i]) + 1) == 0)
+			return 1;
+	return 0;
+}
+
+/*
+ * check if lost devices are brought back
+ * @param argc: argument count
+ * @param argv: array of function arguments
+ * @return returns 1 if -reconnect is set else 0
+ */
+int
+check_reconnect(int argc, char *argv[])
+{
+	int i = 0;
+	for (;i < argc; i++)
+		if (strncmp(argv[i], "-reconnect\0", strlen(argv[i]) + 1) == 0)
+			return 1;
+	return 0;
+}
+
+/*
+ * check if steps shorter than the device profile allows are merged
+ * @param argc: argument count
+ * @param argv: array of function arguments
+ * @return returns 1 if -merge is set else 0
+ */
+int
+check_merge(int argc, char *argv[])
+{
+	int i = 0;
+	for (;i < argc; i++)
+		if (strncmp(argv[i], "-merge\0", strlen(argv[i]) + 1) == 0)
+			return 1;
+	return 0;
+}
+
+/*
+ * get the timeline file of a simulation
+ * @param argc: argument count
+ * @param argv: array of function arguments
+ * @return: path given with -sim, NULL if it is not set
+ */
+char *
+get_sim_path(int argc, char *argv[])
+{
+	int i = 1;
+	for (;i < argc - 1; i++)
+		if (strncmp(argv[i], "-sim\0", strlen(argv[i]) + 1) == 0)
+			return argv[i + 1];
+	return NULL;
+}
+
+/*
+ * check if an option of the multi device mode takes a value
+ * @param arg: argument to check
+ * @return: 1 if the option is followed by a value else 0
+ */
+int
+multi_dev_option_has_value(char *arg)
+{
+	return strcmp(arg, "-init-workers") == 0
+	       || strcmp(arg, "-init-timeout") == 0
+	       || strcmp(arg, "-status") == 0
+	       || strcmp(arg, "-latoffset") == 0
+	       || strcmp(arg, "-verify") == 0
+	       || strcmp(arg, "-floor") == 0
+	       || strcmp(arg, "-sim") == 0
+	       || strcmp(arg, "-sim-drop") == 0
+	       || strcmp(arg, "-profile-dir") == 0
+	       || strcmp(arg, "-live-rate") == 0;
+}
+
+/*
+ * get numeric value of a multi device option
+ * @param argc: argument count
+ * @param argv: array of function arguments
+ * @param option: option name
+ * @param def: value used if the option is not set
+ * @return: value of the option
+ */
+unsigned int
+get_multi_dev_option(int argc, char *argv[], char *option, unsigned int def)
+{
+	int i;
+
+	for (i = 2; i < argc - 1; i++)
+		if (strcmp(argv[i], option) == 0)
+			return (unsigned int)atoi(argv[i + 1]);
+	return def;
+}
+
+/*
+ * get string value of a multi device option
+ * @param argc: argument count
+ * @param argv: array of function arguments
+ * @param option: option name
+ * @return: value of the option, NULL if it is not set
+ */
+char *
+get_multi_dev_string(int argc, char *argv[], char *option)
+{
+	int i;
+
+	for (i = 2; i < argc - 1; i++)
+		if (strcmp(argv[i], option) == 0)
+			return argv[i + 1];
+	return NULL;
+}
+
+/*
+ * collect config files given in multi device mode, options are skipped
+ * @param argc: argument count
+ * @param argv: arguments given by the user
+ * @param files: storage for at least argc file names
+ * @return: number of files found
+ */
+int
+get_multi_dev_files(int argc, char *argv[], char **files)
+{
+	int i, count = 0;
+
+	for (i = 2; i < argc; i++) {
+		if (argv[i][0] != '-')
+			files[count++] = argv[i];
+		else if (multi_dev_option_has_value(argv[i]))
+			i++;
+	}
+	return count;
+}
+
+/*
+ * play files on all devices with the event loop engine
+ * @param files: file for each device
+ * @param dev_ids: device id for each file
+ * @param count: number of files
+ * @param quiet: quiet flag
+ * @param lat_comp: 1 to issue steps early by the estimated write latency
+ * @param lat_offset: fixed write latency in us, 0 to estimate it
+ */
+void
+start_evloop(char **files, int *dev_ids, int count, int quiet,
+	     unsigned int lat_comp, unsigned long lat_offset)
+{
+	struct ev_device *devs;
+	int i;
+
+	devs = mem_calloc(count, sizeof(struct ev_device));
+	if (devs == NULL) {
+		printf(ERR "could not allocate memory for devices\n");
+		return;
+	}
+
+	for (i = 0; i < count; i++) {
+		devs[i].id = dev_ids[i];
+		devs[i].serial = fnLDA_GetSerialNumber(dev_ids[i]);
+		devs[i].path = files[i];
+		clear_userdata(&devs[i].ud);
+		devs[i].ud.lat_comp = lat_comp;
+		devs[i].ud.lat_offset = lat_offset;
+	}
+
+	if (!quiet)
+		printf(INFO "driving %d devices from a single event loop\n", count);
+	evloop_run(devs, count, quiet);
+	free(devs);
+}
+
+/*
+ * start thread for each active device
+ * @param argc: argument count
+ * @param argv: arguments given by the user
+ * @param file_serial_check: flag to parse serial number from filename
+ */
+void
+handle_multi_dev(int argc, char *argv[], int file_serial_check)
+{
+	struct thread_arguments args[MAXDEVICES];
+	pthread_t threads[MAXDEVICES];
+	unsigned int device_count = 0;
+	int length;
+	int i, nr_active_devices, file_count, ret, quiet, info, serial;
+	DEVID working_devices[MAXDEVICES];
+	DEVID id;
+	int dev_ids[MAXDEVICES];
+	DEVID usable[MAXDEVICES];
+	struct dev_init_result init_results[MAXDEVICES];
+	unsigned long long init_start, init_time;
+	int ok, nr_usable = 0, k;
+	char **files;
+	char device_name[MAX_MODELNAME];
+	char *status_name;
+	struct user_data monitor_ud;
+	void *status;
+	int live;
+
+	device_count = (unsigned int)fnLDA_GetNumDevices();
+
+	quiet = check_quiet(argc, argv);
+	info = check_info(argc, argv);
+
+	if (device_count == 0) {
+		printf(ERR "There is no attenuator connected\n");
+	} else if (device_count > 1 && !quiet) {
+			printf(INFO "There are %d attenuators connected\n", device_count);
+	} else if (!quiet) {
+			printf(INFO "There is %d attenuator connected\n", device_count);
+	}
+
+	nr_active_devices = fnLDA_GetDevInfo(working_devices);
+	if (!quiet) {
+		get_serial_and_name(device_count, device_name);
+		printf(INFO "%d active devices found\n", nr_active_devices);
+	}
+
+	/*
+	 * initiate and check devices
+	 */
+	init_start = time_now_ns();
+	ok = init_devices(working_devices, nr_active_devices,
+			  get_multi_dev_option(argc, argv, "-init-workers",
+					       DEFAULT_INIT_WORKERS),
+			  get_multi_dev_option(argc, argv, "-init-timeout",
+					       DEFAULT_INIT_TIMEOUT),
+			  check_fast(argc, argv), init_results);
+	init_time = time_now_ns() - init_start;
+
+	for (i = 0; i < nr_active_devices; i++) {
+		id = init_results[i].id;
+		serial = init_results[i].serial;
+
+		if (init_results[i].state == INIT_FAILED
+		    || init_results[i].state == INIT_TIMEOUT) {
+			printf(ERR "initialising device %d (serial %i) failed: %s\n",
+			       id, serial, init_results[i].message);
+			continue;
+		}
+
+		if (init_results[i].state == INIT_CHECK_FAILED) {
+			printf(ERR "check failed for device %d (serial %i)\n", id, serial);
+			printf(ERR "%s\n", init_results[i].message);
+		} else if (!quiet) {
+			printf(INFO "initialized device %d (serial %i) successfully "
+			       "(init %.1f ms, check %.1f ms)\n", id, serial,
+			       (double)init_results[i].init_time / NSEC_PER_MSEC,
+			       (double)init_results[i].check_time / NSEC_PER_MSEC);
+		}
+
+		if (info)
+			print_dev_info(id);
+	}
+
+	if (!quiet)
+		printf(INFO "initialized %d of %d devices in %.1f ms\n", ok,
+		       nr_active_devices, (double)init_time / NSEC_PER_MSEC);
+
+	files = mem_alloc(argc * sizeof(char *));
+	if (files == NULL) {
+		printf(ERR "could not allocate memory for file list\n");
+		return;
+	}
+	file_count = get_multi_dev_files(argc, argv, files);
+
+	/* failed and timed out devices get no file */
+	for (i = 0; i < nr_active_devices; i++)
+		if (init_results[i].state == INIT_OK)
+			usable[nr_usable++] = init_results[i].id;
+
+	/* check number of available files */
+	if (file_count > (file_serial_check ? nr_active_devices : nr_usable))
+		file_count = file_serial_check ? nr_active_devices : nr_usable;
+
+	for (i = 0; i < file_count; i++) {
+		if (file_serial_check) {
+			/* Get serial using filename */
+			int file_serial_int, tmp_id;
+			char file_serial[MAX_PATH_LENGTH];
+			if ((strlen(files[i]) - 4) >= MAX_PATH_LENGTH) {
+				length = MAX_PATH_LENGTH - 1;
+			} else {
+				length = strlen(files[i]) - 4;
+			}
+			strncpy(file_serial, files[i], length);
+			file_serial[length] = '\0';
+			file_serial_int = atoi(basename(file_serial));
+			tmp_id = get_id_by_serial(file_serial_int, device_count);
+			if (tmp_id < 0) {
+				printf(ERR "Filename %s not matching with any device\n", files[i]);
+				free(files);
+				close_devices(nr_active_devices,
+					      working_devices, quiet);
+				return;
+			}
+			for (k = 0; k < nr_usable; k++)
+				if ((int)usable[k] == tmp_id)
+					break;
+			if (k == nr_usable) {
+				printf(ERR "device for %s (serial %i) is not "
+				       "available\n", files[i], file_serial_int);
+				free(files);
+				close_devices(nr_active_devices,
+					      working_devices, quiet);
+				return;
+			}
+			dev_ids[i] = tmp_id;
+		} else {
+			dev_ids[i] = usable[i];
+		}
+	}
+
+	sim_start();
+	status_name = get_multi_dev_string(argc, argv, "-status");
+	live = check_live(argc, argv);
+	clear_userdata(&monitor_ud);
+	monitor_ud.quiet = quiet;
+	if (status_name)
+		strncpy(monitor_ud.status, status_name, MAX_LENGTH - 1);
+	monitor_ud.live = live;
+	monitor_ud.live_rate = get_multi_dev_option(argc, argv, "-live-rate",
+						    DEFAULT_LIVE_RATE);
+	monitor_ud.verify_rate = get_multi_dev_option(argc, argv, "-verify", 0);
+	monitor_ud.reconnect = check_reconnect(argc, argv);
+	if (monitors_start(&monitor_ud)) {
+		free(files);
+		close_devices(nr_active_devices, working_devices, quiet);
+		return;
+	}
+
+	if (check_evloop(argc, argv)) {
+		start_evloop(files, dev_ids, file_count, quiet || live,
+			     check_latcomp(argc, argv),
+			     get_multi_dev_option(argc, argv, "-latoffset", 0));
+		monitors_stop();
+		free(files);
+		close_devices(nr_active_devices, working_devices, quiet);
+		mem_report(quiet);
+		return;
+	}
+
+	/* every thread gets arguments of its own, no handoff needed */
+	for (i = 0; i < file_count; i++) {
+		args[i].path = files[i];
+		args[i].id = dev_ids[i];
+		args[i].live = live;
+		args[i].lat_comp = check_latcomp(argc, argv);
+		args[i].lat_offset = get_multi_dev_option(argc, argv,
+							  "-latoffset", 0);
+		args[i].merge = check_merge(argc, argv);
+		args[i].profile_dir = get_multi_dev_string(argc, argv,
+							   "-profile-dir");
+
+		time_sim_add(1);
+		ret = pthread_create(&threads[i], NULL, start_device, (void *)&args[i]);
+		if (ret) {
+			time_sim_add(-1);
+			printf(ERR "Failed to create thread! Error Code: %d\n", ret);
+		}
+	}
+
+	/* the threads play on the virtual clock without this one */
+	time_sim_leave();
+	for (i = 0; i < file_count; i++) {
+		ret = pthread_join(threads[i], &status);
+
+		if (ret)
+			printf(ERR "Failed to join thread! Error Code: %d\n", ret);
+	}
+
+	monitors_stop();
+	free(files);
+	close_devices(nr_active_devices, working_devices, quiet);
+	mem_report(quiet);
+	return;
+}
+
+/*
+ * handle single connected device
+ * @param ud: user data struct
+ * @param argc: argument count
+ * @param argv: arguments given by the user
+ * @param working_devices: array of active devices
+ * @param get_serial: check if we need to get device id from serial number
+ * return: 1 on success, 0 on error
+ */
+int
+handle_single_dev(struct user_data *ud, int argc, char *argv[], DEVID *working_devices,
+		  int get_serial, int device_count)
+{
+	int status, id, serial;
+	char message[64];
+	char *version;
+
+	clear_userdata(ud);
+
+	if (!get_parameters(argc, argv, ud)) {
+		printf(WARN "Usage: %s [options]\n", argv[0]);
+		call_help();
+		return 0;
+	}
+
+	if (get_serial) {
+		id = get_id_by_serial(ud->serial_number, device_count);
+		if (id < 0) {
+			printf(ERR "unable to find device with serial %i\n", ud->serial_number);
+			return 0;
+		}
+	} else {
+		id = SINGLE_DEV_ID;
+	}
+	
+	if (!ud->quiet) {
+		version = fnLDA_LibVersion();
+		printf(INFO "you are using libversion %s\n", version);
+	}
+
+	status = fnLDA_InitDevice(working_devices[id - 1]);
+	serial = fnLDA_GetSerialNumber(working_devices[id - 1]);
+
+	if (status != 0) {
+		printf(ERR "initialising device %d (serial %i) failed\n",
+		       id, serial);
+		return 0;
+	}
+	else
+		if (!ud->quiet)
+			printf(INFO "initialized device %d (serial %i) successfully\n",
+			       id, serial);
+
+	if (ud->info)
+		print_dev_info(id);
+
+	if (check_device(working_devices[id - 1], 0, message, MAX_MSG_SIZE) == 0) {
+		if (!ud->quiet)
+			printf(INFO "Successfully checked device\n");
+	} else {
+		printf(ERR "check failed for the device (serial %i)\n", serial);
+		printf(ERR "%s\n", message);
+		return 0;
+	}
+
+	sim_start();
+	if (ud->feed[0] && time_is_virtual()) {
+		printf(ERR "a measurement feed can not be simulated\n");
+		return 0;
+	}
+	if (monitors_start(ud))
+		return 0;
+
+	set_data(ud, id);
+	monitors_stop();
+	close_single_device(id, working_devices, ud->quiet);
+	mem_report(ud->quiet);
+	return 1;
+}
+
+/*
+ * check if the user wants to analyze a log instead of using a device
+ * @param argc: argument count
+ * @param argv: arguments passed to the program
+ * @return: 1 if -analyze is the first argument, else 0
+ */
+int
+check_analyze(int argc, char *argv[])
+{
+	return argc > 1 && strncmp(argv[1], "-analyze\0", strlen(argv[1]) + 1) == 0;
+}
+
+/*
+ * analyze a log written with -l, optionally against the schedule file
+ * given with -f. No device and no root access is needed.
+ * @param argc: argument count
+ * @param argv: arguments passed to the program
+ * @return: 0 on success, 1 on error
+ */
+int
+handle_analyze(int argc, char *argv[])
+{
+	struct user_data *ud;
+	struct schedule sched;
+	int ret;
+
+	if (argc < 3) {
+		printf(ERR "no log file to analyze specified\n");
+		return 1;
+	}
+
+	ud = allocate_user_data();
+	if (ud == NULL)
+		return 1;
+	clear_userdata(ud);
+	if (!get_parameters(argc, argv, ud)) {
+		free(ud);
+		return 1;
+	}
+
+	if (ud->file) {
+		if (schedule_load(ud->path, &sched, ud)) {
+			free(ud);
+			return 1;
+		}
+		ret = analyze_log(argv[2], &sched, ud);
+		schedule_free(&sched);
+	} else {
+		ret = analyze_log(argv[2], NULL, ud);
+	}
+
+	free(ud);
+	return ret;
+}
+
+/*
+ * check if the user wants to play a channel model
+ * @param argc: argument count
+ * @param argv: arguments passed to the program
+ * @return: 1 if -channel is the first argument, else 0
+ */
+int
+check_channel(int argc, char *argv[])
+{
+	return argc > 1 && strncmp(argv[1], "-channel\0", strlen(argv[1]) + 1) == 0;
+}
+
+/*
+ * play a channel model on the devices of its links, every device is
+ * found by the serial number given for its link
+ * @param argc: argument count
+ * @param argv: arguments passed to the program
+ * @return: 0 on success, 1 on error
+ */
+int
+handle_channel(int argc, char *argv[])
+{
+	struct channel_model *m;
+	struct user_data *ud;
+	struct dev_init_result init_results[MAXDEVICES];
+	DEVID working_devices[MAXDEVICES];
+	int ids[CHANNEL_MAX_LINKS];
+	int nr_active_devices, device_count, ret = 1;
+	unsigned int k;
+	int i;
+
+	if (argc < 3) {
+		printf(ERR "no channel model specified\n");
+		return 1;
+	}
+
+	ud = allocate_user_data();
+	m = mem_alloc(sizeof(struct channel_model));
+	if (ud == NULL || m == NULL) {
+		printf(ERR "could not allocate memory for channel model\n");
+		free(ud);
+		free(m);
+		return 1;
+	}
+	clear_userdata(ud);
+	if (!get_parameters(argc, argv, ud) || channel_load(argv[2], m, ud))
+		goto out;
+
+	device_count = fnLDA_GetNumDevices();
+	nr_active_devices = fnLDA_GetDevInfo(working_devices);
+	init_devices(working_devices, nr_active_devices, DEFAULT_INIT_WORKERS,
+		     DEFAULT_INIT_TIMEOUT, check_fast(argc, argv), init_results);
+
+	for (k = 0; k < m->links; k++) {
+		ids[k] = get_id_by_serial(m->serials[k], device_count);
+		for (i = 0; i < nr_active_devices; i++)
+			if (init_results[i].id == ids[k])
+				break;
+		if (ids[k] < 0 || i == nr_active_devices
+		    || init_results[i].state != INIT_OK) {
+			printf(ERR "device for link %u (serial %i) is not "
+			       "available\n", k + 1, m->serials[k]);
+			goto close;
+		}
+	}
+
+	sim_start();
+	if (monitors_start(ud))
+		goto close;
+
+	ret = channel_run(m, ids, ud);
+	monitors_stop();
+
+close:
+	close_devices(nr_active_devices, working_devices, ud->quiet);
+	mem_report(ud->quiet);
+	channel_free(m);
+out:
+	free(m);
+	free(ud);
+	return ret;
+}
+
+/*
+ * check if the user wants to play a batch manifest
+ * @param argc: argument count
+ * @param argv: arguments passed to the program
+ * @return: 1 if -batch is the first argument, else 0
+ */
+int
+check_batch(int argc, char *argv[])
+{
+	return argc > 1 && strncmp(argv[1], "-batch\0", strlen(argv[1]) + 1) == 0;
+}
+
+/*
+ * play all rounds of a batch manifest. Schedules and devices of all rounds
+ * are checked before the first one starts, devices stay open in between.
+ * @param argc: argument count
+ * @param argv: arguments passed to the program
+ * @return: 0 on success, 1 on error
+ */
+int
+handle_batch(int argc, char *argv[])
+{
+	struct batch b;
+	struct user_data *ud;
+	struct dev_init_result init_results[MAXDEVICES];
+	DEVID working_devices[MAXDEVICES];
+	int nr_active_devices, device_count, first = -1, ret = 1;
+	unsigned int k;
+	int i;
+
+	if (argc < 3) {
+		printf(ERR "no batch manifest specified\n");
+		return 1;
+	}
+
+	ud = allocate_user_data();
+	if (ud == NULL)
+		return 1;
+	clear_userdata(ud);
+	if (!get_parameters(argc, argv, ud)
+	    || batch_load(argv[2], &b, ud->quiet)) {
+		free(ud);
+		return 1;
+	}
+
+	device_count = fnLDA_GetNumDevices();
+	nr_active_devices = fnLDA_GetDevInfo(working_devices);
+	init_devices(working_devices, nr_active_devices, DEFAULT_INIT_WORKERS,
+		     DEFAULT_INIT_TIMEOUT, check_fast(argc, argv), init_results);
+	for (i = 0; i < nr_active_devices; i++)
+		if (init_results[i].state == INIT_OK) {
+			first = init_results[i].id;
+			break;
+		}
+
+	for (k = 0; k < b.count; k++) {
+		b.rounds[k].ud.live = ud->live;
+		if (b.rounds[k].serial == 0) {
+			b.rounds[k].id = first;
+			if (first < 0) {
+				printf(ERR "no device available for round %u\n",
+				       k + 1);
+				goto close;
+			}
+			continue;
+		}
+		b.rounds[k].id = get_id_by_serial(b.rounds[k].serial,
+						  device_count);
+		for (i = 0; i < nr_active_devices; i++)
+			if (init_results[i].id == b.rounds[k].id)
+				break;
+		if (b.rounds[k].id < 0 || i == nr_active_devices
+		    || init_results[i].state != INIT_OK) {
+			printf(ERR "device for round %u (serial %i) is not "
+			       "available\n", k + 1, b.rounds[k].serial);
+			goto close;
+		}
+	}
+
+	/* rounds play one after the other, the bus is not shared */
+	for (k = 0; k < b.count; k++) {
+		if (b.rounds[k].ud.file)
+			profile_schedule(b.rounds[k].id, b.rounds[k].ud.path,
+					 &b.rounds[k].sched, &b.rounds[k].ud, 0);
+		else if (b.rounds[k].ud.ramp || b.rounds[k].ud.triangle)
+			profile_form(b.rounds[k].id, &b.rounds[k].ud);
+	}
+
+	sim_start();
+	if (monitors_start(ud))
+		goto close;
+
+	ret = batch_run(&b, ud->quiet);
+	monitors_stop();
+
+close:
+	close_devices(nr_active_devices, working_devices, ud->quiet);
+	mem_report(ud->quiet);
+	batch_free(&b);
+	free(ud);
+	return ret;
+}
+
+/*
+ * check if the user wants to calibrate the devices
+ * @param argc: argument count
+ * @param argv: arguments passed to the program
+ * @return: 1 if -calibrate is the first argument, else 0
+ */
+int
+check_calibrate(int argc, char *argv[])
+{
+	return argc > 1
+	       && strncmp(argv[1], "-calibrate\0", strlen(argv[1]) + 1) == 0;
+}
+
+/*
+ * measure all connected devices alone and together and write a profile
+ * for each of them
+ * @param argc: argument count
+ * @param argv: arguments passed to the program
+ * @return: 0 on success, 1 on error
+ */
+int
+handle_calibrate(int argc, char *argv[])
+{
+	struct dev_init_result init_results[MAXDEVICES];
+	DEVID working_devices[MAXDEVICES], ids[MAXDEVICES];
+	unsigned long samples;
+	char *dir;
+	int nr_active_devices, count = 0, quiet, ret;
+	int i;
+
+	quiet = check_quiet(argc, argv);
+	samples = get_multi_dev_option(argc, argv, "-cal-writes",
+				       DEFAULT_CAL_WRITES);
+	dir = get_multi_dev_string(argc, argv, "-profile-dir");
+	if (samples == 0) {
+		printf(ERR "number of writes has to be above 0\n");
+		return 1;
+	}
+
+	nr_active_devices = fnLDA_GetDevInfo(working_devices);
+	init_devices(working_devices, nr_active_devices, DEFAULT_INIT_WORKERS,
+		     DEFAULT_INIT_TIMEOUT, check_fast(argc, argv), init_results);
+	for (i = 0; i < nr_active_devices; i++)
+		if (init_results[i].state == INIT_OK)
+			ids[count++] = init_results[i].id;
+	if (count == 0) {
+		printf(ERR "There is no attenuator connected\n");
+		close_devices(nr_active_devices, working_devices, quiet);
+		return 1;
+	}
+
+	ret = calibrate_run(ids, count, samples, dir, quiet);
+	close_devices(nr_active_devices, working_devices, quiet);
+	mem_report(quiet);
+	return ret;
+}
+
+/*
+ * check if the user wants a dry run without devices
+ * @param argc: argument count
+ * @param argv: arguments passed to the program
+ * @return: 1 if -dry-run is set, else 0
+ */
+int
+check_dry_run(int argc, char *argv[])
+{
+	int i = 0;
+	for (;i < argc; i++)
+		if (strncmp(argv[i], "-dry-run\0", strlen(argv[i]) + 1) == 0)
+			return 1;
+	return 0;
+}
+
+/*
+ * predict the timeline of an invocation without touching a device
+ * @param argc: argument count
+ * @param argv: arguments passed to the program
+ * @return: 0 on success, 1 on error
+ */
+int
+handle_dry_run(int argc, char *argv[])
+{
+	struct user_data *ud;
+	char **files;
+	int count, ret;
+
+	if (argc > 1 && check_multi_device(argv)) {
+		files = mem_alloc(argc * sizeof(char *));
+		if (files == NULL)
+			return 1;
+		count = get_multi_dev_files(argc, argv, files);
+		ret = plan_multi(files, count, get_multi_dev_option(argc, argv,
+				 "-floor", DEFAULT_FLOOR), check_quiet(argc, argv));
+		free(files);
+		return ret;
+	}
+
+	ud = allocate_user_data();
+	if (ud == NULL)
+		return 1;
+	clear_userdata(ud);
+	ret = get_parameters(argc, argv, ud) ? plan_single(ud) : 1;
+	free(ud);
+	return ret;
+}
+
+/*
+ * returns 0 on success, 1 on error
+ */
+int
+main(int argc, char *argv[])
+{
+	int device_count, get_serial, mdc = 0;
+	int nr_active_devices, quiet;
+	DEVID working_devices[MAXDEVICES];
+	char device_name[MAX_MODELNAME];
+	char *sim;
+	int i, res;
+
+	/* log analysis works offline, without devices and root access */
+	if (check_analyze(argc, argv))
+		exit(handle_analyze(argc, argv));
+
+	/* a dry run only reads files, like the log analysis */
+	if (check_dry_run(argc, argv))
+		exit(handle_dry_run(argc, argv));
+
+	/* get the uid of caller */
+	uid_t uid = geteuid();
+	fnLDA_Init();
+
+	/* a simulation plays on the test mode devices of the library */
+	sim = get_sim_path(argc, argv);
+	fnLDA_SetTestMode(sim ? TRUE : FALSE);
+	quiet = check_quiet(argc, argv);
+
+	if (sim && sim_open(sim))
+		exit(1);
+	for (i = 1; sim && i < argc - 1; i++)
+		if (strncmp(argv[i], "-sim-drop\0", strlen(argv[i]) + 1) == 0
+		    && sim_drop(argv[++i]))
+			exit(1);
+
+	if (uid != 0 && sim == NULL) {
+		printf(ERR "This tool needs to be run as root to access USB ports\n");
+		printf("Please run again as root\n");
+		exit(1);
+	}
+
+	if (argc < 2) {
+		printf(ERR "Usage: %s [options]\n", argv[0]);
+		call_help();
+		exit(1);
+	}
+
+	if ((strncmp(argv[1], "-h", strlen(argv[1]))) == 0) {
+		call_help();
+		exit(0);
+	}
+
+	/* Manage termination signal */
+	if (shutdown_start())
+		exit(1);
+
+	if (check_channel(argc, argv))
+		exit(handle_channel(argc, argv));
+
+	if (check_batch(argc, argv))
+		exit(handle_batch(argc, argv));
+
+	if (check_calibrate(argc, argv))
+		exit(handle_calibrate(argc, argv));
+
+	mdc = check_multi_device(argv);
+	if (mdc) {
+		if (!quiet)
+			printf(INFO "multidevice support enabled\n");
+		if (mdc == 2)
+			handle_multi_dev(argc, argv, 1);
+		else
+			handle_multi_dev(argc, argv, 0);
+		exit(0);
+	}
+
+	struct user_data *ud = allocate_user_data();
+	if (ud == NULL)
+		exit(1);
+	device_count = fnLDA_GetNumDevices();
+
+	if (device_count == 0) {
+		printf(ERR "There is no attenuator connected\n");
+	} else if (device_count > 1) {
+		if (!quiet)
+			printf(INFO "There are %d attenuators connected\n", device_count);
+	} else {
+		if (!quiet)
+			printf(INFO "There is %d attenuator connected\n", device_count);
+	}
+
+	if (!quiet)
+		get_serial_and_name(device_count, device_name);
+
+	nr_active_devices = fnLDA_GetDevInfo(working_devices);
+	if (!quiet)
+		printf(INFO "%d active device(s) found\n", nr_active_devices);
+
+	get_serial = check_serial_number(argc, argv);
+	res = handle_single_dev(ud, argc, argv, working_devices, get_serial,
+				device_count);
+
+	free(ud);
+	return res ? 0 : 1;
+}
@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <malloc.h>
+#include <sys/resource.h>
+#include "mem.h"
+#include "control.h"
+
+/*
+ * counts of the allocations done through the functions below, memory is
+ * released with free(). Every allocation of the program is done at load
+ * time, so the counts do not grow with the length of a playback. Those of
+ * libraries like the SDK or stdio are not counted, the heap in use is
+ * reported from the C library where it is known.
+ */
+static unsigned long allocations;
+static unsigned long long allocated;
+
+/*
+ * allocate memory and count it
+ * @param size: size in bytes
+ * @return: memory, NULL if out of memory
+ */
+void *
+mem_alloc(size_t size)
+{
+	__sync_fetch_and_add(&allocations, 1);
+	__sync_fetch_and_add(&allocated, size);
+	return malloc(size);
+}
+
+/*
+ * allocate zeroed memory for an array and count it
+ * @param count: number of elements
+ * @param size: size of an element in bytes
+ * @return: memory, NULL if out of memory
+ */
+void *
+mem_calloc(size_t count, size_t size)
+{
+	__sync_fetch_and_add(&allocations, 1);
+	__sync_fetch_and_add(&allocated, count * size);
+	return calloc(count, size);
+}
+
+/*
+ * resize memory, counted as a new allocation of the full size
+ * @param ptr: memory to resize, may be NULL
+ * @param size: new size in bytes
+ * @return: memory, NULL if out of memory
+ */
+void *
+mem_realloc(void *ptr, size_t size)
+{
+	__sync_fetch_and_add(&allocations, 1);
+	__sync_fetch_and_add(&allocated, size);
+	return realloc(ptr, size);
+}
+
+/*
+ * print the peak resident set size, the allocations of the program so far
+ * and the heap in use of the whole process
+ * @param quiet: 1 to print nothing
+ */
+void
+mem_report(int quiet)
+{
+	struct rusage ru;
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+	struct mallinfo2 mi;
+#endif
+
+	if (quiet || getrusage(RUSAGE_SELF, &ru))
+		return;
+	printf(INFO "peak RSS %ld KiB, %lu program allocations, %llu KiB in "
+	       "total\n", ru.ru_maxrss, allocations, (allocated + 1023) / 1024);
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+	mi = mallinfo2();
+	printf(INFO "heap in use %zu KiB\n", (mi.uordblks + mi.hblkhd + 1023)
+	       / 1024);
+#endif
+}
@@ -0,0 +1,11 @@
+#ifndef _MEM_H_
+#define _MEM_H_
+
+#include <stddef.h>
+
+void *mem_alloc(size_t size);
+void *mem_calloc(size_t count, size_t size);
+void *mem_realloc(void *ptr, size_t size);
+void mem_report(int quiet);
+
+#endif
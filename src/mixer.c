@@ -0,0 +1,509 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include "mixer.h"
+#include "blockring.h"
+#include "mem.h"
+#include "keyframe.h"
+#include "status.h"
+#include "timing.h"
+#include "control.h"
+#include "LDAhid.h"
+
+#define LINE_LENGTH 512
+#define MAX_VALUES 4
+
+struct mix_block
+{
+	unsigned int count;
+	struct mix_event events[MIX_BLOCK];
+};
+
+/*
+ * state shared by the mixer thread and the playback. run, t, last and
+ * ended belong to the mixer.
+ */
+struct mix_player
+{
+	struct mix *mx;
+	int resolution;
+	int min;
+	int max;
+	struct block_ring ring;
+	unsigned int runs;
+	int cont;
+	unsigned int run;
+	unsigned long long t;
+	int last;
+	int ended;
+	unsigned long updates;
+};
+
+/*
+ * read the values of a row into an array
+ * @return: number of values read
+ */
+static unsigned int
+read_values(char **pos, double *values, unsigned int max)
+{
+	unsigned int count = 0;
+	char *end;
+
+	while (count < max) {
+		values[count] = strtod(*pos, &end);
+		if (end == *pos)
+			break;
+		*pos = end;
+		count++;
+	}
+	return count;
+}
+
+/*
+ * set up a ramp or triangle layer
+ * @return: 0 on success, 1 if start and end are equal, 2 if the step time
+ * rounds to 0 ns
+ */
+static int
+init_form(struct mix_layer *l, double *values, unsigned long long unit)
+{
+	int start, end, step;
+
+	start = (int)(values[0] * MULTIPLIER_STEP);
+	end = (int)(values[1] * MULTIPLIER_STEP);
+	step = (int)(values[2] * MULTIPLIER_STEP);
+	if (step <= 0 || abs(end - start) / step == 0)
+		return 1;
+
+	l->start_att = start;
+	l->step = end > start ? step : -step;
+	l->nr_steps = abs(end - start) / step;
+	l->period = (unsigned long long)(values[3] * unit + 0.5);
+	/* like set_ramp() and set_triangle(), the last step is held as well */
+	if (l->type == LAYER_RAMP)
+		l->length = (l->nr_steps + 1) * l->period;
+	else
+		l->length = (2 * l->nr_steps + 1) * l->period;
+	return l->period == 0 ? 2 : 0;
+}
+
+/*
+ * read a mix file, every row adds a layer:
+ * file <path>                                  - steps of a .csv file
+ * ramp|triangle <start dB> <end dB> <step dB> <time> - a step every <time>
+ * fading <Doppler Hz> <samples per second> [sinusoids [seed]] - Rayleigh
+ * offset <dB>                                  - constant attenuation
+ * length <time>                                - time of a run
+ * Times are given in the time unit set by the user, a .csv file may set its
+ * own. Empty rows and text after '#' are skipped.
+ * @param path: path to mix file
+ * @param mx: mix to fill
+ * @param ud: user data struct
+ * @return: 0 on success, 1 on error
+ */
+int
+mix_load(char *path, struct mix *mx, struct user_data *ud)
+{
+	FILE *fp;
+	char line[LINE_LENGTH];
+	char *pos, *end;
+	double values[MAX_VALUES];
+	struct mix_layer *l;
+	struct user_data unit;
+	unsigned long long unit_ns, length;
+	unsigned int nr_line = 0, count, k;
+
+	memset(mx, 0, sizeof(struct mix));
+	unit_ns = time_unit_ns(ud);
+	length = 0;
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		printf(ERR "unable to open mix file for reading: %s\n", path);
+		return 1;
+	}
+
+	while (fgets(line, LINE_LENGTH, fp)) {
+		nr_line++;
+		if ((pos = strchr(line, '#')))
+			*pos = '\0';
+		pos = line;
+		while (isspace((unsigned char)*pos))
+			pos++;
+		for (end = pos + strlen(pos); end > pos
+		     && isspace((unsigned char)end[-1]); end--)
+			end[-1] = '\0';
+		if (*pos == '\0')
+			continue;
+
+		if (strncmp(pos, "length ", 7) == 0) {
+			pos += 7;
+			if (read_values(&pos, values, 1) != 1 || values[0] <= 0)
+				goto malformed;
+			length = (unsigned long long)(values[0] * unit_ns + 0.5);
+			continue;
+		}
+		if (mx->count == MIX_MAX_LAYERS) {
+			printf(ERR "%s:%u: more than %d layers\n", path, nr_line,
+			       MIX_MAX_LAYERS);
+			goto error;
+		}
+		l = &mx->layers[mx->count];
+
+		if (strncmp(pos, "file ", 5) == 0) {
+			for (pos += 5; isspace((unsigned char)*pos); pos++)
+				;
+			unit = *ud;
+			if (schedule_load(pos, &l->sched, &unit))
+				goto error;
+			if (l->sched.count == 0) {
+				printf(ERR "%s:%u: %s holds no steps\n", path,
+				       nr_line, pos);
+				schedule_free(&l->sched);
+				goto error;
+			}
+			l->type = LAYER_FILE;
+			l->length = l->sched.length;
+		} else if (strncmp(pos, "ramp ", 5) == 0
+			   || strncmp(pos, "triangle ", 9) == 0) {
+			l->type = pos[0] == 'r' ? LAYER_RAMP : LAYER_TRIANGLE;
+			pos = strchr(pos, ' ');
+			if (read_values(&pos, values, 4) != 4 || values[3] <= 0)
+				goto malformed;
+			switch (init_form(l, values, unit_ns)) {
+			case 1:
+				printf(ERR "%s:%u: start and end attenuation are "
+				       "equal\n", path, nr_line);
+				goto error;
+			case 2:
+				printf(ERR "%s:%u: step time rounds to 0 ns\n",
+				       path, nr_line);
+				goto error;
+			}
+		} else if (strncmp(pos, "fading ", 7) == 0) {
+			pos += 7;
+			count = read_values(&pos, values, 4);
+			if (count < 2 || values[0] < 0 || values[1] <= 0
+			    || values[1] > NSEC_PER_SEC
+			    || (count > 2 && (values[2] < 1
+					      || values[2] > CHANNEL_MAX_SINUSOIDS)))
+				goto malformed;
+			l->fading = mem_alloc(sizeof(struct channel_model));
+			if (l->fading == NULL) {
+				printf(ERR "could not allocate memory for fading\n");
+				goto error;
+			}
+			channel_single(l->fading, values[0],
+				       count > 2 ? (unsigned int)values[2]
+						 : DEFAULT_SINUSOIDS,
+				       count > 3 ? (unsigned long long)values[3] : 1);
+			l->type = LAYER_FADING;
+			l->period = (unsigned long long)(NSEC_PER_SEC / values[1]);
+		} else if (strncmp(pos, "offset ", 7) == 0) {
+			pos += 7;
+			if (read_values(&pos, values, 1) != 1)
+				goto malformed;
+			l->type = LAYER_OFFSET;
+			l->value = values[0] * MULTIPLIER_STEP;
+		} else {
+			goto malformed;
+		}
+		mx->count++;
+	}
+	fclose(fp);
+
+	if (mx->count == 0) {
+		printf(ERR "%s: no layer defined\n", path);
+		mix_free(mx);
+		return 1;
+	}
+	mx->length = length;
+	for (k = 0; length == 0 && k < mx->count; k++)
+		if (mx->layers[k].length > mx->length)
+			mx->length = mx->layers[k].length;
+	if (mx->length == 0) {
+		printf(ERR "%s: fading and offset need a length\n", path);
+		mix_free(mx);
+		return 1;
+	}
+	return 0;
+
+malformed:
+	printf(ERR "%s:%u: malformed row\n", path, nr_line);
+error:
+	fclose(fp);
+	mix_free(mx);
+	return 1;
+}
+
+/*
+ * value of a layer at a point in time of a run
+ * @param l: layer
+ * @param t: time since the start of the run
+ * @param base: start of the run, fading does not repeat with the runs
+ * @return: attenuation in MULTIPLIER_STEP units
+ */
+static double
+layer_value(struct mix_layer *l, unsigned long long t, unsigned long long base)
+{
+	struct schedule *s = &l->sched;
+	double fade[CHANNEL_MAX_LINKS];
+	unsigned long long k;
+
+	switch (l->type) {
+	case LAYER_FILE:
+		while (l->index + 1 < s->count
+		       && s->entries[l->index + 1].start <= t)
+			l->index++;
+		return s->entries[l->index].attenuation;
+	case LAYER_RAMP:
+		k = t / l->period;
+		if (k > (unsigned long long)l->nr_steps)
+			k = l->nr_steps;
+		return l->start_att + (double)k * l->step;
+	case LAYER_TRIANGLE:
+		k = t / l->period;
+		if (k > 2ULL * l->nr_steps)
+			k = 2 * l->nr_steps;
+		if (k > (unsigned long long)l->nr_steps)
+			k = 2 * l->nr_steps - k;
+		return l->start_att + (double)k * l->step;
+	case LAYER_FADING:
+		k = t / l->period;
+		channel_fading(l->fading, (double)(base + k * l->period)
+			       / NSEC_PER_SEC, fade);
+		/* a fade is a loss of power, it adds to the attenuation */
+		return -fade[0] * MULTIPLIER_STEP;
+	default:
+		return l->value;
+	}
+}
+
+/*
+ * time of the next update of a layer, layer_value() has to be called for
+ * t before
+ * @return: time since the start of the run, ~0 if there is none
+ */
+static unsigned long long
+layer_next(struct mix_layer *l, unsigned long long t)
+{
+	unsigned long long k, last;
+
+	switch (l->type) {
+	case LAYER_FILE:
+		if (l->index + 1 < l->sched.count)
+			return l->sched.entries[l->index + 1].start;
+		return ~0ULL;
+	case LAYER_RAMP:
+	case LAYER_TRIANGLE:
+		k = t / l->period;
+		last = l->type == LAYER_RAMP ? l->nr_steps : 2 * l->nr_steps;
+		return k < last ? (k + 1) * l->period : ~0ULL;
+	case LAYER_FADING:
+		return (t / l->period + 1) * l->period;
+	default:
+		return ~0ULL;
+	}
+}
+
+/*
+ * mix the layers into a block of changes. The sum is taken whenever a
+ * layer updates, it is clamped to the device limits and rounded to its
+ * resolution. Sums equal to the last change are dropped.
+ * @return: 1 if the last run ended, else 0
+ */
+static int
+fill_block(void *arg, void *block, unsigned long nr)
+{
+	struct mix_player *p = arg;
+	struct mix_block *b = block;
+	struct mix *mx = p->mx;
+	unsigned long long base, next, n;
+	double sum;
+	unsigned int k;
+	int value;
+
+	b->count = 0;
+	while (b->count < MIX_BLOCK && !p->ended) {
+		base = p->run * mx->length;
+		if (p->t >= mx->length) {
+			p->run++;
+			if (!p->cont && p->run >= p->runs) {
+				b->events[b->count].time = base + mx->length;
+				b->events[b->count++].value = MIX_END;
+				p->ended = 1;
+				break;
+			}
+			p->t = 0;
+			for (k = 0; k < mx->count; k++)
+				mx->layers[k].index = 0;
+			continue;
+		}
+
+		sum = 0;
+		next = mx->length;
+		for (k = 0; k < mx->count; k++) {
+			sum += layer_value(&mx->layers[k], p->t, base);
+			n = layer_next(&mx->layers[k], p->t);
+			if (n < next)
+				next = n;
+		}
+		p->updates++;
+		value = quantize(sum, p->resolution, p->min, p->max);
+		if (value != p->last) {
+			b->events[b->count].time = base + p->t;
+			b->events[b->count++].value = value;
+			p->last = value;
+		}
+		p->t = next;
+	}
+	return p->ended;
+}
+
+/*
+ * get the change after the one at position i of a block, if it is mixed
+ * already
+ */
+static struct mix_event *
+peek_event(struct mix_player *p, unsigned long block, unsigned int i)
+{
+	struct mix_block *b = blockring_block(&p->ring, block);
+
+	if (i < b->count)
+		return &b->events[i];
+	if (block + 1 < p->ring.produced) {
+		b = blockring_block(&p->ring, block + 1);
+		return &b->events[0];
+	}
+	return NULL;
+}
+
+/*
+ * play a mix on a device. The layers are mixed by a worker thread ahead of
+ * time into a ring of changes, the playback only writes them at their
+ * deadlines. A change is dropped if the next one is due as well. If the
+ * worker falls behind, the playback polls for it instead of mixing.
+ * @param id: device id
+ * @param mx: mix
+ * @param ud: user data struct
+ * @return: 0 on success, 1 on error
+ */
+int
+mix_run(int id, struct mix *mx, struct user_data *ud)
+{
+	struct mix_player p;
+	struct mix_block *b;
+	struct mix_event *e, *next;
+	unsigned long long start, deadline, issue, now, late, max_late = 0;
+	unsigned long long tolerance, pause;
+	unsigned long block = 0, writes = 0, missed = 0, dropped = 0;
+	unsigned long underruns = 0;
+	unsigned int i = 0;
+	double speed;
+
+	memset(&p, 0, sizeof(struct mix_player));
+	p.mx = mx;
+	p.resolution = fnLDA_GetDevResolution(id);
+	if (p.resolution <= 0)
+		p.resolution = 1;
+	p.min = fnLDA_GetMinAttenuation(id);
+	p.max = fnLDA_GetMaxAttenuation(id);
+	p.runs = ud->runs;
+	p.cont = ud->cont;
+	p.last = MIX_END;
+	speed = ud->speed > 0 ? ud->speed : 1;
+	pause = (unsigned long long)(MIX_POLL_NS / speed);
+	tolerance = (unsigned long long)ud->tolerance * NSEC_PER_USEC;
+
+	if (blockring_start(&p.ring, MIX_BLOCKS, sizeof(struct mix_block),
+			    pause, fill_block, &p)) {
+		printf(ERR "unable to start mixer thread\n");
+		return 1;
+	}
+
+	if (!ud->quiet)
+		printf(INFO "mixing %u layers, %.3f s per run\n", mx->count,
+		       (double)mx->length / NSEC_PER_SEC);
+
+	start = time_now_ns();
+	for (;;) {
+		if (block >= p.ring.produced) {
+			if (p.ring.done && block >= p.ring.produced)
+				break;
+			underruns++;
+			time_sleep_until_ns(time_now_ns() + pause);
+			continue;
+		}
+		__sync_synchronize();
+		b = blockring_block(&p.ring, block);
+		if (i == b->count) {
+			block++;
+			i = 0;
+			__sync_synchronize();
+			p.ring.consumed = block;
+			continue;
+		}
+
+		e = &b->events[i++];
+		deadline = start + (unsigned long long)(e->time / speed);
+		if (e->value == MIX_END) {
+			time_sleep_until_ns(deadline);
+			break;
+		}
+		/* a change overtaken by the next one is not written anymore */
+		next = peek_event(&p, block, i);
+		if (next && next->value != MIX_END && start
+		    + (unsigned long long)(next->time / speed) <= time_now_ns()) {
+			dropped++;
+			continue;
+		}
+
+		issue = deadline - write_lead(id, ud);
+		time_sleep_until_ns(issue);
+		now = time_now_ns();
+		late = now > issue ? now - issue : 0;
+		if (late > tolerance)
+			missed++;
+		if (late > max_late)
+			max_late = late;
+		write_attenuation(id, e->value);
+		log_attenuation(e->value, ud);
+		write_residual(id, writes, deadline, ud);
+		status_late(id, late, late > tolerance, 0);
+		/* a change which is not mixed yet may be due any time */
+		next = peek_event(&p, block, i);
+		if (next == NULL)
+			status_step(id, writes, 0, time_now_ns());
+		else
+			status_step(id, writes, 0, next->value == MIX_END ? 0
+				    : start + (unsigned long long)(next->time
+								    / speed));
+		writes++;
+	}
+
+	blockring_stop(&p.ring);
+
+	if (!ud->quiet)
+		printf(INFO "mixed %lu updates into %lu writes, %lu late, %lu "
+		       "overtaken, %lu waits for the mixer, max lateness "
+		       "%.3f ms\n", p.updates, writes, missed, dropped,
+		       underruns, (double)max_late / NSEC_PER_MSEC);
+	return 0;
+}
+
+/*
+ * release the layers of a mix
+ */
+void
+mix_free(struct mix *mx)
+{
+	unsigned int k;
+
+	for (k = 0; k < mx->count; k++) {
+		schedule_free(&mx->layers[k].sched);
+		free(mx->layers[k].fading);
+		mx->layers[k].fading = NULL;
+	}
+	mx->count = 0;
+}
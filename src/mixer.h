@@ -0,0 +1,66 @@
+#ifndef _MIXER_H_
+#define _MIXER_H_
+
+#include "input.h"
+#include "schedule.h"
+#include "channel.h"
+
+#define MIX_MAX_LAYERS 8
+#define MIX_BLOCK 256
+#define MIX_BLOCKS 8
+#define MIX_END -1
+/* sleep of the mixer when the ring is full, and of the playback when empty */
+#define MIX_POLL_NS 1000000ULL
+
+#define LAYER_FILE 0
+#define LAYER_RAMP 1
+#define LAYER_TRIANGLE 2
+#define LAYER_FADING 3
+#define LAYER_OFFSET 4
+
+/*
+ * source of attenuation mixed with others. Every layer holds its value
+ * until its next update, values are in MULTIPLIER_STEP units.
+ * @period: step time of ramp and triangle, sample time of fading
+ * @length: time of a run of the layer, 0 if it never ends
+ */
+struct mix_layer
+{
+	int type;
+	struct schedule sched;
+	unsigned long index;
+	int start_att;
+	int step;
+	int nr_steps;
+	double value;
+	unsigned long long period;
+	unsigned long long length;
+	struct channel_model *fading;
+};
+
+/*
+ * layers summed in dB on one device. A run lasts as long as the longest
+ * layer unless length is set.
+ */
+struct mix
+{
+	struct mix_layer layers[MIX_MAX_LAYERS];
+	unsigned int count;
+	unsigned long long length;
+};
+
+/*
+ * change of the mixed attenuation, time is counted from the start of the
+ * first run. MIX_END as value marks the end of the last run.
+ */
+struct mix_event
+{
+	unsigned long long time;
+	int value;
+};
+
+int mix_load(char *path, struct mix *mx, struct user_data *ud);
+int mix_run(int id, struct mix *mx, struct user_data *ud);
+void mix_free(struct mix *mx);
+
+#endif
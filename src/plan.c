@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "plan.h"
+#include "mem.h"
+#include "timing.h"
+#include "control.h"
+
+/*
+ * follow the steps of a schedule like schedule_play() does, every entry is
+ * a write to the device
+ * @param p: plan to fill
+ * @param s: schedule
+ * @param speed: playback speed
+ * @param floor: shortest achievable step in nanoseconds
+ */
+static void
+plan_schedule(struct plan *p, struct schedule *s, double speed,
+	      unsigned long long floor)
+{
+	unsigned long long interval;
+	unsigned long i;
+
+	p->steps = s->count;
+	p->duration = (unsigned long long)(s->length / speed);
+	p->min_interval = ~0ULL;
+	for (i = 0; i < s->count; i++) {
+		interval = (unsigned long long)(s->entries[i].duration / speed);
+		if (interval < p->min_interval)
+			p->min_interval = interval;
+		if (interval < floor)
+			p->below_floor++;
+	}
+}
+
+/*
+ * count the writes of set_ramp() or set_triangle() without asking a
+ * device for its limits
+ * @param p: plan to fill
+ * @param ud: user data struct
+ * @param floor: shortest achievable step in nanoseconds
+ * @return: 0 on success, 1 on error
+ */
+static int
+plan_form(struct plan *p, struct user_data *ud, unsigned long long floor)
+{
+	unsigned long long step;
+	int nr_steps, span;
+
+	span = abs(ud->end_att - ud->start_att);
+	if (ud->ramp_steps > span)
+		ud->ramp_steps = span;
+	if (ud->ramp_steps <= 0 || (nr_steps = calc_nr_steps(ud)) == 0) {
+		printf(ERR "start and end attenuation are equal\n");
+		return 1;
+	}
+
+	step = ud->atime * time_unit_ns(ud);
+	p->min_interval = step;
+	if (ud->ramp) {
+		p->steps = nr_steps + 1;
+		p->duration = (nr_steps + 1) * step;
+		p->below_floor = step < floor ? nr_steps : 0;
+	} else {
+		/* the triangle ends at its start and writes it once more */
+		p->steps = 2 * nr_steps + 2;
+		p->duration = (2 * nr_steps + 1) * step;
+		p->min_interval = 0;
+		p->below_floor = (step < floor ? 2 * nr_steps : 0) + 1;
+	}
+	return 0;
+}
+
+/*
+ * print the timeline of a device
+ */
+static void
+plan_print(struct plan *p, unsigned long floor)
+{
+	printf(INFO "%s: %lu steps in %.3f s per run, ", p->name, p->steps,
+	       (double)p->duration / NSEC_PER_SEC);
+	if (p->cont)
+		printf("repeated until stopped\n");
+	else
+		printf("%u run(s), %.3f s in total\n", p->runs,
+		       (double)p->duration * p->runs / NSEC_PER_SEC);
+	printf(INFO "%s: shortest step %.3f ms, %.1f writes/s\n", p->name,
+	       (double)p->min_interval / NSEC_PER_MSEC,
+	       p->duration ? (double)p->steps * NSEC_PER_SEC / p->duration : 0);
+	if (p->below_floor)
+		printf(WARN "%s: %lu steps per run are shorter than %lu us\n",
+		       p->name, p->below_floor, floor);
+}
+
+/*
+ * predict what a -f, -ramp or -triangle invocation does without any device
+ * access. The file is read with the same code as for playback.
+ * @param ud: user data struct
+ * @return: 0 on success, 1 on error
+ */
+int
+plan_single(struct user_data *ud)
+{
+	struct plan p;
+	unsigned long long floor;
+	double speed;
+
+	memset(&p, 0, sizeof(struct plan));
+	floor = (unsigned long long)ud->floor * NSEC_PER_USEC;
+	speed = ud->speed > 0 ? ud->speed : 1;
+	p.runs = ud->runs;
+	p.cont = ud->cont;
+
+	if (ud->file) {
+		p.name = ud->path;
+		if (schedule_load(ud->path, &p.sched, ud))
+			return 1;
+		plan_schedule(&p, &p.sched, speed, floor);
+		schedule_free(&p.sched);
+	} else if (ud->ramp || ud->triangle) {
+		p.name = ud->ramp ? "ramp" : "triangle";
+		if (plan_form(&p, ud, floor))
+			return 1;
+	} else if (ud->simple) {
+		p.name = "attenuation";
+		p.steps = 1;
+		p.duration = ud->atime * time_unit_ns(ud);
+		p.min_interval = p.duration;
+		p.runs = 1;
+		p.cont = 0;
+	} else {
+		printf(ERR "a dry run supports -a, -f, -ramp, -triangle and "
+		       "-md\n");
+		return 1;
+	}
+
+	plan_print(&p, ud->floor);
+	return 0;
+}
+
+/*
+ * predict the -md playback of files on several devices. Besides every
+ * device, the writes of all devices are merged into the timeline of the
+ * USB bus they share.
+ * @param files: file for each device
+ * @param count: number of files
+ * @param floor: shortest achievable step in microseconds
+ * @param quiet: 1 to suppress the lines per device
+ * @return: 0 on success, 1 on error
+ */
+int
+plan_multi(char **files, int count, unsigned long floor, int quiet)
+{
+	struct plan *plans;
+	struct user_data ud;
+	unsigned long long floor_ns, now, last = 0, min_gap = ~0ULL;
+	unsigned long long duration = 0;
+	unsigned long *next, writes = 0, below = 0;
+	double rate = 0;
+	int i, k, ret = 1;
+
+	plans = mem_calloc(count, sizeof(struct plan));
+	next = mem_calloc(count, sizeof(unsigned long));
+	if (plans == NULL || next == NULL) {
+		printf(ERR "could not allocate memory for the plan\n");
+		goto out;
+	}
+	floor_ns = (unsigned long long)floor * NSEC_PER_USEC;
+
+	for (i = 0; i < count; i++) {
+		clear_userdata(&ud);
+		plans[i].name = files[i];
+		plans[i].runs = 1;
+		if (schedule_load(files[i], &plans[i].sched, &ud))
+			goto out;
+		plans[i].loaded = 1;
+		plan_schedule(&plans[i], &plans[i].sched, 1, floor_ns);
+		if (!quiet)
+			plan_print(&plans[i], floor);
+		if (plans[i].duration > duration)
+			duration = plans[i].duration;
+		if (plans[i].duration)
+			rate += (double)plans[i].steps * NSEC_PER_SEC
+				/ plans[i].duration;
+	}
+
+	/* all devices start together, take the writes in order of time */
+	for (;;) {
+		k = -1;
+		for (i = 0; i < count; i++)
+			if (next[i] < plans[i].sched.count
+			    && (k < 0 || plans[i].sched.entries[next[i]].start
+				< plans[k].sched.entries[next[k]].start))
+				k = i;
+		if (k < 0)
+			break;
+		now = plans[k].sched.entries[next[k]++].start;
+		if (writes++) {
+			if (now - last < min_gap)
+				min_gap = now - last;
+			if (now - last < floor_ns)
+				below++;
+		}
+		last = now;
+	}
+
+	printf(INFO "%d devices: %lu writes in %.3f s, %.1f writes/s on the "
+	       "bus\n", count, writes, (double)duration / NSEC_PER_SEC, rate);
+	if (writes > 1)
+		printf(INFO "%d devices: shortest gap between writes %.3f ms\n",
+		       count, (double)min_gap / NSEC_PER_MSEC);
+	if (below)
+		printf(WARN "%d devices: %lu writes follow the one before "
+		       "within %lu us\n", count, below, floor);
+	ret = 0;
+
+out:
+	for (i = 0; plans && i < count; i++)
+		if (plans[i].loaded)
+			schedule_free(&plans[i].sched);
+	free(plans);
+	free(next);
+	return ret;
+}
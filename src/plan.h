@@ -0,0 +1,29 @@
+#ifndef _PLAN_H_
+#define _PLAN_H_
+
+#include "input.h"
+#include "schedule.h"
+
+/* shortest step a Lab Brick is expected to follow, one USB HID frame */
+#define DEFAULT_FLOOR 1000
+
+/*
+ * timeline of one run of a device as it would be played
+ */
+struct plan
+{
+	char *name;
+	unsigned long long duration;
+	unsigned long steps;
+	unsigned long long min_interval;
+	unsigned long below_floor;
+	unsigned int runs;
+	int cont;
+	struct schedule sched;
+	int loaded;
+};
+
+int plan_single(struct user_data *ud);
+int plan_multi(char **files, int count, unsigned long floor, int quiet);
+
+#endif
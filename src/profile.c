@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include "profile.h"
+#include "timing.h"
+#include "control.h"
+#include "LDAhid.h"
+
+#define LINE_LENGTH 256
+
+/* keys of a profile file and the fields they are stored in */
+static const struct
+{
+	const char *key;
+	size_t offset;
+} keys[] = {
+	{ "serial", offsetof(struct profile, serial) },
+	{ "samples", offsetof(struct profile, samples) },
+	{ "devices", offsetof(struct profile, devices) },
+	{ "write_p50", offsetof(struct profile, write_p50) },
+	{ "write_p99", offsetof(struct profile, write_p99) },
+	{ "write_max", offsetof(struct profile, write_max) },
+	{ "read_p50", offsetof(struct profile, read_p50) },
+	{ "read_p99", offsetof(struct profile, read_p99) },
+	{ "shared_p50", offsetof(struct profile, shared_p50) },
+	{ "shared_p99", offsetof(struct profile, shared_p99) },
+	{ "sleep_p50", offsetof(struct profile, sleep_p50) },
+	{ "sleep_p99", offsetof(struct profile, sleep_p99) },
+	{ "rate", offsetof(struct profile, rate) },
+	{ "shared_rate", offsetof(struct profile, shared_rate) },
+	{ "min_step", offsetof(struct profile, min_step) },
+	{ "min_step_shared", offsetof(struct profile, min_step_shared) },
+};
+
+#define NR_KEYS (sizeof(keys) / sizeof(keys[0]))
+#define FIELD(p, k) ((unsigned long long *)((char *)(p) + keys[k].offset))
+
+/*
+ * build the path of the profile of a device
+ * @param serial: serial number of the device
+ * @param dir: directory of the profiles, DEFAULT_PROFILE_DIR if empty
+ * @param path: storage for the path
+ * @param length: size of path
+ * @return: 0 on success, 1 if the path does not fit
+ */
+int
+profile_path(int serial, char *dir, char *path, int length)
+{
+	int n;
+
+	n = snprintf(path, length, "%s/%i.profile",
+		     dir && dir[0] ? dir : DEFAULT_PROFILE_DIR, serial);
+	return n < 0 || n >= length;
+}
+
+/*
+ * write the profile of a device as <key> <value> lines
+ * @param p: profile, the file is named after its serial number
+ * @param dir: directory of the profiles, DEFAULT_PROFILE_DIR if empty
+ * @return: 0 on success, 1 on error
+ */
+int
+profile_save(struct profile *p, char *dir)
+{
+	char path[LINE_LENGTH];
+	FILE *fp;
+	unsigned int k;
+
+	if (profile_path((int)p->serial, dir, path, LINE_LENGTH))
+		return 1;
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		printf(ERR "unable to open %s for writing\n", path);
+		return 1;
+	}
+	fprintf(fp, "# written by -calibrate, times in ns, rates in writes/s\n");
+	for (k = 0; k < NR_KEYS; k++)
+		fprintf(fp, "%s %llu\n", keys[k].key, *FIELD(p, k));
+	if (fclose(fp)) {
+		printf(ERR "unable to write %s\n", path);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * read the profile of a device. Unknown keys are skipped, so profiles of
+ * other versions can still be read.
+ * @param serial: serial number of the device
+ * @param dir: directory of the profiles, DEFAULT_PROFILE_DIR if empty
+ * @param p: profile to fill
+ * @return: 0 on success, 1 if there is no profile
+ */
+int
+profile_load(int serial, char *dir, struct profile *p)
+{
+	char path[LINE_LENGTH], line[LINE_LENGTH], key[PROFILE_KEY_LENGTH];
+	unsigned long long value;
+	FILE *fp;
+	unsigned int k;
+
+	memset(p, 0, sizeof(struct profile));
+	if (profile_path(serial, dir, path, LINE_LENGTH))
+		return 1;
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return 1;
+	while (fgets(line, LINE_LENGTH, fp)) {
+		if (line[0] == '#'
+		    || sscanf(line, "%31s %llu", key, &value) != 2)
+			continue;
+		for (k = 0; k < NR_KEYS; k++)
+			if (strcmp(key, keys[k].key) == 0)
+				*FIELD(p, k) = value;
+	}
+	fclose(fp);
+	return p->serial != (unsigned long long)serial;
+}
+
+/*
+ * get the shortest step the profile of a device allows
+ * @param id: device id
+ * @param ud: user data struct holding the profile directory
+ * @param shared: 1 if other devices write at the same time
+ * @param serial: storage for the serial number of the device
+ * @return: shortest step in nanoseconds, 0 without profile
+ */
+static unsigned long long
+profile_floor(int id, struct user_data *ud, int shared, int *serial)
+{
+	struct profile p;
+
+	*serial = fnLDA_GetSerialNumber(id);
+	if (profile_load(*serial, ud->profile_dir, &p))
+		return 0;
+	return shared && p.min_step_shared ? p.min_step_shared : p.min_step;
+}
+
+/*
+ * check the steps of a schedule against the profile of the device playing
+ * it. Steps shorter than the device can follow are reported, with -merge
+ * they are combined with the steps after them.
+ * @param id: device id
+ * @param name: name of the schedule in messages
+ * @param s: schedule
+ * @param ud: user data struct
+ * @param shared: 1 if other devices play at the same time
+ */
+void
+profile_schedule(int id, char *name, struct schedule *s, struct user_data *ud,
+		 int shared)
+{
+	unsigned long long floor;
+	unsigned long i, below = 0, removed;
+	double speed;
+	int serial;
+
+	floor = profile_floor(id, ud, shared, &serial);
+	if (floor == 0)
+		return;
+	/* the profile holds real time, the schedule is played at speed */
+	speed = ud->speed > 0 ? ud->speed : 1;
+	floor = (unsigned long long)(floor * speed);
+	for (i = 0; i < s->count; i++)
+		if (s->entries[i].duration < floor)
+			below++;
+	if (below == 0)
+		return;
+
+	if (!ud->merge) {
+		printf(WARN "%s: %lu steps are shorter than the %.3f ms serial "
+		       "%i can follow, -merge combines them\n", name, below,
+		       (double)floor / speed / NSEC_PER_MSEC, serial);
+		return;
+	}
+	removed = schedule_merge(s, floor);
+	if (!ud->quiet)
+		printf(INFO "%s: %lu steps merged into the ones after them for "
+		       "serial %i, %lu steps left\n", name, removed, serial,
+		       s->count);
+}
+
+/*
+ * check the step time of -ramp and -triangle against the profile of the
+ * device. With -merge several steps are combined into one, so the form
+ * keeps its slope.
+ * @param id: device id
+ * @param ud: user data struct
+ */
+void
+profile_form(int id, struct user_data *ud)
+{
+	unsigned long long floor, step;
+	unsigned long factor;
+	int serial;
+
+	floor = profile_floor(id, ud, 0, &serial);
+	step = ud->atime * time_unit_ns(ud);
+	if (floor == 0 || step == 0 || step >= floor)
+		return;
+
+	if (!ud->merge) {
+		printf(WARN "steps of %.3f ms are shorter than the %.3f ms serial "
+		       "%i can follow, -merge combines them\n",
+		       (double)step / NSEC_PER_MSEC,
+		       (double)floor / NSEC_PER_MSEC, serial);
+		return;
+	}
+	factor = (floor + step - 1) / step;
+	ud->atime *= factor;
+	ud->ramp_steps *= factor;
+	if (!ud->quiet)
+		printf(INFO "%lu steps merged into one for serial %i: %.2f dB "
+		       "every %.3f ms\n", factor, serial,
+		       (double)ud->ramp_steps / MULTIPLIER_STEP,
+		       (double)(step * factor) / NSEC_PER_MSEC);
+}
@@ -0,0 +1,43 @@
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include "input.h"
+#include "schedule.h"
+
+/* -calibrate writes <serial>.profile files here unless -profile-dir is set */
+#define DEFAULT_PROFILE_DIR "/etc/attenuator"
+#define PROFILE_KEY_LENGTH 32
+
+/*
+ * timing of a device on this host as measured by -calibrate. Times are in
+ * nanoseconds, rates in writes per second. The shared values were measured
+ * with all calibrated devices writing at the same time.
+ */
+struct profile
+{
+	unsigned long long serial;
+	unsigned long long samples;
+	unsigned long long devices;
+	unsigned long long write_p50;
+	unsigned long long write_p99;
+	unsigned long long write_max;
+	unsigned long long read_p50;
+	unsigned long long read_p99;
+	unsigned long long shared_p50;
+	unsigned long long shared_p99;
+	unsigned long long sleep_p50;
+	unsigned long long sleep_p99;
+	unsigned long long rate;
+	unsigned long long shared_rate;
+	unsigned long long min_step;
+	unsigned long long min_step_shared;
+};
+
+int profile_path(int serial, char *dir, char *path, int length);
+int profile_save(struct profile *p, char *dir);
+int profile_load(int serial, char *dir, struct profile *p);
+void profile_schedule(int id, char *name, struct schedule *s,
+		      struct user_data *ud, int shared);
+void profile_form(int id, struct user_data *ud);
+
+#endif
@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <limits.h>
+#include <libgen.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include "reload.h"
+#include "mem.h"
+#include "profile.h"
+#include "timing.h"
+#include "control.h"
+
+#define EVENT_BUFFER (16 * (sizeof(struct inotify_event) + NAME_MAX + 1))
+
+/*
+ * watcher of a schedule file. The playback owns the active slot, the
+ * watcher parses into the other one and publishes it as pending. The lock
+ * is only held to pick and hand over slots, never while parsing.
+ * @ud: copy of the user data taken before the playback changed it
+ * @armed: statistics of the run playing now, stopped by RELOAD_NOW
+ * @cut: set when the run was stopped for a new version
+ */
+struct reloader
+{
+	char path[MAX_LENGTH];
+	char name[MAX_LENGTH];
+	int id;
+	int fd;
+	struct user_data ud;
+	struct schedule slots[2];
+	int active;
+	int pending;
+	int cut;
+	struct play_stats *armed;
+	unsigned long reloads;
+	unsigned long rejected;
+	pthread_mutex_t lock;
+	pthread_t thread;
+	volatile int running;
+};
+
+/*
+ * time of the parse, real time even on the virtual clock of a simulation
+ */
+static unsigned long long
+parse_clock_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/*
+ * read pending events of the directory of the schedule
+ * @return: 1 if the schedule was written or replaced, else 0
+ */
+static int
+read_events(struct reloader *r)
+{
+	char buf[EVENT_BUFFER] __attribute__((aligned(8)));
+	struct inotify_event *ev;
+	ssize_t n, pos;
+	int changed = 0;
+
+	n = read(r->fd, buf, sizeof(buf));
+	for (pos = 0; pos < n; pos += sizeof(struct inotify_event) + ev->len) {
+		ev = (struct inotify_event *)(buf + pos);
+		if (ev->len && strcmp(ev->name, r->name) == 0)
+			changed = 1;
+	}
+	return changed;
+}
+
+/*
+ * parse the schedule into the free slot and publish it. A version which
+ * does not parse or has no steps is dropped and the playing one is kept.
+ */
+static void
+reload_parse(struct reloader *r)
+{
+	struct schedule *next;
+	unsigned long long begin, took;
+	int slot, failed;
+
+	pthread_mutex_lock(&r->lock);
+	slot = 1 - r->active;
+	/* a newer version replaces one which was not taken yet */
+	if (r->pending == slot)
+		r->pending = -1;
+	pthread_mutex_unlock(&r->lock);
+
+	next = &r->slots[slot];
+	schedule_free(next);
+	begin = parse_clock_ns();
+	failed = schedule_load(r->path, next, &r->ud);
+	if (!failed && next->count == 0) {
+		printf(ERR "%s has no steps\n", r->path);
+		schedule_free(next);
+		failed = 1;
+	}
+	if (!failed)
+		profile_schedule(r->id, r->path, next, &r->ud, 0);
+	took = parse_clock_ns() - begin;
+	log_reload(failed ? 0 : next->count, took, failed, &r->ud);
+
+	if (failed) {
+		r->rejected++;
+		printf(WARN "%s: reload failed after %.3f ms, the playing "
+		       "version is kept\n", r->path, (double)took / NSEC_PER_MSEC);
+		return;
+	}
+	if (!r->ud.quiet)
+		printf(INFO "%s: parsed %lu steps (%.3fs) in %.3f ms, swapping "
+		       "them in %s\n", r->path, next->count,
+		       (double)next->length / NSEC_PER_SEC,
+		       (double)took / NSEC_PER_MSEC,
+		       r->ud.reload == RELOAD_NOW ? "now" : "with the next run");
+
+	pthread_mutex_lock(&r->lock);
+	r->pending = slot;
+	r->reloads++;
+	if (r->ud.reload == RELOAD_NOW && r->armed) {
+		r->armed->stop = 1;
+		r->cut = 1;
+	}
+	pthread_mutex_unlock(&r->lock);
+}
+
+/*
+ * wait for changes of the schedule. Editors write a file in several steps
+ * or replace it, so it is parsed once no event came in for
+ * RELOAD_SETTLE_MS.
+ */
+static void *
+reload_loop(void *arg)
+{
+	struct reloader *r = arg;
+	struct pollfd pfd;
+	sigset_t set;
+
+	/* signals are handled by the threads of the program */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	pfd.fd = r->fd;
+	pfd.events = POLLIN;
+	while (r->running) {
+		if (poll(&pfd, 1, RELOAD_POLL_MS) <= 0 || !read_events(r))
+			continue;
+		while (r->running && poll(&pfd, 1, RELOAD_SETTLE_MS) > 0)
+			read_events(r);
+		if (r->running)
+			reload_parse(r);
+	}
+	return NULL;
+}
+
+/*
+ * watch a schedule with inotify and parse new versions in a thread of its
+ * own, so the playback never waits for a parse. The directory is watched,
+ * which also catches editors replacing the file by renaming.
+ * @param path: path to the schedule file
+ * @param id: device id, for the profile of the device
+ * @param s: loaded schedule, moved into the reloader
+ * @param ud: user data struct, reload sets when versions are swapped in
+ * @return: reloader, NULL on error with s left to the caller
+ */
+struct reloader *
+reload_start(char *path, int id, struct schedule *s, struct user_data *ud)
+{
+	struct reloader *r;
+	char copy[MAX_LENGTH];
+
+	r = mem_calloc(1, sizeof(struct reloader));
+	if (r == NULL) {
+		printf(ERR "could not allocate memory for reloading\n");
+		return NULL;
+	}
+	strncpy(r->path, path, MAX_LENGTH - 1);
+	strncpy(copy, path, MAX_LENGTH - 1);
+	copy[MAX_LENGTH - 1] = '\0';
+	strncpy(r->name, basename(copy), MAX_LENGTH - 1);
+	strncpy(copy, path, MAX_LENGTH - 1);
+
+	r->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (r->fd < 0 || inotify_add_watch(r->fd, dirname(copy),
+					   IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		printf(ERR "could not watch %s for changes\n", path);
+		goto error;
+	}
+
+	r->id = id;
+	r->ud = *ud;
+	r->slots[0] = *s;
+	r->pending = -1;
+	r->running = 1;
+	pthread_mutex_init(&r->lock, NULL);
+	if (pthread_create(&r->thread, NULL, reload_loop, r)) {
+		printf(ERR "unable to start watching %s\n", path);
+		pthread_mutex_destroy(&r->lock);
+		goto error;
+	}
+	if (!ud->quiet)
+		printf(INFO "watching %s for changes\n", path);
+	return r;
+
+error:
+	if (r->fd >= 0)
+		close(r->fd);
+	free(r);
+	return NULL;
+}
+
+/*
+ * get the schedule playing now
+ */
+struct schedule *
+reload_current(struct reloader *r)
+{
+	return &r->slots[r->active];
+}
+
+/*
+ * hand the statistics of a run to the watcher, so RELOAD_NOW can stop it.
+ * A version published while no run was armed stops the run right away.
+ */
+void
+reload_arm(struct reloader *r, struct play_stats *st)
+{
+	pthread_mutex_lock(&r->lock);
+	r->armed = st;
+	if (r->ud.reload == RELOAD_NOW && r->pending >= 0) {
+		st->stop = 1;
+		r->cut = 1;
+	}
+	pthread_mutex_unlock(&r->lock);
+}
+
+/*
+ * swap in a new version after a run ended
+ * @param r: reloader
+ * @param cut: set to 1 if the run was stopped for it, else 0
+ * @return: new schedule, NULL if there is none and the old one stays
+ */
+struct schedule *
+reload_take(struct reloader *r, int *cut)
+{
+	struct schedule *s = NULL;
+
+	pthread_mutex_lock(&r->lock);
+	r->armed = NULL;
+	*cut = r->cut;
+	r->cut = 0;
+	if (r->pending >= 0) {
+		r->active = r->pending;
+		r->pending = -1;
+		s = &r->slots[r->active];
+	}
+	pthread_mutex_unlock(&r->lock);
+	return s;
+}
+
+/*
+ * end the watcher and free both versions of the schedule
+ */
+void
+reload_stop(struct reloader *r)
+{
+	r->running = 0;
+	pthread_join(r->thread, NULL);
+	close(r->fd);
+	pthread_mutex_destroy(&r->lock);
+	if (!r->ud.quiet && (r->reloads || r->rejected))
+		printf(INFO "%s: %lu reloads, %lu rejected\n", r->path,
+		       r->reloads, r->rejected);
+	schedule_free(&r->slots[0]);
+	schedule_free(&r->slots[1]);
+	free(r);
+}
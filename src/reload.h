@@ -0,0 +1,25 @@
+#ifndef _RELOAD_H_
+#define _RELOAD_H_
+
+#include "input.h"
+#include "schedule.h"
+
+/* when a changed schedule is swapped in, set in the user data */
+#define RELOAD_RUN 1
+#define RELOAD_NOW 2
+
+/* quiet time after the last write before a changed schedule is parsed */
+#define RELOAD_SETTLE_MS 100
+/* longest wait of the watcher before it checks if it has to end */
+#define RELOAD_POLL_MS 200
+
+struct reloader;
+
+struct reloader *reload_start(char *path, int id, struct schedule *s,
+			      struct user_data *ud);
+struct schedule *reload_current(struct reloader *r);
+void reload_arm(struct reloader *r, struct play_stats *st);
+struct schedule *reload_take(struct reloader *r, int *cut);
+void reload_stop(struct reloader *r);
+
+#endif
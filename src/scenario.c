@@ -0,0 +1,508 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include "scenario.h"
+#include "mem.h"
+#include "control.h"
+#include "input.h"
+#include "LDAhid.h"
+
+#define TOKEN_LENGTH 64
+#define INITIAL_CODE_SIZE 32
+#define FOREVER 0
+
+/* state of the scenario tokenizer */
+struct lexer
+{
+	FILE *fp;
+	char *path;
+	unsigned int line;
+	unsigned int tok_line;
+	char tok[TOKEN_LENGTH];
+	int peeked;
+};
+
+/* loop or call frame used while running a scenario */
+struct frame
+{
+	unsigned int pc;
+	unsigned long left;
+};
+
+/*
+ * read the next token. Tokens are separated by whitespace, braces are
+ * tokens on their own and '#' starts a comment until the end of the line.
+ * @param lx: lexer state
+ * @return: 1 if a token was read, 0 at end of file
+ */
+static int
+next_token(struct lexer *lx)
+{
+	int c, len = 0;
+
+	if (lx->peeked) {
+		lx->peeked = 0;
+		return 1;
+	}
+
+	for (;;) {
+		c = fgetc(lx->fp);
+		if (c == EOF)
+			return 0;
+		if (c == '\n')
+			lx->line++;
+		if (c == '#') {
+			while ((c = fgetc(lx->fp)) != EOF && c != '\n')
+				;
+			lx->line++;
+			if (c == EOF)
+				return 0;
+			continue;
+		}
+		if (!isspace(c))
+			break;
+	}
+
+	lx->tok_line = lx->line;
+	if (c == '{' || c == '}') {
+		lx->tok[0] = c;
+		lx->tok[1] = '\0';
+		return 1;
+	}
+
+	do {
+		if (len < TOKEN_LENGTH - 1)
+			lx->tok[len++] = c;
+		c = fgetc(lx->fp);
+	} while (c != EOF && !isspace(c) && c != '{' && c != '}' && c != '#');
+	lx->tok[len] = '\0';
+
+	if (c != EOF)
+		ungetc(c, lx->fp);
+	return 1;
+}
+
+/*
+ * check if the next token is equal to word without consuming it otherwise
+ */
+static int
+accept(struct lexer *lx, char *word)
+{
+	if (!next_token(lx))
+		return 0;
+	if (strcmp(lx->tok, word) == 0)
+		return 1;
+	lx->peeked = 1;
+	return 0;
+}
+
+/*
+ * map a time unit token to its flag
+ * @return: unit flag, -1 if token is no time unit
+ */
+static int
+get_unit(char *tok)
+{
+	if (strcmp(tok, "s") == 0)
+		return UNIT_S;
+	if (strcmp(tok, "ms") == 0)
+		return UNIT_MS;
+	if (strcmp(tok, "us") == 0)
+		return UNIT_US;
+	return -1;
+}
+
+/*
+ * read an attenuation in dB and convert it into device steps
+ */
+static int
+read_att(struct lexer *lx, int *att)
+{
+	char *end;
+	double value;
+
+	if (!next_token(lx))
+		return 1;
+	value = strtod(lx->tok, &end);
+	if (end == lx->tok || *end != '\0')
+		return 1;
+	*att = (int)(value * MULTIPLIER_STEP);
+	return 0;
+}
+
+/*
+ * read a time value and an optional time unit following it
+ */
+static int
+read_time(struct lexer *lx, unsigned long *atime, unsigned char *unit)
+{
+	char *end;
+	int tmp_unit;
+
+	if (!next_token(lx))
+		return 1;
+	if (lx->tok[0] == '-')
+		return 1;
+	*atime = strtoul(lx->tok, &end, 10);
+	if (end == lx->tok || *end != '\0')
+		return 1;
+
+	if (next_token(lx)) {
+		tmp_unit = get_unit(lx->tok);
+		if (tmp_unit < 0)
+			lx->peeked = 1;
+		else
+			*unit = tmp_unit;
+	}
+	return 0;
+}
+
+/*
+ * append an instruction to the scenario
+ * @return: index of the instruction, -1 if out of memory
+ */
+static int
+emit(struct scenario *sc, struct instruction *in)
+{
+	struct instruction *code;
+	unsigned int size;
+
+	if (sc->count == sc->size) {
+		size = sc->size ? sc->size * 2 : INITIAL_CODE_SIZE;
+		code = mem_realloc(sc->code, size * sizeof(struct instruction));
+		if (code == NULL)
+			return -1;
+		sc->code = code;
+		sc->size = size;
+	}
+	sc->code[sc->count] = *in;
+	return sc->count++;
+}
+
+/*
+ * get index of a named segment, add it if it is not known yet
+ * @return: segment index, -1 if there are too many segments
+ */
+static int
+find_segment(struct scenario *sc, char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < sc->nr_segments; i++)
+		if (strcmp(sc->segments[i].name, name) == 0)
+			return i;
+
+	if (sc->nr_segments == MAX_SEGMENTS)
+		return -1;
+
+	strncpy(sc->segments[i].name, name, MAX_SEGMENT_NAME - 1);
+	sc->segments[i].name[MAX_SEGMENT_NAME - 1] = '\0';
+	sc->segments[i].defined = 0;
+	return sc->nr_segments++;
+}
+
+/*
+ * compile statements until the end of the block or file
+ * @param lx: lexer state
+ * @param sc: scenario to compile into
+ * @param unit: time unit inherited from the enclosing block
+ * @param depth: nesting depth of the block
+ * @return: 0 on success, 1 on error
+ */
+static int
+parse_block(struct lexer *lx, struct scenario *sc, int unit, int depth)
+{
+	struct instruction in;
+	int start, seg;
+
+	while (next_token(lx)) {
+		memset(&in, 0, sizeof(struct instruction));
+		in.line = lx->tok_line;
+		in.unit = unit;
+
+		if (strcmp(lx->tok, "}") == 0) {
+			if (depth == 0) {
+				printf(ERR "%s:%u: unexpected }\n", lx->path, in.line);
+				return 1;
+			}
+			return 0;
+		} else if (strcmp(lx->tok, "unit") == 0) {
+			if (!next_token(lx) || (unit = get_unit(lx->tok)) < 0) {
+				printf(ERR "%s:%u: unit has to be s, ms or us\n",
+				       lx->path, in.line);
+				return 1;
+			}
+		} else if (strcmp(lx->tok, "hold") == 0) {
+			in.op = OP_HOLD;
+			if (read_att(lx, &in.attenuation)
+			    || read_time(lx, &in.atime, &in.unit)) {
+				printf(ERR "%s:%u: expected hold <dB> <time> [s|ms|us]\n",
+				       lx->path, in.line);
+				return 1;
+			}
+			if (emit(sc, &in) < 0)
+				goto nomem;
+		} else if (strcmp(lx->tok, "ramp") == 0
+			   || strcmp(lx->tok, "triangle") == 0) {
+			in.op = lx->tok[0] == 'r' ? OP_RAMP : OP_TRIANGLE;
+			if (read_att(lx, &in.start_att)
+			    || read_att(lx, &in.end_att)
+			    || read_att(lx, &in.ramp_steps)
+			    || read_time(lx, &in.atime, &in.unit)
+			    || in.ramp_steps <= 0) {
+				printf(ERR "%s:%u: expected %s <start dB> <end dB> "
+				       "<step dB> <time> [s|ms|us]\n", lx->path,
+				       in.line, in.op == OP_RAMP ? "ramp" : "triangle");
+				return 1;
+			}
+			if (emit(sc, &in) < 0)
+				goto nomem;
+		} else if (strcmp(lx->tok, "repeat") == 0) {
+			in.op = OP_REPEAT;
+			if (!next_token(lx))
+				goto bad_repeat;
+			if (strcmp(lx->tok, "forever") == 0) {
+				in.arg = FOREVER;
+			} else {
+				in.arg = strtoul(lx->tok, NULL, 10);
+				if (in.arg == 0 || lx->tok[0] == '-')
+					goto bad_repeat;
+			}
+			if (!accept(lx, "{"))
+				goto bad_repeat;
+			if (depth + 1 >= MAX_NESTING) {
+				printf(ERR "%s:%u: blocks nested too deep\n",
+				       lx->path, in.line);
+				return 1;
+			}
+			if ((start = emit(sc, &in)) < 0)
+				goto nomem;
+			if (parse_block(lx, sc, unit, depth + 1))
+				return 1;
+			in.op = OP_END_REPEAT;
+			in.arg = start;
+			if (emit(sc, &in) < 0)
+				goto nomem;
+		} else if (strcmp(lx->tok, "segment") == 0) {
+			if (depth != 0) {
+				printf(ERR "%s:%u: segments can only be defined "
+				       "at top level\n", lx->path, in.line);
+				return 1;
+			}
+			if (!next_token(lx) || (seg = find_segment(sc, lx->tok)) < 0
+			    || !accept(lx, "{")) {
+				printf(ERR "%s:%u: expected segment <name> {\n",
+				       lx->path, in.line);
+				return 1;
+			}
+			if (sc->segments[seg].defined) {
+				printf(ERR "%s:%u: segment %s already defined in line %u\n",
+				       lx->path, in.line, sc->segments[seg].name,
+				       sc->segments[seg].line);
+				return 1;
+			}
+			/* segment bodies are jumped over when reached in order */
+			in.op = OP_JUMP;
+			if ((start = emit(sc, &in)) < 0)
+				goto nomem;
+			sc->segments[seg].pc = sc->count;
+			sc->segments[seg].line = in.line;
+			sc->segments[seg].defined = 1;
+			if (parse_block(lx, sc, unit, depth + 1))
+				return 1;
+			in.op = OP_RET;
+			if (emit(sc, &in) < 0)
+				goto nomem;
+			sc->code[start].arg = sc->count;
+		} else if (strcmp(lx->tok, "call") == 0) {
+			in.op = OP_CALL;
+			if (!next_token(lx) || (seg = find_segment(sc, lx->tok)) < 0) {
+				printf(ERR "%s:%u: expected call <segment>\n",
+				       lx->path, in.line);
+				return 1;
+			}
+			in.arg = seg;
+			if (emit(sc, &in) < 0)
+				goto nomem;
+		} else {
+			printf(ERR "%s:%u: unknown statement %s\n", lx->path,
+			       in.line, lx->tok);
+			return 1;
+		}
+	}
+
+	if (depth != 0) {
+		printf(ERR "%s: missing } at end of file\n", lx->path);
+		return 1;
+	}
+	return 0;
+
+bad_repeat:
+	printf(ERR "%s:%u: expected repeat <count>|forever {\n", lx->path,
+	       lx->tok_line);
+	return 1;
+nomem:
+	printf(ERR "could not allocate memory for scenario\n");
+	return 1;
+}
+
+/*
+ * compile a scenario file into an instruction list
+ * @param path: path to scenario file
+ * @param sc: scenario to fill
+ * @return: 0 on success, 1 on error
+ */
+int
+scenario_load(char *path, struct scenario *sc)
+{
+	struct lexer lx;
+	struct instruction end;
+	struct segment *seg;
+	unsigned int i;
+	int res;
+
+	memset(sc, 0, sizeof(struct scenario));
+	memset(&lx, 0, sizeof(struct lexer));
+	lx.path = path;
+	lx.line = 1;
+
+	lx.fp = fopen(path, "r");
+	if (lx.fp == NULL) {
+		printf(ERR "unable to open scenario file for reading: %s\n", path);
+		return 1;
+	}
+
+	res = parse_block(&lx, sc, UNIT_S, 0);
+	fclose(lx.fp);
+
+	memset(&end, 0, sizeof(struct instruction));
+	end.op = OP_END;
+	if (!res && emit(sc, &end) < 0) {
+		printf(ERR "could not allocate memory for scenario\n");
+		res = 1;
+	}
+
+	/* resolve calls, segments may be used before they are defined */
+	for (i = 0; !res && i < sc->count; i++) {
+		if (sc->code[i].op != OP_CALL)
+			continue;
+		seg = &sc->segments[sc->code[i].arg];
+		if (!seg->defined) {
+			printf(ERR "%s:%u: call of undefined segment %s\n",
+			       path, sc->code[i].line, seg->name);
+			res = 1;
+		}
+		sc->code[i].arg = seg->pc;
+	}
+
+	if (res)
+		scenario_free(sc);
+	return res;
+}
+
+/*
+ * prepare user data for a single instruction, logging and output
+ * settings are taken from the user
+ */
+static void
+prepare_step(struct user_data *step, struct user_data *ud,
+	     struct instruction *in)
+{
+	memcpy(step, ud, sizeof(struct user_data));
+	step->cont = 0;
+	step->runs = 1;
+	step->atime = in->atime;
+	step->ms = in->unit == UNIT_MS;
+	step->us = in->unit == UNIT_US;
+	step->attenuation = in->attenuation;
+	step->start_att = in->start_att;
+	step->end_att = in->end_att;
+	step->ramp_steps = in->ramp_steps;
+}
+
+/*
+ * run a compiled scenario on a device. Loops and calls are executed in
+ * place, so memory usage does not depend on the number of repetitions.
+ * @param id: device id
+ * @param sc: compiled scenario
+ * @param ud: user data struct
+ * @return: 0 on success, 1 on error
+ */
+int
+scenario_run(int id, struct scenario *sc, struct user_data *ud)
+{
+	struct frame stack[MAX_NESTING];
+	struct instruction *in;
+	struct user_data step;
+	unsigned int pc = 0;
+	int sp = 0;
+
+	for (;;) {
+		in = &sc->code[pc];
+		switch (in->op) {
+		case OP_HOLD:
+			prepare_step(&step, ud, in);
+			set_attenuation(id, &step);
+			pc++;
+			break;
+		case OP_RAMP:
+			prepare_step(&step, ud, in);
+			if (set_ramp(id, &step))
+				return 1;
+			pc++;
+			break;
+		case OP_TRIANGLE:
+			prepare_step(&step, ud, in);
+			if (set_triangle(id, &step))
+				return 1;
+			pc++;
+			break;
+		case OP_REPEAT:
+		case OP_CALL:
+			if (sp == MAX_NESTING) {
+				printf(ERR "line %u: scenario nested too deep, "
+				       "recursive call?\n", in->line);
+				return 1;
+			}
+			if (in->op == OP_REPEAT) {
+				stack[sp].pc = pc;
+				stack[sp++].left = in->arg;
+				pc++;
+			} else {
+				stack[sp].pc = pc + 1;
+				stack[sp++].left = 0;
+				pc = in->arg;
+			}
+			break;
+		case OP_END_REPEAT:
+			if (stack[sp - 1].left == FOREVER
+			    || --stack[sp - 1].left > 0) {
+				pc = stack[sp - 1].pc + 1;
+			} else {
+				sp--;
+				pc++;
+			}
+			break;
+		case OP_RET:
+			pc = stack[--sp].pc;
+			break;
+		case OP_JUMP:
+			pc = in->arg;
+			break;
+		default:
+			return 0;
+		}
+	}
+}
+
+/*
+ * free memory of a compiled scenario
+ * @param sc: scenario
+ */
+void
+scenario_free(struct scenario *sc)
+{
+	free(sc->code);
+	memset(sc, 0, sizeof(struct scenario));
+}
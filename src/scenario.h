@@ -0,0 +1,63 @@
+#ifndef _SCENARIO_H_
+#define _SCENARIO_H_
+
+#include "input.h"
+
+#define OP_END 0
+#define OP_HOLD 1
+#define OP_RAMP 2
+#define OP_TRIANGLE 3
+#define OP_REPEAT 4
+#define OP_END_REPEAT 5
+#define OP_CALL 6
+#define OP_RET 7
+#define OP_JUMP 8
+
+#define UNIT_S 0
+#define UNIT_MS 1
+#define UNIT_US 2
+
+#define MAX_SEGMENTS 64
+#define MAX_SEGMENT_NAME 32
+#define MAX_NESTING 32
+
+/*
+ * compiled scenario instruction, loops and calls are not expanded but
+ * executed with jumps
+ * @arg: repeat count for OP_REPEAT, jump target otherwise
+ */
+struct instruction
+{
+	unsigned char op;
+	unsigned char unit;
+	unsigned int line;
+	unsigned long arg;
+	unsigned long atime;
+	int attenuation;
+	int start_att;
+	int end_att;
+	int ramp_steps;
+};
+
+struct segment
+{
+	char name[MAX_SEGMENT_NAME];
+	unsigned int pc;
+	unsigned int line;
+	int defined;
+};
+
+struct scenario
+{
+	struct instruction *code;
+	unsigned int count;
+	unsigned int size;
+	struct segment segments[MAX_SEGMENTS];
+	unsigned int nr_segments;
+};
+
+int scenario_load(char *path, struct scenario *sc);
+int scenario_run(int id, struct scenario *sc, struct user_data *ud);
+void scenario_free(struct scenario *sc);
+
+#endif
@@ -0,0 +1,367 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "schedule.h"
+#include "mem.h"
+#include "checkpoint.h"
+#include "status.h"
+#include "timing.h"
+#include "control.h"
+#include "input.h"
+#include "csv.h"
+#include "LDAhid.h"
+
+#define INITIAL_ENTRIES 256
+
+/*
+ * map name of an overrun policy to its flag
+ * @param name: catchup, skip or stretch
+ * @return: policy flag, -1 if unknown
+ */
+int
+get_overrun_policy(char *name)
+{
+	if (strcmp(name, "stretch") == 0)
+		return OVERRUN_STRETCH;
+	if (strcmp(name, "catchup") == 0)
+		return OVERRUN_CATCHUP;
+	if (strcmp(name, "skip") == 0)
+		return OVERRUN_SKIP;
+	return -1;
+}
+
+/*
+ * append an entry to the schedule, growing it if needed
+ * @return: 0 on success, 1 if out of memory
+ */
+static int
+add_entry(struct schedule *s, struct sched_entry *e)
+{
+	struct sched_entry *entries;
+	unsigned long size;
+
+	if (s->count == s->size) {
+		size = s->size ? s->size * 2 : INITIAL_ENTRIES;
+		entries = mem_realloc(s->entries, size * sizeof(struct sched_entry));
+		if (entries == NULL)
+			return 1;
+		s->entries = entries;
+		s->size = size;
+	}
+	e->start = s->length;
+	if (s->count == 0 || e->duration < s->shortest)
+		s->shortest = e->duration;
+	s->entries[s->count++] = *e;
+	s->length += e->duration;
+	return 0;
+}
+
+/*
+ * read a .csv schedule file into memory
+ * <time>,<attenuation in dB>[,<time unit>]
+ * The content is hashed, so a checkpoint can be matched to its schedule.
+ * Malformed rows are reported with their line and column.
+ * @param path: path to schedule file
+ * @param s: schedule to fill
+ * @param ud: user data struct holding the default time unit
+ * @return: 0 on success, 1 on error
+ */
+int
+schedule_load(char *path, struct schedule *s, struct user_data *ud)
+{
+	struct csv_reader r;
+	struct user_data unit;
+	struct sched_entry e, *entries;
+	int res;
+
+	memset(s, 0, sizeof(struct schedule));
+	unit = *ud;
+
+	if (csv_open(&r, path))
+		return 1;
+
+	while ((res = csv_next(&r, &unit, &e.duration, &e.attenuation)) == 0) {
+		e.atime = e.duration / time_unit_ns(&unit);
+		e.ms = unit.ms;
+		e.us = unit.us;
+		if (add_entry(s, &e)) {
+			report(ERR "could not allocate memory for schedule\n");
+			goto error;
+		}
+	}
+	if (res == -2) {
+		report(ERR "%s:%lu:%lu: value out of range\n", path, r.line,
+		       r.col);
+		goto error;
+	}
+	if (res < 0) {
+		report(ERR "%s:%lu:%lu: expected <time>,<attenuation>[,<time unit>]\n",
+		       path, r.line, r.col);
+		goto error;
+	}
+	s->hash = r.hash;
+	csv_close(&r);
+
+	/* give back what the last growth step took too much */
+	if (s->count && s->count < s->size) {
+		entries = mem_realloc(s->entries,
+				      s->count * sizeof(struct sched_entry));
+		if (entries) {
+			s->entries = entries;
+			s->size = s->count;
+		}
+	}
+	return 0;
+
+error:
+	csv_close(&r);
+	schedule_free(s);
+	return 1;
+}
+
+/*
+ * combine steps shorter than floor with the steps after them until they
+ * last floor. A combined step starts with its first step and sets the
+ * attenuation of its last one, so the schedule keeps its length and every
+ * value held for floor or longer is still set.
+ * @param s: schedule
+ * @param floor: shortest step in nanoseconds
+ * @return: number of steps removed
+ */
+unsigned long
+schedule_merge(struct schedule *s, unsigned long long floor)
+{
+	struct sched_entry e;
+	unsigned long i = 0, count = 0;
+
+	s->length = 0;
+	while (i < s->count) {
+		e = s->entries[i++];
+		while (e.duration < floor && i < s->count) {
+			e.duration += s->entries[i].duration;
+			e.attenuation = s->entries[i].attenuation;
+			e.ms = s->entries[i].ms;
+			e.us = s->entries[i++].us;
+		}
+		e.atime = e.duration / (e.us ? NSEC_PER_USEC
+					: e.ms ? NSEC_PER_MSEC : NSEC_PER_SEC);
+		e.start = s->length;
+		if (count == 0 || e.duration < s->shortest)
+			s->shortest = e.duration;
+		s->entries[count++] = e;
+		s->length += e.duration;
+	}
+	i = s->count - count;
+	s->count = count;
+	return i;
+}
+
+/*
+ * count a step which was issued too late or skipped and write it to the
+ * log file
+ */
+static void
+note_miss(struct user_data *ud, struct play_stats *st, unsigned long index,
+	  unsigned long long late, int skipped)
+{
+	if (st->lock)
+		pthread_mutex_lock(st->lock);
+	if (skipped)
+		st->skipped++;
+	else
+		st->missed++;
+	if (late > st->max_late)
+		st->max_late = late;
+	if (st->lock)
+		pthread_mutex_unlock(st->lock);
+	log_overrun(index, late, skipped, ud);
+}
+
+/*
+ * note a step written to the device
+ */
+static void
+note_step(struct play_stats *st, unsigned long index, int value)
+{
+	if (st->lock)
+		pthread_mutex_lock(st->lock);
+	st->index = index;
+	st->value = value;
+	st->steps++;
+	if (st->lock)
+		pthread_mutex_unlock(st->lock);
+}
+
+/*
+ * sleep until a deadline, waking up often enough to notice a stop request
+ * @return: 1 if playback was stopped, else 0
+ */
+int
+schedule_wait(unsigned long long deadline, struct play_stats *st)
+{
+	unsigned long long wake;
+
+	while (!st->stop) {
+		wake = time_now_ns() + STOP_POLL_NS;
+		if (wake >= deadline) {
+			time_sleep_until_ns(deadline);
+			return st->stop;
+		}
+		time_sleep_until_ns(wake);
+	}
+	return 1;
+}
+
+/*
+ * find the step active at a given time using the start times of all
+ * steps as index
+ * @param s: schedule
+ * @param t: offset from start of the schedule in nanoseconds
+ * @return: index of the step, count if t is beyond the end
+ */
+unsigned long
+schedule_seek(struct schedule *s, unsigned long long t)
+{
+	unsigned long low = 0, high = s->count, mid;
+
+	if (t >= s->length)
+		return s->count;
+
+	/* last step starting at or before t */
+	while (high - low > 1) {
+		mid = low + (high - low) / 2;
+		if (s->entries[mid].start <= t)
+			low = mid;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+/*
+ * play a schedule on a device. How late steps are handled depends on the
+ * overrun policy set by the user:
+ * stretch - every step is kept for its full time, lateness moves all
+ *           following steps
+ * catchup - steps have fixed deadlines, late steps are issued immediately
+ * skip    - steps have fixed deadlines, steps whose time is already over
+ *           are dropped, so the device follows wall clock time
+ * Playback starts at the offset set by the user and schedule time runs
+ * faster or slower than wall clock time by the speed factor. It ends early
+ * if stop is set in the statistics. Steps outside the limits of the device
+ * are clamped, they are reported once before the playback starts.
+ * @param id: device id
+ * @param s: schedule
+ * @param ud: user data struct
+ * @param st: statistics to update
+ * @return: 0 on success, 1 on error
+ */
+int
+schedule_play(int id, struct schedule *s, struct user_data *ud,
+	      struct play_stats *st)
+{
+	struct sched_entry *e;
+	unsigned long long origin, deadline, end, now, tolerance, offset, issue;
+	unsigned long i, first, clamped = 0;
+	double speed;
+	int serial, min, max, value;
+
+	serial = fnLDA_GetSerialNumber(id);
+	min = fnLDA_GetMinAttenuation(id);
+	max = fnLDA_GetMaxAttenuation(id);
+	tolerance = (unsigned long long)ud->tolerance * NSEC_PER_USEC;
+	speed = ud->speed > 0 ? ud->speed : 1;
+	offset = (unsigned long long)(ud->offset * time_unit_ns(ud));
+
+	first = schedule_seek(s, offset);
+	if (first == s->count) {
+		report(ERR "offset is beyond the end of the schedule\n");
+		return 1;
+	}
+	/* limits are checked once here, steps are only clamped */
+	for (i = first; i < s->count; i++)
+		if (s->entries[i].attenuation < min
+		    || s->entries[i].attenuation > max)
+			clamped++;
+	if (clamped)
+		report(WARN "%lu steps are outside of %.2f to %.2fdB and are "
+		       "clamped (serial %i)\n", clamped,
+		       (double)min / MULTIPLIER_STEP,
+		       (double)max / MULTIPLIER_STEP, serial);
+	if (!ud->quiet && (offset || speed != 1))
+		report(INFO "starting at step %lu of %lu (%.3fs into the "
+		       "schedule) at %.2fx speed\n", first, s->count,
+		       (double)offset / NSEC_PER_SEC, speed);
+
+	/* wall clock time of schedule time t is origin + (t - offset) / speed */
+	origin = deadline = time_now_ns();
+	for (i = first; i < s->count; i++) {
+		e = &s->entries[i];
+		end = origin + (unsigned long long)
+		      ((e->start + e->duration - offset) / speed);
+
+		if (ud->overrun == OVERRUN_SKIP && i + 1 < s->count
+		    && (now = time_now_ns()) >= end) {
+			note_miss(ud, st, i, now - deadline, 1);
+			status_late(id, now - deadline, 0, 1);
+			deadline = end;
+			continue;
+		}
+
+		/* issue early by the write latency, so the value lands on time */
+		issue = deadline - write_lead(id, ud);
+		if (schedule_wait(issue, st))
+			break;
+		now = time_now_ns();
+		if (now > issue + tolerance)
+			note_miss(ud, st, i, now - issue, 0);
+		status_late(id, now > issue ? now - issue : 0,
+			    now > issue + tolerance, 0);
+
+		ud->attenuation = e->attenuation;
+		ud->atime = e->atime;
+		ud->ms = e->ms;
+		ud->us = e->us;
+		value = e->attenuation < min ? min
+			: e->attenuation > max ? max : e->attenuation;
+		write_attenuation(id, value);
+		log_attenuation(value, ud);
+		checkpoint_step(i, i == first ? offset : e->start, now,
+				e->start + e->duration, speed, serial, value);
+		note_step(st, i, value);
+		write_residual(id, i, deadline, ud);
+
+		if (ud->overrun == OVERRUN_STRETCH)
+			deadline = time_now_ns() + (unsigned long long)
+				   ((e->start + e->duration
+				     - (i == first ? offset : e->start)) / speed);
+		else
+			deadline = end;
+		status_step(id, i, s->count, deadline);
+	}
+	schedule_wait(deadline, st);
+
+	now = time_now_ns();
+	end = (unsigned long long)((s->length - offset) / speed);
+	if (now - origin > end)
+		st->drift = now - origin - end;
+
+	if (!ud->quiet)
+		report(INFO "played %lu of %lu steps, %lu late, %lu skipped, "
+		       "max lateness %.3f ms, drift %.3f ms\n", st->steps,
+		       s->count - first, st->missed, st->skipped,
+		       (double)st->max_late / NSEC_PER_MSEC,
+		       (double)st->drift / NSEC_PER_MSEC);
+	return 0;
+}
+
+/*
+ * free memory of a schedule
+ * @param s: schedule
+ */
+void
+schedule_free(struct schedule *s)
+{
+	free(s->entries);
+	memset(s, 0, sizeof(struct schedule));
+}
@@ -0,0 +1,65 @@
+#ifndef _SCHEDULE_H_
+#define _SCHEDULE_H_
+
+#include <pthread.h>
+#include "input.h"
+
+#define OVERRUN_STRETCH 0
+#define OVERRUN_CATCHUP 1
+#define OVERRUN_SKIP 2
+
+#define DEFAULT_TOLERANCE 1000
+#define STOP_POLL_NS 10000000ULL
+
+/*
+ * single row of a schedule file, start is the offset from the beginning of
+ * the schedule and serves as time index
+ */
+struct sched_entry
+{
+	unsigned long long start;
+	unsigned long long duration;
+	unsigned long atime;
+	int attenuation;
+	unsigned char ms;
+	unsigned char us;
+};
+
+struct schedule
+{
+	struct sched_entry *entries;
+	unsigned long count;
+	unsigned long size;
+	unsigned long long length;
+	unsigned long long shortest;
+	unsigned long long hash;
+};
+
+/*
+ * timing statistics of a schedule playback. If lock is set, the counters
+ * and the current step are updated with it held, so other threads can
+ * follow the playback. Setting stop ends the playback within STOP_POLL_NS.
+ */
+struct play_stats
+{
+	unsigned long steps;
+	unsigned long missed;
+	unsigned long skipped;
+	unsigned long long max_late;
+	unsigned long long drift;
+	unsigned long index;
+	int value;
+	volatile int stop;
+	pthread_mutex_t *lock;
+};
+
+int get_overrun_policy(char *name);
+int schedule_load(char *path, struct schedule *s, struct user_data *ud);
+unsigned long schedule_merge(struct schedule *s, unsigned long long floor);
+unsigned long schedule_seek(struct schedule *s, unsigned long long t);
+int schedule_wait(unsigned long long deadline, struct play_stats *st);
+int schedule_play(int id, struct schedule *s, struct user_data *ud,
+		  struct play_stats *st);
+void schedule_free(struct schedule *s);
+
+#endif
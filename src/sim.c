@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "sim.h"
+#include "timing.h"
+#include "control.h"
+#include "LDAhid.h"
+
+#define SIM_BUFFER (1 << 16)
+#define SIM_DROPS 16
+
+/*
+ * time a simulated device is gone from the bus
+ */
+struct sim_drop
+{
+	int serial;
+	unsigned long long at;
+	unsigned long long length;
+};
+
+static FILE *sim_fp;
+static pthread_mutex_t sim_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sim_drop drops[SIM_DROPS];
+static int drop_count;
+
+/*
+ * open the timeline every write of a simulation is recorded to. The devices
+ * are the simulated ones of the library's test mode.
+ * @param path: path to the timeline
+ * @return: 0 on success, 1 on error
+ */
+int
+sim_open(char *path)
+{
+	sim_fp = fopen(path, "w");
+	if (sim_fp == NULL) {
+		printf(ERR "unable to open %s for writing\n", path);
+		return 1;
+	}
+	setvbuf(sim_fp, NULL, _IOFBF, SIM_BUFFER);
+	fprintf(sim_fp, "#time,serial,attenuation\n");
+	atexit(sim_close);
+	return 0;
+}
+
+/*
+ * switch to the virtual clock if a simulation is recorded, the calling
+ * thread is the one playing
+ */
+void
+sim_start(void)
+{
+	if (sim_fp)
+		time_sim_start();
+}
+
+/*
+ * record a write with the virtual time since the start of the simulation
+ * @param id: device id
+ * @param value: attenuation in MULTIPLIER_STEP units
+ */
+void
+sim_record(int id, int value)
+{
+	struct timespec ts;
+
+	if (sim_fp == NULL)
+		return;
+	time_realtime(&ts);
+	pthread_mutex_lock(&sim_lock);
+	fprintf(sim_fp, "%u.%09u,%d,%.2f\n", (unsigned int)ts.tv_sec,
+		(unsigned int)ts.tv_nsec, fnLDA_GetSerialNumber(id),
+		(double)value / MULTIPLIER_STEP);
+	pthread_mutex_unlock(&sim_lock);
+}
+
+/*
+ * let a simulated device drop off the bus for a while
+ * @param spec: <serial>:<start in s>:<length in s>, start from the
+ *              beginning of the playback
+ * @return: 0 on success, 1 on error
+ */
+int
+sim_drop(char *spec)
+{
+	double at, length;
+	int serial;
+
+	if (drop_count == SIM_DROPS) {
+		printf(ERR "at most %d device drops can be simulated\n",
+		       SIM_DROPS);
+		return 1;
+	}
+	if (sscanf(spec, "%d:%lf:%lf", &serial, &at, &length) != 3
+	    || at < 0 || length <= 0) {
+		printf(ERR "device drop has to be <serial>:<start>:<length>: "
+		       "%s\n", spec);
+		return 1;
+	}
+	drops[drop_count].serial = serial;
+	drops[drop_count].at = (unsigned long long)(at * NSEC_PER_SEC);
+	drops[drop_count].length = (unsigned long long)(length * NSEC_PER_SEC);
+	drop_count++;
+	return 0;
+}
+
+/*
+ * check if a device is on the bus, simulated devices may be dropped
+ * @param id: device id
+ * @return: 0 if the device is dropped, else 1
+ */
+int
+sim_present(int id)
+{
+	unsigned long long now;
+	int i, serial;
+
+	if (drop_count == 0 || !time_is_virtual())
+		return 1;
+	now = time_now_ns() - VCLOCK_EPOCH;
+	serial = fnLDA_GetSerialNumber(id);
+	for (i = 0; i < drop_count; i++)
+		if (drops[i].serial == serial && now >= drops[i].at
+		    && now < drops[i].at + drops[i].length)
+			return 0;
+	return 1;
+}
+
+/*
+ * flush and close the timeline
+ */
+void
+sim_close(void)
+{
+	pthread_mutex_lock(&sim_lock);
+	if (sim_fp)
+		fclose(sim_fp);
+	sim_fp = NULL;
+	pthread_mutex_unlock(&sim_lock);
+}
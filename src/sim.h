@@ -0,0 +1,11 @@
+#ifndef _SIM_H_
+#define _SIM_H_
+
+int sim_open(char *path);
+void sim_start(void);
+void sim_record(int id, int value);
+int sim_drop(char *spec);
+int sim_present(int id);
+void sim_close(void);
+
+#endif
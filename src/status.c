@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "status.h"
+#include "timing.h"
+#include "control.h"
+#include "LDAhid.h"
+
+static struct status_page *page;
+static char page_name[MAX_LENGTH];
+
+/*
+ * create the shared memory status page. Until it is opened all status
+ * updates are no-ops. The serial numbers of the devices are filled in
+ * here, so updates never call into the SDK.
+ * @param name: name of the shared memory object, like /attenuator, NULL
+ *              for a page private to this process
+ * @return: 0 on success, 1 on error
+ */
+int
+status_open(const char *name)
+{
+	DEVID list[MAXDEVICES];
+	void *addr;
+	int fd, i, n;
+
+	if (page)
+		return 0;
+
+	if (name == NULL) {
+		addr = mmap(NULL, sizeof(struct status_page),
+			    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+			    -1, 0);
+		if (addr == MAP_FAILED) {
+			printf(ERR "unable to map status page\n");
+			return 1;
+		}
+		page_name[0] = '\0';
+	} else {
+		fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+		if (fd < 0) {
+			printf(ERR "unable to create shared memory status %s\n",
+			       name);
+			return 1;
+		}
+		if (ftruncate(fd, sizeof(struct status_page))) {
+			printf(ERR "unable to size shared memory status %s\n",
+			       name);
+			close(fd);
+			return 1;
+		}
+		addr = mmap(NULL, sizeof(struct status_page),
+			    PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (addr == MAP_FAILED) {
+			printf(ERR "unable to map shared memory status %s\n",
+			       name);
+			return 1;
+		}
+		strncpy(page_name, name, MAX_LENGTH - 1);
+	}
+
+	memset(addr, 0, sizeof(struct status_page));
+	page = addr;
+	page->version = STATUS_VERSION;
+	page->nr_slots = STATUS_SLOTS;
+	page->pid = getpid();
+	n = fnLDA_GetDevInfo(list);
+	for (i = 0; i < n; i++)
+		if (list[i] > 0 && list[i] <= STATUS_SLOTS)
+			page->devices[list[i] - 1].serial =
+				fnLDA_GetSerialNumber(list[i]);
+	__sync_synchronize();
+	page->magic = STATUS_MAGIC;
+	return 0;
+}
+
+/*
+ * status page of this process, NULL if none is open
+ */
+struct status_page *
+status_page(void)
+{
+	return page;
+}
+
+/*
+ * mark all devices as stopped and remove the name of the status page. The
+ * page stays mapped for threads which may still update it until the
+ * program exits.
+ */
+void
+status_unlink(void)
+{
+	int i;
+
+	if (page == NULL)
+		return;
+	for (i = 0; i < STATUS_SLOTS; i++)
+		page->devices[i].running = 0;
+	if (page_name[0])
+		shm_unlink(page_name);
+	page_name[0] = '\0';
+}
+
+/*
+ * mark all devices as stopped and remove the status page, nothing may
+ * update it anymore
+ */
+void
+status_close(void)
+{
+	if (page == NULL)
+		return;
+	status_unlink();
+	munmap(page, sizeof(struct status_page));
+	page = NULL;
+}
+
+/*
+ * get the slot of a device and start an update of it. A slot is only
+ * updated by the thread stepping the device, so seq is only odd while an
+ * update is in progress and the writer never waits.
+ */
+static struct dev_status *
+slot_begin(int id)
+{
+	struct dev_status *s;
+
+	if (page == NULL || id < 1 || id > STATUS_SLOTS)
+		return NULL;
+	s = &page->devices[id - 1];
+	__sync_fetch_and_add(&s->seq, 1);
+	return s;
+}
+
+static void
+slot_end(struct dev_status *s)
+{
+	s->updated = time_now_ns();
+	__sync_fetch_and_add(&s->seq, 1);
+}
+
+/*
+ * note a value written to a device
+ * @param id: device id
+ * @param value: attenuation in MULTIPLIER_STEP units
+ * @param error: 1 if the device reported an error, 2 if the write was
+ *               skipped for a lost device, which is set to the value when
+ *               it is back
+ */
+void
+status_write(int id, int value, int error)
+{
+	struct dev_status *s = slot_begin(id);
+
+	if (s == NULL)
+		return;
+	s->running = 1;
+	s->writes++;
+	if (error)
+		s->errors++;
+	if (error != 1)
+		s->attenuation = value;
+	slot_end(s);
+}
+
+/*
+ * note the step a device is at
+ * @param id: device id
+ * @param index: index of the step
+ * @param count: number of steps, 0 if unknown
+ * @param next: deadline of the next step
+ */
+void
+status_step(int id, unsigned long index, unsigned long count,
+	    unsigned long long next)
+{
+	struct dev_status *s = slot_begin(id);
+
+	if (s == NULL)
+		return;
+	s->index = index;
+	s->count = count;
+	s->next_deadline = next;
+	s->steps++;
+	slot_end(s);
+}
+
+/*
+ * note the lateness of a step
+ * @param id: device id
+ * @param late: lateness in nanoseconds
+ * @param missed: 1 if the step missed its deadline
+ * @param skipped: 1 if the step was dropped
+ */
+void
+status_late(int id, unsigned long long late, int missed, int skipped)
+{
+	struct dev_status *s = slot_begin(id);
+
+	if (s == NULL)
+		return;
+	s->last_late = late;
+	if (late > s->max_late)
+		s->max_late = late;
+	s->missed += missed;
+	s->skipped += skipped;
+	slot_end(s);
+}
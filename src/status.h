@@ -0,0 +1,122 @@
+#ifndef _STATUS_H_
+#define _STATUS_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#define STATUS_MAGIC 0x4c414253
+#define STATUS_VERSION 1
+#define STATUS_SLOTS 64
+/* reads of a slot held odd by a writer before status_read() gives up */
+#define STATUS_READ_TRIES 1000000
+
+/*
+ * live state of a device in shared memory. Each slot has a single writer,
+ * the thread stepping the device. seq is odd while it updates the slot,
+ * readers copy the slot and retry if seq was odd or changed meanwhile, see
+ * status_read(). Times are CLOCK_MONOTONIC nanoseconds, attenuation is in
+ * 0.05dB units. All fields have fixed sizes, so 32 and 64 bit monitors read
+ * the same layout.
+ */
+struct dev_status
+{
+	uint32_t seq;
+	int32_t serial;
+	int32_t attenuation;
+	uint32_t running;
+	uint64_t index;
+	uint64_t count;
+	uint64_t next_deadline;
+	uint64_t updated;
+	uint64_t writes;
+	uint64_t steps;
+	uint64_t missed;
+	uint64_t skipped;
+	uint64_t last_late;
+	uint64_t max_late;
+	uint64_t errors;
+};
+
+struct status_page
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nr_slots;
+	int32_t pid;
+	struct dev_status devices[STATUS_SLOTS];
+};
+
+int status_open(const char *name);
+void status_close(void);
+void status_unlink(void);
+struct status_page *status_page(void);
+void status_write(int id, int value, int error);
+void status_step(int id, unsigned long index, unsigned long count,
+		 unsigned long long next);
+void status_late(int id, unsigned long long late, int missed, int skipped);
+
+/*
+ * readers below only need this header, so monitors do not have to link
+ * against the vendor library
+ */
+
+/*
+ * map the status page of a running instance read only
+ * @param name: name of the shared memory object
+ * @return: status page, NULL on error
+ */
+static inline struct status_page *
+status_attach(const char *name)
+{
+	struct status_page *p;
+	int fd;
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+		return NULL;
+	p = mmap(NULL, sizeof(struct status_page), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return NULL;
+	if (p->magic != STATUS_MAGIC || p->version != STATUS_VERSION) {
+		munmap(p, sizeof(struct status_page));
+		return NULL;
+	}
+	return p;
+}
+
+/*
+ * take a consistent copy of a device slot without blocking the writer. A
+ * slot which stays odd, like after the writer died during an update, is
+ * given up on instead of waiting for it forever.
+ * @param page: attached status page
+ * @param slot: slot to read, device id - 1
+ * @param copy: storage for the copy
+ * @return: 0 on success, 1 if the slot does not exist, 2 if it stayed busy
+ */
+static inline int
+status_read(struct status_page *page, int slot, struct dev_status *copy)
+{
+	volatile struct dev_status *s;
+	unsigned long tries = 0;
+	uint32_t seq;
+
+	if (slot < 0 || slot >= STATUS_SLOTS)
+		return 1;
+	s = &page->devices[slot];
+
+	do {
+		while ((seq = s->seq) & 1)
+			if (++tries >= STATUS_READ_TRIES)
+				return 2;
+		__sync_synchronize();
+		memcpy(copy, (const void *)s, sizeof(struct dev_status));
+		__sync_synchronize();
+	} while (s->seq != seq && ++tries < STATUS_READ_TRIES);
+	return s->seq == seq ? 0 : 2;
+}
+
+#endif
@@ -0,0 +1,286 @@
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include "timing.h"
+
+/*
+ * virtual clock of a simulation. Time only moves when every thread taking
+ * part in the simulation sleeps, it then jumps to the earliest deadline.
+ * Threads outside of it, like the logger or the console, keep sleeping on
+ * the real clock for short moments. Helpers, like the health monitor, sleep
+ * on the virtual clock as well but do not keep it going on their own.
+ */
+struct vclock_waiter
+{
+	unsigned long long deadline;
+	struct vclock_waiter *next;
+};
+
+static struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int on;
+	unsigned long long now;
+	int members;
+	int helpers;
+	int sleeping;
+	struct vclock_waiter *waiters;
+} vclock = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+static __thread int vclock_member;
+static __thread int vclock_helper;
+
+/*
+ * move the virtual clock to the earliest deadline once all members sleep,
+ * has to be called with the lock held
+ */
+static void
+vclock_advance(void)
+{
+	struct vclock_waiter *w, **prev;
+	unsigned long long next = ~0ULL;
+
+	/* helpers left alone are woken to see they are done */
+	if (vclock.members <= vclock.helpers) {
+		pthread_cond_broadcast(&vclock.cond);
+		return;
+	}
+	if (vclock.sleeping < vclock.members || vclock.waiters == NULL)
+		return;
+
+	for (w = vclock.waiters; w; w = w->next)
+		if (w->deadline < next)
+			next = w->deadline;
+	__atomic_store_n(&vclock.now, next, __ATOMIC_RELEASE);
+
+	/* woken waiters are taken off here, so nobody advances twice */
+	for (prev = &vclock.waiters; (w = *prev);) {
+		if (w->deadline <= next) {
+			*prev = w->next;
+			vclock.sleeping--;
+		} else {
+			prev = &w->next;
+		}
+	}
+	pthread_cond_broadcast(&vclock.cond);
+}
+
+/*
+ * sleep on the virtual clock
+ * @param deadline: virtual time to wake up in nanoseconds
+ */
+static void
+vclock_sleep(unsigned long long deadline)
+{
+	struct vclock_waiter w, **prev;
+	struct timespec ts;
+	unsigned long long now;
+	int alone;
+
+	if (!vclock_member) {
+		now = __atomic_load_n(&vclock.now, __ATOMIC_ACQUIRE);
+		if (deadline <= now)
+			return;
+		if (deadline - now > VCLOCK_POLL_NS)
+			deadline = now + VCLOCK_POLL_NS;
+		ts.tv_sec = (deadline - now) / NSEC_PER_SEC;
+		ts.tv_nsec = (deadline - now) % NSEC_PER_SEC;
+		nanosleep(&ts, NULL);
+		return;
+	}
+
+	pthread_mutex_lock(&vclock.lock);
+	if (deadline > vclock.now && vclock.members > vclock.helpers) {
+		w.deadline = deadline;
+		w.next = vclock.waiters;
+		vclock.waiters = &w;
+		vclock.sleeping++;
+		vclock_advance();
+		while (vclock.now < deadline && vclock.members > vclock.helpers)
+			pthread_cond_wait(&vclock.cond, &vclock.lock);
+		if (vclock.now < deadline) {
+			for (prev = &vclock.waiters; *prev != &w;
+			     prev = &(*prev)->next)
+				;
+			*prev = w.next;
+			vclock.sleeping--;
+		}
+	}
+	alone = deadline > vclock.now;
+	pthread_mutex_unlock(&vclock.lock);
+
+	/* nothing moves the clock anymore until the helper is stopped */
+	if (alone) {
+		ts.tv_sec = 0;
+		ts.tv_nsec = VCLOCK_POLL_NS;
+		nanosleep(&ts, NULL);
+	}
+}
+
+/*
+ * switch to the virtual clock, the calling thread takes part in the
+ * simulation. Time starts at VCLOCK_EPOCH, so steps issued early by the
+ * write latency do not wrap around.
+ */
+void
+time_sim_start(void)
+{
+	pthread_mutex_lock(&vclock.lock);
+	vclock.now = VCLOCK_EPOCH;
+	vclock.members = 1;
+	vclock.helpers = 0;
+	vclock.sleeping = 0;
+	vclock.waiters = NULL;
+	vclock_member = 1;
+	__atomic_store_n(&vclock.on, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&vclock.lock);
+}
+
+/*
+ * check if the virtual clock is used
+ * @return: 1 if the virtual clock is used, else 0
+ */
+int
+time_is_virtual(void)
+{
+	return __atomic_load_n(&vclock.on, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * announce threads which are about to take part in the simulation. The
+ * clock does not move until they have called time_sim_enter() and sleep.
+ * Nothing is done without a virtual clock.
+ * @param n: number of threads, negative if they did not start
+ */
+void
+time_sim_add(int n)
+{
+	if (!time_is_virtual())
+		return;
+	pthread_mutex_lock(&vclock.lock);
+	vclock.members += n;
+	vclock_advance();
+	pthread_mutex_unlock(&vclock.lock);
+}
+
+/*
+ * let the calling thread take part in the simulation, it has to be
+ * announced with time_sim_add() by the thread creating it
+ */
+void
+time_sim_enter(void)
+{
+	if (time_is_virtual())
+		vclock_member = 1;
+}
+
+/*
+ * let the calling thread take part in the simulation as a helper, which
+ * does not keep the clock going once all other members left. It has to be
+ * announced with time_sim_add() like any member.
+ */
+void
+time_sim_enter_helper(void)
+{
+	if (!time_is_virtual())
+		return;
+	pthread_mutex_lock(&vclock.lock);
+	vclock_member = 1;
+	vclock_helper = 1;
+	vclock.helpers++;
+	pthread_mutex_unlock(&vclock.lock);
+}
+
+/*
+ * leave the simulation, has to be called before a member waits for
+ * anything else than the clock, like joining other members
+ */
+void
+time_sim_leave(void)
+{
+	if (!time_is_virtual() || !vclock_member)
+		return;
+	vclock_member = 0;
+	if (vclock_helper) {
+		pthread_mutex_lock(&vclock.lock);
+		vclock.helpers--;
+		pthread_mutex_unlock(&vclock.lock);
+		vclock_helper = 0;
+	}
+	time_sim_add(-1);
+}
+
+/*
+ * get the wall clock time used for timestamps in logs. With the virtual
+ * clock it is the simulated time since the start, so runs can be compared.
+ * @param ts: storage for the time
+ */
+void
+time_realtime(struct timespec *ts)
+{
+	unsigned long long now;
+
+	if (!time_is_virtual()) {
+		clock_gettime(CLOCK_REALTIME, ts);
+		return;
+	}
+	now = time_now_ns() - VCLOCK_EPOCH;
+	ts->tv_sec = now / NSEC_PER_SEC;
+	ts->tv_nsec = now % NSEC_PER_SEC;
+}
+
+/*
+ * get current time of the monotonic clock, or of the virtual clock in a
+ * simulation
+ * @return: time in nanoseconds
+ */
+unsigned long long
+time_now_ns(void)
+{
+	struct timespec ts;
+
+	if (time_is_virtual())
+		return __atomic_load_n(&vclock.now, __ATOMIC_ACQUIRE);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/*
+ * sleep until an absolute point in time of the monotonic clock is reached.
+ * Sleeping on absolute deadlines keeps errors from adding up over many steps.
+ * @param deadline: time to wake up in nanoseconds
+ */
+void
+time_sleep_until_ns(unsigned long long deadline)
+{
+	struct timespec ts;
+
+	if (time_is_virtual()) {
+		vclock_sleep(deadline);
+		return;
+	}
+	ts.tv_sec = deadline / NSEC_PER_SEC;
+	ts.tv_nsec = deadline % NSEC_PER_SEC;
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+/*
+ * get length of the time unit set by the user
+ * @param ud: user data struct
+ * @return: nanoseconds per time unit
+ */
+unsigned long long
+time_unit_ns(struct user_data *ud)
+{
+	if (ud->us == 1)
+		return NSEC_PER_USEC;
+	else if (ud->ms == 1)
+		return NSEC_PER_MSEC;
+	return NSEC_PER_SEC;
+}
@@ -0,0 +1,26 @@
+#ifndef _TIMING_H_
+#define _TIMING_H_
+
+#include <time.h>
+#include "input.h"
+
+#define NSEC_PER_USEC 1000ULL
+#define NSEC_PER_MSEC 1000000ULL
+#define NSEC_PER_SEC 1000000000ULL
+
+/* start of the virtual clock and longest real sleep of other threads */
+#define VCLOCK_EPOCH (3600 * NSEC_PER_SEC)
+#define VCLOCK_POLL_NS NSEC_PER_MSEC
+
+unsigned long long time_now_ns(void);
+void time_sleep_until_ns(unsigned long long deadline);
+unsigned long long time_unit_ns(struct user_data *ud);
+void time_sim_start(void);
+int time_is_virtual(void);
+void time_sim_add(int n);
+void time_sim_enter(void);
+void time_sim_enter_helper(void);
+void time_sim_leave(void);
+void time_realtime(struct timespec *ts);
+
+#endif
@@ -0,0 +1,142 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "verify.h"
+#include "status.h"
+#include "timing.h"
+#include "control.h"
+#include "LDAhid.h"
+
+static pthread_t verify_thread;
+static volatile int verify_running;
+static struct user_data *verify_ud;
+static unsigned long checked, mismatches, deferred;
+
+/*
+ * read back the attenuation of a device and compare it to the value last
+ * written. The device is skipped if a write is due soon, the readback is
+ * dropped if a write happened while reading. The SDK has no uncached read,
+ * fnLDA_GetAttenuation() returns the value of the last status report of
+ * the device, which the SDK also sets on every write. A mismatch thus
+ * shows a device that reported another value since, e.g. after a reset,
+ * but a write lost on the way may go unnoticed until the next report.
+ * @param page: status page
+ * @param slot: slot of the device
+ */
+static void
+verify_device(struct status_page *page, int slot)
+{
+	struct dev_status before, after;
+	unsigned long long now, guard;
+	int value;
+
+	if (status_read(page, slot, &before) || before.writes == 0)
+		return;
+
+	/* a readback takes about as long as a write */
+	now = time_now_ns();
+	guard = VERIFY_GUARD_NS + 2 * write_latency(slot + 1);
+	if (before.next_deadline && before.next_deadline < now + guard) {
+		deferred++;
+		return;
+	}
+
+	value = fnLDA_GetAttenuation(slot + 1);
+	if (status_read(page, slot, &after)
+	    || after.writes != before.writes) {
+		deferred++;
+		return;
+	}
+
+	checked++;
+	if (value != (int)before.attenuation) {
+		mismatches++;
+		log_mismatch(before.serial, before.attenuation, value, verify_ud);
+	}
+}
+
+/*
+ * check all devices with a slot on the status page at the verify rate
+ */
+static void *
+verify_loop(void *arg)
+{
+	struct status_page *page = arg;
+	unsigned long long deadline, period;
+	sigset_t set;
+	int i;
+
+	/* signals are handled by the threads of the program */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	/*
+	 * writes always win the cpu against readbacks. The thread stays in
+	 * SCHED_OTHER, at idle priority it may starve for long on a loaded
+	 * system.
+	 */
+	setpriority(PRIO_PROCESS, syscall(SYS_gettid), VERIFY_NICE);
+
+	period = NSEC_PER_SEC / verify_ud->verify_rate;
+	deadline = time_now_ns();
+	while (verify_running) {
+		deadline += period;
+		time_sleep_until_ns(deadline);
+		for (i = 0; i < STATUS_SLOTS && verify_running; i++)
+			verify_device(page, i);
+	}
+	return NULL;
+}
+
+/*
+ * compare the attenuation read back from all devices to the value last
+ * written at a low rate in a thread of its own. Mismatches are counted and
+ * logged with time stamp if a log file is set, the write path is never
+ * held up by the checks.
+ * @param ud: user data struct with verify rate and log file
+ * @return: 0 on success, 1 on error
+ */
+int
+verify_start(struct user_data *ud)
+{
+	struct status_page *page;
+
+	page = status_page();
+	if (page == NULL) {
+		printf(ERR "readback verification needs a status page\n");
+		return 1;
+	}
+
+	verify_ud = ud;
+	checked = mismatches = deferred = 0;
+	verify_running = 1;
+	if (pthread_create(&verify_thread, NULL, verify_loop, page)) {
+		printf(ERR "unable to start readback verification thread\n");
+		verify_running = 0;
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * end the readback verification and report its counts
+ */
+void
+verify_stop(void)
+{
+	if (!verify_running)
+		return;
+	verify_running = 0;
+	pthread_join(verify_thread, NULL);
+
+	if (mismatches)
+		printf(WARN "%lu of %lu readbacks differed from the value "
+		       "written\n", mismatches, checked);
+	else if (!verify_ud->quiet)
+		printf(INFO "verified %lu readbacks, %lu deferred for writes\n",
+		       checked, deferred);
+}
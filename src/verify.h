@@ -0,0 +1,14 @@
+#ifndef _VERIFY_H_
+#define _VERIFY_H_
+
+#include "input.h"
+
+/* no readback if a write is due within this time */
+#define VERIFY_GUARD_NS 2000000ULL
+/* niceness of the readback thread, writes always win the cpu */
+#define VERIFY_NICE 10
+
+int verify_start(struct user_data *ud);
+void verify_stop(void);
+
+#endif